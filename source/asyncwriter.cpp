@@ -0,0 +1,255 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Buffered asynchronous output files.
+
+*/
+
+#include "asyncwriter.h"
+#include <new>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+AsyncWriterSettings::AsyncWriterSettings()
+{
+    bufferBytes = ASYNC_WRITER_BUFFER_BYTES;
+    directIO = false;
+}
+
+AsyncWriter::AsyncWriter(const std::string& fileName, const AsyncWriterSettings& settings, uint64_t expectedBytes)
+: fd(-1), direct(false), active(0), handed(0), stalled(0), pendingData(nullptr), pendingBytes(0),
+  busy(false), stopping(false), failed(false), fileOffset(0)
+{
+    bufferBytes = std::max<size_t>(1, (settings.bufferBytes + ASYNC_WRITER_ALIGNMENT - 1) / ASYNC_WRITER_ALIGNMENT) * ASYNC_WRITER_ALIGNMENT;
+
+    const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+#ifdef O_DIRECT
+    if (settings.directIO)
+    {
+        fd = ::open(fileName.c_str(), flags | O_DIRECT, 0666);
+        direct = fd >= 0;
+    }
+#endif
+    if (fd < 0)
+        fd = ::open(fileName.c_str(), flags, 0666);
+    if (fd < 0)
+        return;
+
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+    // Reserve the blocks without changing the size, so a short file is not
+    // left padded if less is written than expected
+    if (expectedBytes > 0)
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)expectedBytes);
+#else
+    (void)expectedBytes;
+#endif
+
+    for (auto& buffer : buffers)
+    {
+        void* memory = nullptr;
+        if (posix_memalign(&memory, ASYNC_WRITER_ALIGNMENT, bufferBytes) != 0)
+            throw std::bad_alloc();
+        buffer.reset(static_cast<char*>(memory));
+    }
+    setp(buffers[0].get(), buffers[0].get() + bufferBytes);
+    flusher = std::thread(&AsyncWriter::flushLoop, this);
+}
+
+AsyncWriter::~AsyncWriter()
+{
+    if (fd >= 0)
+        close();
+}
+
+bool AsyncWriter::close()
+{
+    if (fd < 0)
+        return false;
+
+    hand(pptr() - pbase());
+    waitIdle();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    changed.notify_all();
+    flusher.join();
+
+    bool ok = !failed;
+    if (::close(fd) != 0)
+        ok = false;
+    fd = -1;
+
+    // Anything put after closing goes to overflow, which refuses it
+    setp(nullptr, nullptr);
+    return ok;
+}
+
+AsyncWriter::int_type AsyncWriter::overflow(int_type c)
+{
+    if (fd < 0)
+        return traits_type::eof();
+
+    hand(pptr() - pbase());
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+std::streamsize AsyncWriter::xsputn(const char* data, std::streamsize count)
+{
+    if (fd < 0)
+        return 0;
+
+    std::streamsize done = 0;
+    while (done < count)
+    {
+        size_t room = epptr() - pptr();
+        if (room == 0)
+        {
+            hand(bufferBytes);
+            continue;
+        }
+        // pbump takes an int, so buffers of 2 GB or more are filled in steps
+        size_t n = std::min<size_t>(std::min<size_t>(room, count - done), INT_MAX);
+        std::memcpy(pptr(), data + done, n);
+        pbump((int)n);
+        done += n;
+    }
+    return done;
+}
+
+// Gives the filled part of the active buffer to the background thread and
+// continues in the other buffer
+void AsyncWriter::hand(size_t count)
+{
+    if (count == 0)
+        return;
+
+    waitIdle();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        pendingData = buffers[active].get();
+        pendingBytes = count;
+        busy = true;
+    }
+    changed.notify_all();
+
+    handed += count;
+    active ^= 1;
+    setp(buffers[active].get(), buffers[active].get() + bufferBytes);
+}
+
+void AsyncWriter::waitIdle()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    if (!busy)
+        return;
+    auto start = std::chrono::steady_clock::now();
+    changed.wait(guard, [this]() { return !busy; });
+    stalled += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void AsyncWriter::flushLoop()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;)
+    {
+        changed.wait(guard, [this]() { return busy || stopping; });
+        if (!busy)
+            return;
+
+        const char* data = pendingData;
+        size_t count = pendingBytes;
+        guard.unlock();
+        bool ok = writeOut(data, count);
+        guard.lock();
+
+        if (!ok)
+            failed = true;
+        busy = false;
+        changed.notify_all();
+    }
+}
+
+// Writes a buffer at the end of the file.  Only the last buffer of a file can
+// be a partial one, with direct I/O its unaligned tail is written through the
+// page cache.
+bool AsyncWriter::writeOut(const char* data, size_t count)
+{
+    size_t done = 0;
+    while (done < count)
+    {
+        size_t n = count - done;
+#ifdef O_DIRECT
+        if (direct && n % ASYNC_WRITER_ALIGNMENT != 0)
+        {
+            n -= n % ASYNC_WRITER_ALIGNMENT;
+            if (n == 0)
+            {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+                direct = false;
+                continue;
+            }
+        }
+#endif
+        ssize_t written = pwrite(fd, data + done, n, (off_t)fileOffset);
+        if (written < 0 && errno == EINTR)
+            continue;
+#ifdef O_DIRECT
+        if (written < 0 && errno == EINVAL && direct)
+        {
+            // The filesystem accepted O_DIRECT at open but not for writing
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            direct = false;
+            continue;
+        }
+#endif
+        if (written <= 0)
+            return false;
+        done += (size_t)written;
+        fileOffset += (uint64_t)written;
+    }
+    return true;
+}
+
+AsyncOutputFile::AsyncOutputFile(const std::string& fileName, const AsyncWriterSettings& settings, uint64_t expectedBytes)
+: std::ostream(nullptr), fileName(fileName), writer(fileName, settings, expectedBytes)
+{
+    rdbuf(&writer);
+    if (!writer.isOpen())
+        setstate(std::ios::failbit);
+}
+
+void AsyncOutputFile::close()
+{
+    if (!writer.close())
+    {
+        setstate(std::ios::badbit);
+        throw std::runtime_error("Could not write " + fileName);
+    }
+}
@@ -0,0 +1,150 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Buffered asynchronous output files.
+
+    The scratch files and results were written with std::ofstream, in
+    records of a few dozen bytes and lines ended with std::endl, which
+    flushed every line to the filesystem on the thread doing the work.
+    An AsyncWriter is a stream buffer with two large buffers: the caller
+    fills one while a background thread writes the other, so formatting
+    and writing overlap and the caller only waits when it fills a buffer
+    before the previous one is on disk, or when it closes the file.
+
+    Flushing the stream does not force a write, the buffers are written
+    when they are full and when the file is closed.  When the final size
+    of the file is known it is reserved up front with fallocate, and with
+    direct I/O the full buffers bypass the page cache through O_DIRECT.
+    Direct I/O is off by default since the scratch files are read back by
+    the next stage, which is faster from the page cache, and a filesystem
+    which refuses O_DIRECT is written through the page cache instead.
+
+    AsyncOutputFile is a std::ostream over an AsyncWriter, so the existing
+    text and binary writers keep their formatting unchanged.  A write which
+    fails in the background is only reported when the file is closed.
+
+*/
+#ifndef ASYNCWRITER_H
+#define ASYNCWRITER_H
+
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <streambuf>
+#include <ostream>
+#include <cstdint>
+#include <cstdlib>
+
+// The default size of each of the two buffers
+#define ASYNC_WRITER_BUFFER_BYTES (4 << 20)
+
+// Buffers, and with direct I/O the offsets and sizes written, are multiples
+// of this many bytes
+#define ASYNC_WRITER_ALIGNMENT 4096
+
+struct AsyncWriterSettings
+{
+    size_t bufferBytes;
+    bool directIO;
+
+    AsyncWriterSettings();
+};
+
+class AsyncWriter : public std::streambuf
+{
+public:
+    // Creates or truncates the file.  expectedBytes, when it is known, is
+    // reserved with fallocate before anything is written.
+    AsyncWriter(const std::string& fileName, const AsyncWriterSettings& settings = AsyncWriterSettings(), uint64_t expectedBytes = 0);
+    ~AsyncWriter();
+
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    bool isOpen() const { return fd >= 0; }
+
+    // Writes out what is buffered, waits for the background thread and closes
+    // the file.  Returns false if any write failed.
+    bool close();
+
+    // The number of bytes put into the writer so far
+    uint64_t bytes() const { return handed + (pptr() - pbase()); }
+
+    // The time the caller spent waiting for the background thread
+    double stallSeconds() const { return stalled; }
+
+    bool usingDirectIO() const { return direct; }
+
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char* data, std::streamsize count) override;
+
+private:
+    struct FreeBuffer
+    {
+        void operator()(char* p) const { std::free(p); }
+    };
+
+    int fd;
+    std::atomic<bool> direct;     // Cleared by the background thread
+    size_t bufferBytes;
+    std::unique_ptr<char, FreeBuffer> buffers[2];
+    size_t active;
+    uint64_t handed;
+    double stalled;
+
+    // The buffer handed to the background thread, if any
+    std::thread flusher;
+    std::mutex lock;
+    std::condition_variable changed;
+    const char* pendingData;
+    size_t pendingBytes;
+    bool busy;
+    bool stopping;
+    bool failed;
+    uint64_t fileOffset;
+
+    void hand(size_t count);
+    void waitIdle();
+    void flushLoop();
+    bool writeOut(const char* data, size_t count);
+};
+
+// An output stream which writes through an AsyncWriter
+class AsyncOutputFile : public std::ostream
+{
+public:
+    AsyncOutputFile(const std::string& fileName, const AsyncWriterSettings& settings = AsyncWriterSettings(), uint64_t expectedBytes = 0);
+
+    bool is_open() const { return writer.isOpen(); }
+    uint64_t bytes() const { return writer.bytes(); }
+
+    // Closes the file, setting the badbit and throwing std::runtime_error if
+    // any write failed.  A file which is only destroyed is closed without
+    // reporting failures, so every writer closes its files explicitly.
+    void close();
+
+private:
+    std::string fileName;
+    AsyncWriter writer;
+};
+
+#endif
@@ -0,0 +1,181 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Columnar per-point attributes and mergeable per-voxel attribute aggregates.
+
+*/
+
+#include "attributes.h"
+#include <string>
+#include <limits>
+#include <algorithm>
+#include <iomanip>
+
+const char* VOXEL_ATTRIBUTE_COLUMNS = "count,intensity_sum,intensity_sum_sq,intensity_min,intensity_max,"
+                                      "z_sum,z_sum_sq,z_min,z_max,first_returns,last_returns";
+
+AttributeColumns::AttributeColumns()
+{
+    intensity = -1;
+    returnNumber = -1;
+    numberOfReturns = -1;
+}
+
+void PointAttributes::push_back(float i, uint8_t r, uint8_t n)
+{
+    intensity.push_back(i);
+    returnNumber.push_back(r);
+    numberOfReturns.push_back(n);
+}
+
+void PointAttributes::append(const PointAttributes& other, size_t index)
+{
+    push_back(other.intensity[index], other.returnNumber[index], other.numberOfReturns[index]);
+}
+
+void PointAttributes::pushPacked(double i, double packedReturns)
+{
+    int packed = static_cast<int>(packedReturns);
+    push_back(static_cast<float>(i), static_cast<uint8_t>(packed / 256), static_cast<uint8_t>(packed % 256));
+}
+
+void PointAttributes::clear()
+{
+    intensity.clear();
+    returnNumber.clear();
+    numberOfReturns.clear();
+}
+
+void PointAttributes::moveElement(size_t from, size_t to)
+{
+    intensity[to] = intensity[from];
+    returnNumber[to] = returnNumber[from];
+    numberOfReturns[to] = numberOfReturns[from];
+}
+
+void PointAttributes::pop_back()
+{
+    intensity.pop_back();
+    returnNumber.pop_back();
+    numberOfReturns.pop_back();
+}
+
+void PointAttributes::resize(size_t n)
+{
+    intensity.resize(n);
+    returnNumber.resize(n);
+    numberOfReturns.resize(n);
+}
+
+void ParseAttributes(const std::vector<std::string>& tokens, const AttributeColumns& columns, PointAttributes& attributes)
+{
+    auto column = [&tokens](int index) { return index >= 0 && index < (int)tokens.size() ? std::stod(tokens[index]) : 0.0; };
+
+    attributes.push_back(static_cast<float>(column(columns.intensity)),
+                         static_cast<uint8_t>(column(columns.returnNumber)),
+                         static_cast<uint8_t>(column(columns.numberOfReturns)));
+}
+
+VoxelAttributes::VoxelAttributes()
+{
+    count = 0;
+    intensitySum = 0;
+    intensitySumSquares = 0;
+    intensityMin = std::numeric_limits<double>::max();
+    intensityMax = std::numeric_limits<double>::lowest();
+    zSum = 0;
+    zSumSquares = 0;
+    zMin = std::numeric_limits<double>::max();
+    zMax = std::numeric_limits<double>::lowest();
+    firstReturns = 0;
+    lastReturns = 0;
+}
+
+void VoxelAttributes::add(double z, float intensity, uint8_t returnNumber, uint8_t numberOfReturns)
+{
+    count++;
+    intensitySum += intensity;
+    intensitySumSquares += (double)intensity * intensity;
+    intensityMin = std::min(intensityMin, (double)intensity);
+    intensityMax = std::max(intensityMax, (double)intensity);
+    zSum += z;
+    zSumSquares += z * z;
+    zMin = std::min(zMin, z);
+    zMax = std::max(zMax, z);
+
+    // A return number of zero means the return columns were not loaded
+    if (returnNumber == 1)
+        firstReturns++;
+    if (returnNumber > 0 && returnNumber == numberOfReturns)
+        lastReturns++;
+}
+
+void VoxelAttributes::merge(const VoxelAttributes& other)
+{
+    count += other.count;
+    intensitySum += other.intensitySum;
+    intensitySumSquares += other.intensitySumSquares;
+    intensityMin = std::min(intensityMin, other.intensityMin);
+    intensityMax = std::max(intensityMax, other.intensityMax);
+    zSum += other.zSum;
+    zSumSquares += other.zSumSquares;
+    zMin = std::min(zMin, other.zMin);
+    zMax = std::max(zMax, other.zMax);
+    firstReturns += other.firstReturns;
+    lastReturns += other.lastReturns;
+}
+
+void accumulateVoxelAttributes(std::unordered_map<VoxelAddress, VoxelAttributes>& v, const VoxelAddress& address,
+                               double z, float intensity, uint8_t returnNumber, uint8_t numberOfReturns)
+{
+    v[address].add(z, intensity, returnNumber, numberOfReturns);
+}
+
+std::unordered_map<VoxelAddress, VoxelAttributes> coarsenVoxelAttributes(const std::unordered_map<VoxelAddress, VoxelAttributes>& v, int factor)
+{
+    std::unordered_map<VoxelAddress, VoxelAttributes> coarse;
+    for (const auto& voxel : v)
+        coarse[coarsenAddress(voxel.first, factor)].merge(voxel.second);
+    return coarse;
+}
+
+::std::ostream& operator<<(::std::ostream& os, const VoxelAttributes& a)
+{
+    std::streamsize precision = os.precision(std::numeric_limits<double>::digits10);
+    os << a.count << "," << a.intensitySum << "," << a.intensitySumSquares << "," << a.intensityMin << "," << a.intensityMax << ","
+       << a.zSum << "," << a.zSumSquares << "," << a.zMin << "," << a.zMax << "," << a.firstReturns << "," << a.lastReturns;
+    os.precision(precision);
+    return os;
+}
+
+VoxelAttributes ParseVoxelAttributes(const std::vector<std::string>& tokens, size_t first)
+{
+    VoxelAttributes a;
+    a.count = std::stoull(tokens[first]);
+    a.intensitySum = std::stod(tokens[first + 1]);
+    a.intensitySumSquares = std::stod(tokens[first + 2]);
+    a.intensityMin = std::stod(tokens[first + 3]);
+    a.intensityMax = std::stod(tokens[first + 4]);
+    a.zSum = std::stod(tokens[first + 5]);
+    a.zSumSquares = std::stod(tokens[first + 6]);
+    a.zMin = std::stod(tokens[first + 7]);
+    a.zMax = std::stod(tokens[first + 8]);
+    a.firstReturns = std::stoull(tokens[first + 9]);
+    a.lastReturns = std::stoull(tokens[first + 10]);
+    return a;
+}
@@ -0,0 +1,123 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    PointAttributes is a columnar store of the optional per-point values that
+    follow x, y, and z on an .asc line (intensity, return number, and number
+    of returns).  It is kept parallel to a vector of Vector3d points, so the
+    i-th element of each column belongs to the i-th point.
+
+    AttributeColumns describes which whitespace separated tokens of a line
+    hold the attributes.
+
+    VoxelAttributes is a per-voxel aggregate of the points that fell into the
+    voxel.  It only keeps counts, sums, sums of squares, minimums and maximums
+    so that aggregates from different Workers, or from the finer levels of a
+    voxel pyramid, can be merged exactly.
+
+*/
+#ifndef ATTRIBUTES_H
+#define ATTRIBUTES_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+#include "voxelsorter.h"
+
+struct AttributeColumns
+{
+    // Zero based token indices, a negative index means the column is absent
+    int intensity;
+    int returnNumber;
+    int numberOfReturns;
+
+    AttributeColumns();
+    inline bool enabled() const { return intensity >= 0 || returnNumber >= 0 || numberOfReturns >= 0; }
+};
+
+struct PointAttributes
+{
+    std::vector<float> intensity;
+    std::vector<uint8_t> returnNumber;
+    std::vector<uint8_t> numberOfReturns;
+
+    void push_back(float i, uint8_t r, uint8_t n);
+    void append(const PointAttributes& other, size_t index);
+    void clear();
+
+    // Copies the element at index `from` over the element at index `to`
+    void moveElement(size_t from, size_t to);
+    void pop_back();
+    void resize(size_t n);
+
+    inline size_t size() const { return intensity.size(); }
+    inline bool empty() const { return intensity.empty(); }
+
+    // Return number and number of returns travel as a single packed value in
+    // the MPI messages and the binary scratch files
+    inline double packedReturns(size_t index) const { return returnNumber[index] * 256 + numberOfReturns[index]; }
+    void pushPacked(double intensity, double packedReturns);
+};
+
+// Parses the attribute columns out of the tokens of a single .asc line,
+// missing or unconfigured columns are read as zero
+void ParseAttributes(const std::vector<std::string>& tokens, const AttributeColumns& columns, PointAttributes& attributes);
+
+struct VoxelAttributes
+{
+    uint64_t count;
+    double intensitySum;
+    double intensitySumSquares;
+    double intensityMin;
+    double intensityMax;
+    double zSum;
+    double zSumSquares;
+    double zMin;
+    double zMax;
+    uint64_t firstReturns;
+    uint64_t lastReturns;
+
+    VoxelAttributes();
+
+    void add(double z, float intensity, uint8_t returnNumber, uint8_t numberOfReturns);
+    void merge(const VoxelAttributes& other);
+
+    inline double meanIntensity() const { return count == 0 ? 0 : intensitySum / count; }
+    inline double meanZ() const { return count == 0 ? 0 : zSum / count; }
+    inline double firstReturnFraction() const { return count == 0 ? 0 : (double)firstReturns / count; }
+    inline double lastReturnFraction() const { return count == 0 ? 0 : (double)lastReturns / count; }
+};
+
+void accumulateVoxelAttributes(std::unordered_map<VoxelAddress, VoxelAttributes>&, const VoxelAddress&,
+                               double z, float intensity, uint8_t returnNumber, uint8_t numberOfReturns);
+
+// Merges the aggregates of a sparse voxel map into voxels that are `factor`
+// times larger on each side
+std::unordered_map<VoxelAddress, VoxelAttributes> coarsenVoxelAttributes(const std::unordered_map<VoxelAddress, VoxelAttributes>&, int factor);
+
+// The comma separated column names written by operator<< after the i,j,k
+// address of each voxel in a .voxattr file
+extern const char* VOXEL_ATTRIBUTE_COLUMNS;
+
+::std::ostream& operator<<(::std::ostream& os, const VoxelAttributes& a);
+
+// Parses the mergeable aggregate columns written by operator<<
+VoxelAttributes ParseVoxelAttributes(const std::vector<std::string>& tokens, size_t first);
+
+#endif
@@ -0,0 +1,356 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Google Benchmark suite for the core kernels.  Every benchmark runs on a
+    synthetic uniform cloud built from a fixed seed, parameterized by the
+    number of points and the density in points per cubic meter, so that runs
+    on different commits measure exactly the same work.
+
+*/
+
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+
+#include "synthetic.h"
+#include "utilities.h"
+#include "pointcloud.h"
+#include "voxelsorter.h"
+#include "thinning.h"
+#include "subdivision.h"
+#include "checkpoint.h"
+#include "morton.h"
+#include "parallelkdtree.h"
+
+#define BENCHMARK_SEED 20160601
+#define BENCHMARK_THINNING 0.05
+#define BENCHMARK_VOXEL 0.1
+
+static std::vector<Vector3d> benchmarkCloud(const benchmark::State& state)
+{
+    return GenerateUniformCloud(state.range(0), state.range(1), BENCHMARK_SEED);
+}
+
+static void countsAndDensities(benchmark::internal::Benchmark* b)
+{
+    b->ArgNames({"points", "density"});
+    b->ArgsProduct({{1 << 12, 1 << 15, 1 << 18}, {1000, 10000, 100000}});
+}
+
+static void BM_LoadPointsFromFile(benchmark::State& state)
+{
+    std::string fileName = "./benchmark_points.asc";
+    WriteAscFile(fileName, benchmarkCloud(state));
+    int64_t bytes = ScratchFileSize(fileName);
+
+    for (auto _ : state)
+    {
+        auto points = LoadPointsFromFile(fileName);
+        benchmark::DoNotOptimize(points.data());
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * bytes);
+    std::remove(fileName.c_str());
+}
+BENCHMARK(BM_LoadPointsFromFile)->ArgNames({"points", "density"})->Args({1 << 12, 10000})->Args({1 << 16, 10000})->Unit(benchmark::kMillisecond);
+
+static void BM_VoxelSorterIdentify(benchmark::State& state)
+{
+    auto points = benchmarkCloud(state);
+    VoxelSorter sorter(BENCHMARK_VOXEL, BENCHMARK_VOXEL, BENCHMARK_VOXEL, 0, 0, 0);
+
+    for (auto _ : state)
+    {
+        for (const auto& p : points)
+        {
+            VoxelAddress a = sorter.identify(p.x, p.y, p.z);
+            benchmark::DoNotOptimize(a);
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * points.size());
+}
+BENCHMARK(BM_VoxelSorterIdentify)->Apply(countsAndDensities);
+
+static void BM_IncrementVoxelIntensity(benchmark::State& state)
+{
+    auto points = benchmarkCloud(state);
+    VoxelSorter sorter(BENCHMARK_VOXEL, BENCHMARK_VOXEL, BENCHMARK_VOXEL, 0, 0, 0);
+    std::vector<VoxelAddress> addresses;
+    for (const auto& p : points)
+        addresses.push_back(sorter.identify(p.x, p.y, p.z));
+
+    for (auto _ : state)
+    {
+        std::unordered_map<VoxelAddress, int> voxels;
+        for (const auto& a : addresses)
+            incrementVoxelIntensity(voxels, a);
+        benchmark::DoNotOptimize(voxels.size());
+    }
+
+    state.SetItemsProcessed(state.iterations() * addresses.size());
+}
+BENCHMARK(BM_IncrementVoxelIntensity)->Apply(countsAndDensities);
+
+static void BM_KDTreeBuild(benchmark::State& state)
+{
+    PointCloud cloud(benchmarkCloud(state));
+
+    for (auto _ : state)
+    {
+        PointCloudKDTree index(3, cloud, nanoflann::KDTreeSingleIndexAdaptorParams(THINNING_LEAF_SIZE));
+        index.buildIndex();
+        benchmark::DoNotOptimize(index.size());
+    }
+
+    state.SetItemsProcessed(state.iterations() * cloud.pts.size());
+}
+BENCHMARK(BM_KDTreeBuild)->Apply(countsAndDensities);
+
+static void BM_KDTreeBuildParallel(benchmark::State& state)
+{
+    PointCloud cloud(GenerateUniformCloud(state.range(0), 10000, BENCHMARK_SEED));
+    ParallelKDTree<PointCloud> index(cloud, THINNING_LEAF_SIZE);
+
+    for (auto _ : state)
+    {
+        index.buildIndex(state.range(1));
+        benchmark::DoNotOptimize(index.size());
+    }
+
+    state.SetItemsProcessed(state.iterations() * cloud.pts.size());
+}
+BENCHMARK(BM_KDTreeBuildParallel)->ArgNames({"points", "threads"})->ArgsProduct({{1 << 18, 1 << 21}, {1, 2, 4, 8}})
+                                 ->UseRealTime()->Unit(benchmark::kMillisecond);
+
+static void BM_KDTreeRadiusSearch(benchmark::State& state)
+{
+    PointCloud cloud(benchmarkCloud(state));
+    PointCloudKDTree index(3, cloud, nanoflann::KDTreeSingleIndexAdaptorParams(THINNING_LEAF_SIZE));
+    index.buildIndex();
+
+    const double searchRadius = BENCHMARK_THINNING * BENCHMARK_THINNING;
+    size_t neighbors = 0;
+    for (auto _ : state)
+    {
+        for (const auto& p : cloud.pts)
+        {
+            double query_pt[3] = {p.x, p.y, p.z};
+            std::vector<std::pair<size_t,double>> indices_dists;
+            nanoflann::RadiusResultSet<double,size_t> resultSet(searchRadius, indices_dists);
+            index.findNeighbors(resultSet, query_pt, nanoflann::SearchParams());
+            neighbors += resultSet.size();
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * cloud.pts.size());
+    state.counters["neighbors"] = benchmark::Counter(neighbors, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_KDTreeRadiusSearch)->Apply(countsAndDensities);
+
+static void BM_ThinRegion(benchmark::State& state)
+{
+    auto points = benchmarkCloud(state);
+    size_t remaining = 0;
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        PointCloud cloud{std::vector<Vector3d>(points)};
+        state.ResumeTiming();
+
+        ThinPointCloud(cloud, BENCHMARK_THINNING);
+        remaining = cloud.pts.size();
+    }
+
+    state.SetItemsProcessed(state.iterations() * points.size());
+    state.counters["remaining"] = remaining;
+}
+BENCHMARK(BM_ThinRegion)->Apply(countsAndDensities)->Unit(benchmark::kMillisecond);
+
+// Thins the cloud as regions of 512 points, the way a Worker thins its bins,
+// with a new index per region or one ThinningContext for all of them
+static void thinRegions(benchmark::State& state, bool reuseContext)
+{
+    auto points = benchmarkCloud(state);
+    const size_t regionPoints = 512;
+    size_t remaining = 0;
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        std::vector<PointCloud> regions;
+        for (size_t first = 0; first < points.size(); first += regionPoints)
+        {
+            size_t last = std::min(points.size(), first + regionPoints);
+            regions.push_back(PointCloud{std::vector<Vector3d>(points.begin() + first, points.begin() + last)});
+        }
+        state.ResumeTiming();
+
+        ThinningContext context;
+        remaining = 0;
+        for (auto& region : regions)
+        {
+            if (reuseContext)
+                context.thin(region, BENCHMARK_THINNING);
+            else
+            {
+                PointCloudKDTree index(3, region, nanoflann::KDTreeSingleIndexAdaptorParams(THINNING_LEAF_SIZE));
+                index.buildIndex();
+                region.RemoveAtIndicies(FindRedundantPoints(region, index, BENCHMARK_THINNING));
+            }
+            remaining += region.pts.size();
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * points.size());
+    state.counters["remaining"] = remaining;
+}
+
+static void BM_ThinRegionsFreshIndex(benchmark::State& state) { thinRegions(state, false); }
+BENCHMARK(BM_ThinRegionsFreshIndex)->Apply(countsAndDensities)->Unit(benchmark::kMillisecond);
+
+static void BM_ThinRegionsReusedContext(benchmark::State& state) { thinRegions(state, true); }
+BENCHMARK(BM_ThinRegionsReusedContext)->Apply(countsAndDensities)->Unit(benchmark::kMillisecond);
+
+// A single 5 m binning region of a synthetic canopy plot, in scan order
+static std::vector<Vector3d> canopyRegion(size_t count)
+{
+    SyntheticCanopySettings settings;
+    settings.points = count;
+    settings.chunkSize = count;
+    settings.seed = BENCHMARK_SEED;
+    settings.width = 5;
+    settings.trees = 3;
+    settings.clusters = 1;
+    settings.stations = 1;
+    SyntheticCanopy canopy(settings);
+
+    std::vector<SyntheticPoint> generated;
+    canopy.generateChunk(0, generated);
+    std::vector<Vector3d> points;
+    for (const auto& p : generated)
+        points.push_back(p.position);
+    return points;
+}
+
+// Thins a dense canopy region with or without sorting it into Morton order
+// before the tree is built, the sort is included in the time
+static void thinCanopyRegion(benchmark::State& state, bool mortonOrder)
+{
+    auto points = canopyRegion(state.range(0));
+    ThinningContext context(mortonOrder);
+    size_t remaining = 0;
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        PointCloud cloud{std::vector<Vector3d>(points)};
+        state.ResumeTiming();
+
+        context.thin(cloud, BENCHMARK_THINNING / 10);
+        remaining = cloud.pts.size();
+    }
+
+    state.SetItemsProcessed(state.iterations() * points.size());
+    state.counters["remaining"] = remaining;
+}
+
+static void BM_ThinCanopyRegion(benchmark::State& state) { thinCanopyRegion(state, false); }
+BENCHMARK(BM_ThinCanopyRegion)->ArgName("points")->Arg(1 << 15)->Arg(1 << 18)->Arg(1 << 21)->Unit(benchmark::kMillisecond);
+
+static void BM_ThinCanopyRegionMortonOrder(benchmark::State& state) { thinCanopyRegion(state, true); }
+BENCHMARK(BM_ThinCanopyRegionMortonOrder)->ArgName("points")->Arg(1 << 15)->Arg(1 << 18)->Arg(1 << 21)->Unit(benchmark::kMillisecond);
+
+// Thins a dense canopy region in octree parts of at most the given number of
+// points, where the budget of the whole region thins it with one tree
+static void BM_ThinCanopyRegionSubdivided(benchmark::State& state)
+{
+    auto points = canopyRegion(state.range(0));
+    ThinningContext context;
+    size_t parts = 0;
+    size_t remaining = 0;
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        PointCloud cloud{std::vector<Vector3d>(points)};
+        state.ResumeTiming();
+
+        parts = ThinSubdivided(context, cloud, BENCHMARK_THINNING / 10, state.range(1));
+        remaining = cloud.pts.size();
+    }
+
+    state.SetItemsProcessed(state.iterations() * points.size());
+    state.counters["parts"] = parts;
+    state.counters["remaining"] = remaining;
+}
+BENCHMARK(BM_ThinCanopyRegionSubdivided)->ArgNames({"points", "budget"})->ArgsProduct({{1 << 21}, {1 << 21, 1 << 17, 1 << 14}})->Unit(benchmark::kMillisecond);
+
+static void BM_MortonSort(benchmark::State& state)
+{
+    auto points = canopyRegion(state.range(0));
+    MortonOrder morton;
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(morton.sort(points, state.range(1)).data());
+
+    state.SetItemsProcessed(state.iterations() * points.size());
+}
+BENCHMARK(BM_MortonSort)->ArgNames({"points", "threads"})->ArgsProduct({{1 << 15, 1 << 21}, {1, 4}})->Unit(benchmark::kMillisecond);
+
+static void BM_StreamingThinning(benchmark::State& state)
+{
+    auto points = benchmarkCloud(state);
+    size_t remaining = 0;
+
+    for (auto _ : state)
+    {
+        StreamingThinner thinner(BENCHMARK_THINNING);
+        for (const auto& p : points)
+            thinner.offer(p);
+        remaining = thinner.size();
+    }
+
+    state.SetItemsProcessed(state.iterations() * points.size());
+    state.counters["remaining"] = remaining;
+}
+BENCHMARK(BM_StreamingThinning)->Apply(countsAndDensities)->Unit(benchmark::kMillisecond);
+
+static void BM_NaiveThinning(benchmark::State& state)
+{
+    auto points = benchmarkCloud(state);
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        std::vector<Vector3d> working(points);
+        state.ResumeTiming();
+
+        naiveThinning(working, BENCHMARK_THINNING);
+        benchmark::DoNotOptimize(working.data());
+    }
+
+    state.SetItemsProcessed(state.iterations() * points.size());
+}
+BENCHMARK(BM_NaiveThinning)->ArgNames({"points", "density"})->ArgsProduct({{1 << 9, 1 << 11}, {1000, 100000}})->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
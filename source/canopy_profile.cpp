@@ -0,0 +1,53 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+
+#include "voxelsorter.h"
+#include "canopyprofile.h"
+
+void printUsageInstructions()
+{
+    std::cout << "canopy_profile: make sure to specify a .sparsevox file as a command line parameter" << std::endl;
+    std::cout << "                usage: canopy_profile input.sparsevox [output_prefix] [ground_height] [ground_radius]" << std::endl;
+    std::cout << "                This tool reduces a sparse voxel file into vertical column profiles" << std::endl;
+    std::cout << "                (output_prefix.profiles) and a raster with the canopy top height," << std::endl;
+    std::cout << "                canopy height and gap fraction of each column (output_prefix.chm)." << std::endl;
+    std::cout << "                The gap fraction is the share of a column's points that lie within" << std::endl;
+    std::cout << "                ground_height (default 0.5) of the ground, the lowest voxel of the" << std::endl;
+    std::cout << "                columns within ground_radius (default 10) of the column." << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        printUsageInstructions();
+        return -1;
+    }
+
+    std::string inputFile(argv[1]);
+    std::string prefix = argc > 2 ? std::string(argv[2]) : inputFile.substr(0, inputFile.rfind(".sparsevox"));
+    double groundHeight = argc > 3 ? std::stod(argv[3]) : 0.5;
+    double groundRadius = argc > 4 ? std::stod(argv[4]) : CANOPY_GROUND_RADIUS;
+
+    double spacing;
+    auto voxels = LoadSparseVoxels(inputFile, spacing);
+    std::cout << "canopy_profile: Loaded " << voxels.size() << " voxels with spacing " << spacing << std::endl;
+    if (spacing <= 0)
+    {
+        std::cout << "canopy_profile: the input file has no spacing in its [info] header" << std::endl;
+        return -1;
+    }
+
+    size_t threads = std::thread::hardware_concurrency();
+    auto products = ComputeCanopyProducts(std::move(voxels), spacing, groundHeight, groundRadius, threads);
+    std::cout << "canopy_profile: Computed " << products.profiles.size() << " column profiles on a "
+              << products.raster.width << " x " << products.raster.height << " grid" << std::endl;
+
+    WriteCanopyRaster(prefix + ".chm", products.raster);
+    WriteColumnProfiles(prefix + ".profiles", products.profiles, spacing);
+    std::cout << "canopy_profile: Wrote " << prefix << ".chm and " << prefix << ".profiles" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,308 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Column profiles, canopy height and gap fraction rasters from a sparse
+    voxel map.
+
+*/
+
+#include "canopyprofile.h"
+#include "asyncwriter.h"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <cmath>
+#include <cstring>
+#include <climits>
+#include <deque>
+
+std::vector<SparseVoxel> LoadSparseVoxels(std::string fileName, double& spacing)
+{
+    std::ifstream infile(fileName);
+    if (!infile.is_open())
+        throw std::invalid_argument("Could not open sparse voxel file " + fileName);
+
+    std::vector<SparseVoxel> voxels;
+    std::string line;
+    spacing = 0;
+    bool inHeader = false;
+    while (std::getline(infile, line))
+    {
+        if (line == "[info]")
+        {
+            inHeader = true;
+            continue;
+        }
+        if (line == "[voxels]")
+        {
+            inHeader = false;
+            continue;
+        }
+        if (inHeader)
+        {
+            if (line.compare(0, 8, "spacing=") == 0)
+                spacing = std::stod(line.substr(8));
+            continue;
+        }
+
+        SparseVoxel v;
+        char comma;
+        std::istringstream fields(line);
+        if (fields >> v.address.i >> comma >> v.address.j >> comma >> v.address.k >> comma >> v.count)
+            voxels.push_back(v);
+    }
+    return voxels;
+}
+
+// Fills in the profile and raster cells of the columns in [first, last), each
+// column owns a distinct raster cell so threads never write the same memory
+static void processColumns(const std::vector<SparseVoxel>& voxels, const std::vector<size_t>& columnStarts,
+                           const std::vector<int>& groundK, size_t first, size_t last, int groundLayers,
+                           CanopyProducts& products)
+{
+    CanopyRaster& raster = products.raster;
+    for (size_t c = first; c < last; c++)
+    {
+        size_t begin = columnStarts[c];
+        size_t end = columnStarts[c + 1];
+
+        ColumnProfile& profile = products.profiles[c];
+        profile.i = voxels[begin].address.i;
+        profile.j = voxels[begin].address.j;
+        profile.kMin = voxels[begin].address.k;
+        int kMax = voxels[end - 1].address.k;
+        profile.counts.assign(kMax - profile.kMin + 1, 0);
+
+        size_t cell = raster.cell(profile.i, profile.j);
+        int groundBase = groundK[cell];
+
+        uint64_t total = 0;
+        uint64_t ground = 0;
+        for (size_t n = begin; n < end; n++)
+        {
+            int layer = voxels[n].address.k - profile.kMin;
+            profile.counts[layer] += voxels[n].count;
+            total += voxels[n].count;
+            if (voxels[n].address.k - groundBase < groundLayers)
+                ground += voxels[n].count;
+        }
+
+        raster.top[cell] = static_cast<float>((kMax + 1) * raster.spacing);
+        raster.chm[cell] = static_cast<float>((kMax + 1 - groundBase) * raster.spacing);
+        raster.gapFraction[cell] = total == 0 ? 0.0f : static_cast<float>((double)ground / total);
+    }
+}
+
+// Replaces every value of a row or column of the grid with the minimum of the
+// values within halfWidth of it along that line
+static void slidingMinimum(std::vector<int>& values, size_t start, size_t count, size_t stride, size_t halfWidth)
+{
+    std::vector<int> line(count);
+    for (size_t n = 0; n < count; n++)
+        line[n] = values[start + n * stride];
+
+    // Indices of the window whose values increase from front to back
+    std::deque<size_t> window;
+    size_t next = 0;
+    for (size_t n = 0; n < count; n++)
+    {
+        for (; next < count && next <= n + halfWidth; next++)
+        {
+            while (!window.empty() && line[window.back()] >= line[next])
+                window.pop_back();
+            window.push_back(next);
+        }
+        while (window.front() + halfWidth < n)
+            window.pop_front();
+        values[start + n * stride] = line[window.front()];
+    }
+}
+
+CanopyProducts ComputeCanopyProducts(std::vector<SparseVoxel> voxels, double spacing, double groundHeight, double groundRadius, size_t threads)
+{
+    CanopyProducts products;
+    CanopyRaster& raster = products.raster;
+    raster.spacing = spacing;
+    raster.i0 = 0;
+    raster.j0 = 0;
+    raster.width = 0;
+    raster.height = 0;
+
+    if (voxels.empty())
+        return products;
+
+    // Order the voxels by column and then height so that each column is a
+    // contiguous, ascending run
+    std::sort(voxels.begin(), voxels.end(), [](const SparseVoxel& a, const SparseVoxel& b)
+    {
+        if (a.address.j != b.address.j) return a.address.j < b.address.j;
+        if (a.address.i != b.address.i) return a.address.i < b.address.i;
+        return a.address.k < b.address.k;
+    });
+
+    std::vector<size_t> columnStarts;
+    int iMin = voxels[0].address.i, iMax = iMin;
+    for (size_t n = 0; n < voxels.size(); n++)
+    {
+        if (n == 0 || voxels[n].address.i != voxels[n - 1].address.i || voxels[n].address.j != voxels[n - 1].address.j)
+            columnStarts.push_back(n);
+        iMin = std::min(iMin, voxels[n].address.i);
+        iMax = std::max(iMax, voxels[n].address.i);
+    }
+    size_t nColumns = columnStarts.size();
+    columnStarts.push_back(voxels.size());
+
+    raster.i0 = iMin;
+    raster.j0 = voxels.front().address.j;
+    raster.width = iMax - iMin + 1;
+    raster.height = voxels.back().address.j - raster.j0 + 1;
+    size_t cells = (size_t)raster.width * raster.height;
+    raster.top.assign(cells, CANOPY_NODATA);
+    raster.chm.assign(cells, CANOPY_NODATA);
+    raster.gapFraction.assign(cells, CANOPY_NODATA);
+    products.profiles.resize(nColumns);
+
+    int groundLayers = spacing > 0 ? std::max(1, static_cast<int>(std::ceil(groundHeight / spacing - 1e-9))) : 1;
+
+    // The ground of each column is the lowest voxel of the columns in the
+    // square of cells within groundRadius, a minimum over the rows and then
+    // over the columns of the grid
+    std::vector<int> groundK(cells, INT_MAX);
+    for (size_t c = 0; c < nColumns; c++)
+    {
+        const VoxelAddress& bottom = voxels[columnStarts[c]].address;
+        groundK[raster.cell(bottom.i, bottom.j)] = bottom.k;
+    }
+    size_t halfWidth = spacing > 0 && groundRadius > 0 ? static_cast<size_t>(std::min<double>(groundRadius / spacing + 1e-9, cells)) : 0;
+    if (halfWidth > 0)
+    {
+        for (size_t j = 0; j < raster.height; j++)
+            slidingMinimum(groundK, j * raster.width, raster.width, 1, halfWidth);
+        for (size_t i = 0; i < raster.width; i++)
+            slidingMinimum(groundK, i, raster.height, raster.width, halfWidth);
+    }
+
+    if (threads < 1)
+        threads = 1;
+    if (threads > nColumns)
+        threads = nColumns;
+
+    std::vector<std::thread> pool;
+    size_t perThread = nColumns / threads;
+    size_t extra = nColumns % threads;
+    size_t first = 0;
+    for (size_t t = 0; t < threads; t++)
+    {
+        size_t last = first + perThread + (t < extra ? 1 : 0);
+        pool.push_back(std::thread(processColumns, std::cref(voxels), std::cref(columnStarts), std::cref(groundK),
+                                   first, last, groundLayers, std::ref(products)));
+        first = last;
+    }
+    for (auto& t : pool)
+        t.join();
+
+    return products;
+}
+
+template <typename T> static void writeValue(std::ostream& out, T value)
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T> static T readValue(std::ifstream& in)
+{
+    T value;
+    in.read(reinterpret_cast<char*>(&value), sizeof(T));
+    return value;
+}
+
+void WriteCanopyRaster(std::string fileName, const CanopyRaster& raster)
+{
+    AsyncOutputFile out(fileName);
+    if (!out.is_open())
+        throw std::invalid_argument("Could not open raster file " + fileName + " for output");
+
+    out.write("CVRS", 4);
+    writeValue<uint32_t>(out, 1);
+    writeValue<uint32_t>(out, raster.width);
+    writeValue<uint32_t>(out, raster.height);
+    writeValue<uint32_t>(out, 3);
+    writeValue<int32_t>(out, raster.i0);
+    writeValue<int32_t>(out, raster.j0);
+    writeValue<double>(out, raster.spacing);
+    writeValue<float>(out, CANOPY_NODATA);
+
+    for (const std::vector<float>* band : {&raster.top, &raster.chm, &raster.gapFraction})
+        out.write(reinterpret_cast<const char*>(band->data()), band->size() * sizeof(float));
+    out.close();
+}
+
+CanopyRaster ReadCanopyRaster(std::string fileName)
+{
+    std::ifstream in(fileName.c_str(), std::ios::binary);
+    char magic[4];
+    in.read(magic, 4);
+    if (!in || std::memcmp(magic, "CVRS", 4) != 0 || readValue<uint32_t>(in) != 1)
+        throw std::invalid_argument("File " + fileName + " is not a canopy raster");
+
+    CanopyRaster raster;
+    raster.width = readValue<uint32_t>(in);
+    raster.height = readValue<uint32_t>(in);
+    uint32_t bands = readValue<uint32_t>(in);
+    raster.i0 = readValue<int32_t>(in);
+    raster.j0 = readValue<int32_t>(in);
+    raster.spacing = readValue<double>(in);
+    readValue<float>(in);
+
+    if (bands != 3)
+        throw std::invalid_argument("Canopy raster " + fileName + " has an unexpected number of bands");
+
+    size_t cells = (size_t)raster.width * raster.height;
+    for (std::vector<float>* band : {&raster.top, &raster.chm, &raster.gapFraction})
+    {
+        band->resize(cells);
+        in.read(reinterpret_cast<char*>(band->data()), cells * sizeof(float));
+    }
+
+    if (!in)
+        throw std::invalid_argument("Canopy raster " + fileName + " is truncated");
+    return raster;
+}
+
+void WriteColumnProfiles(std::string fileName, const std::vector<ColumnProfile>& profiles, double spacing)
+{
+    AsyncOutputFile out(fileName);
+    if (!out.is_open())
+        throw std::invalid_argument("Could not open profile file " + fileName + " for output");
+
+    out.write("CVPR", 4);
+    writeValue<uint32_t>(out, 1);
+    writeValue<double>(out, spacing);
+    writeValue<uint64_t>(out, profiles.size());
+    for (const auto& p : profiles)
+    {
+        writeValue<int32_t>(out, p.i);
+        writeValue<int32_t>(out, p.j);
+        writeValue<int32_t>(out, p.kMin);
+        writeValue<uint32_t>(out, p.counts.size());
+        out.write(reinterpret_cast<const char*>(p.counts.data()), p.counts.size() * sizeof(uint32_t));
+    }
+    out.close();
+}
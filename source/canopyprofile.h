@@ -0,0 +1,113 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Reduces a sparse voxel map into per-column products.  A column is the set
+    of voxels sharing the same i, j address.  For every occupied column this
+    computes the vertical profile (a histogram of point counts by k), and three
+    raster bands over the i, j grid:
+
+      top           the elevation of the top face of the highest occupied
+                    voxel above the z origin of the voxel grid (k = 0)
+      chm           the canopy height, top minus the ground under the column
+      gap_fraction  the fraction of the column's points that lie within
+                    groundHeight of the ground, the proportion of returns
+                    which made it through the canopy
+
+    The ground under a column is the bottom face of the lowest occupied voxel
+    among the columns within groundRadius of it in i and j.  Under a dense
+    crown no return may reach the ground, and the lowest voxel of that column
+    is the bottom of the crown, so the neighbourhood stands in for the ground
+    which was hidden.  A column with no ground returns has a gap fraction of
+    zero.  A groundRadius of 0 measures every column from its own lowest
+    voxel.
+
+    Columns without any voxels hold CANOPY_NODATA in every band.
+
+    The raster file is a small header followed by the bands as row-major
+    float32 arrays, rows are j and columns are i:
+
+      char[4] "CVRS", uint32 version, uint32 width, uint32 height,
+      uint32 bands, int32 i0, int32 j0, double spacing, float nodata,
+      float[bands][height][width]
+
+    The profile file only stores occupied columns:
+
+      char[4] "CVPR", uint32 version, double spacing, uint64 columns, then for
+      each column int32 i, int32 j, int32 kMin, uint32 n, uint32[n] counts
+
+*/
+#ifndef CANOPYPROFILE_H
+#define CANOPYPROFILE_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "voxelsorter.h"
+
+#define CANOPY_NODATA -9999.0f
+
+// The default distance around a column searched for its ground
+#define CANOPY_GROUND_RADIUS 10.0
+
+struct SparseVoxel
+{
+    VoxelAddress address;
+    uint32_t count;
+};
+
+struct ColumnProfile
+{
+    int i;
+    int j;
+    int kMin;
+    std::vector<uint32_t> counts;
+};
+
+struct CanopyRaster
+{
+    int i0;
+    int j0;
+    uint32_t width;
+    uint32_t height;
+    double spacing;
+    std::vector<float> top;
+    std::vector<float> chm;
+    std::vector<float> gapFraction;
+
+    inline size_t cell(int i, int j) const { return (size_t)(j - j0) * width + (i - i0); }
+};
+
+struct CanopyProducts
+{
+    CanopyRaster raster;
+    std::vector<ColumnProfile> profiles;
+};
+
+// Reads the [info] spacing and the [voxels] section of a .sparsevox file,
+// a file without a header is read as bare voxel lines with a spacing of 0
+std::vector<SparseVoxel> LoadSparseVoxels(std::string fileName, double& spacing);
+
+// Groups the voxels into columns and computes the profiles and raster bands,
+// the columns are divided among the given number of threads
+CanopyProducts ComputeCanopyProducts(std::vector<SparseVoxel> voxels, double spacing, double groundHeight, double groundRadius, size_t threads);
+
+void WriteCanopyRaster(std::string fileName, const CanopyRaster& raster);
+CanopyRaster ReadCanopyRaster(std::string fileName);
+void WriteColumnProfiles(std::string fileName, const std::vector<ColumnProfile>& profiles, double spacing);
+
+#endif
@@ -0,0 +1,177 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Stage completion manifest for restarting the parallel algorithm.
+
+*/
+
+#include "checkpoint.h"
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <limits>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "json/json.h"
+
+#define CHECKPOINT_FILE "checkpoint.json"
+#define CHECKPOINT_VERSION 1
+
+CheckpointManifest::CheckpointManifest()
+{
+    stage = 0;
+    workers = 0;
+}
+
+std::string CheckpointFingerprint(const ParallelConfiguration& config, double binSpacing, size_t pointStride)
+{
+    std::stringstream s;
+    s.precision(std::numeric_limits<double>::digits10);
+    s << "thinning=" << config.thinningDistance << ";binning=" << binSpacing << ";stride=" << pointStride;
+    for (auto r : config.voxelResolutions)
+        s << ";voxel=" << r;
+    for (auto f : config.inputFiles)
+        s << ";input=" << f << ":" << ScratchFileSize(f);
+    return s.str();
+}
+
+int64_t ScratchFileSize(std::string fileName)
+{
+    std::ifstream file(fileName.c_str(), std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+        return -1;
+    return static_cast<int64_t>(file.tellg());
+}
+
+CheckpointManifest MakeCheckpoint(int stage, size_t workers, std::string fingerprint, const std::vector<std::string>& files)
+{
+    CheckpointManifest m;
+    m.stage = stage;
+    m.workers = workers;
+    m.fingerprint = fingerprint;
+    m.files = files;
+    for (auto f : files)
+        m.sizes.push_back(static_cast<uint64_t>(ScratchFileSize(f)));
+    return m;
+}
+
+// Forces a file or directory, and its size, onto the disk
+static void syncToDisk(const std::string& name)
+{
+    int fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Could not open " + name + " to sync it: " + std::strerror(errno));
+    int result = fsync(fd);
+    int error = errno;
+    ::close(fd);
+    if (result != 0)
+        throw std::runtime_error("Could not sync " + name + ": " + std::strerror(error));
+}
+
+void WriteCheckpoint(std::string scratchDirectory, const CheckpointManifest& manifest)
+{
+    Json::Value root;
+    root["version"] = CHECKPOINT_VERSION;
+    root["stage"] = manifest.stage;
+    root["workers"] = static_cast<Json::UInt64>(manifest.workers);
+    root["fingerprint"] = manifest.fingerprint;
+
+    Json::Value files(Json::arrayValue);
+    for (size_t i = 0; i < manifest.files.size(); i++)
+    {
+        Json::Value entry;
+        entry["name"] = manifest.files[i];
+        entry["bytes"] = static_cast<Json::UInt64>(manifest.sizes[i]);
+        files.append(entry);
+    }
+    root["files"] = files;
+
+    // The files the manifest vouches for must be on the disk before it is, or
+    // a crash could leave a manifest naming files whose data was lost
+    for (const auto& f : manifest.files)
+        syncToDisk(f);
+
+    // Write to a temporary file and rename it over the old manifest so that a
+    // crash while writing never leaves a partial manifest behind
+    std::string fileName = scratchDirectory + CHECKPOINT_FILE;
+    std::string temporary = fileName + ".tmp";
+    {
+        std::ofstream out(temporary.c_str());
+        Json::StyledStreamWriter writer;
+        writer.write(out, root);
+        out.close();
+        if (!out)
+            throw std::runtime_error("Could not write checkpoint " + temporary);
+    }
+    syncToDisk(temporary);
+    if (std::rename(temporary.c_str(), fileName.c_str()) != 0)
+        throw std::runtime_error("Could not rename checkpoint " + temporary + " to " + fileName + ": " + std::strerror(errno));
+
+    // The rename itself is only durable once the directory is
+    syncToDisk(scratchDirectory.empty() ? "." : scratchDirectory);
+}
+
+CheckpointManifest LoadCheckpoint(std::string scratchDirectory, std::string fingerprint)
+{
+    CheckpointManifest none;
+
+    std::ifstream file((scratchDirectory + CHECKPOINT_FILE).c_str());
+    if (!file.is_open())
+        return none;
+
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    Json::Value root;
+    Json::Reader reader;
+    if (!reader.parse(data, root, false) || !root.isObject())
+        return none;
+
+    if (root.get("version", 0).asInt() != CHECKPOINT_VERSION || root.get("fingerprint", "").asString() != fingerprint)
+        return none;
+
+    CheckpointManifest m;
+    m.stage = root.get("stage", 0).asInt();
+    m.workers = root.get("workers", 0).asUInt64();
+    m.fingerprint = fingerprint;
+
+    Json::Value files = root["files"];
+    if (!files.isArray())
+        return none;
+
+    for (auto entry : files)
+    {
+        std::string name = entry.get("name", "").asString();
+        uint64_t bytes = entry.get("bytes", 0).asUInt64();
+        if (ScratchFileSize(name) != static_cast<int64_t>(bytes))
+            return none;
+
+        m.files.push_back(name);
+        m.sizes.push_back(bytes);
+    }
+
+    return m;
+}
+
+void RemoveCheckpoint(std::string scratchDirectory)
+{
+    std::remove((scratchDirectory + CHECKPOINT_FILE).c_str());
+}
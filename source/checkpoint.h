@@ -0,0 +1,76 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    The checkpoint manifest records which stage of the parallel algorithm has
+    been completed and which scratch files hold its results.  It is written to
+    checkpoint.json in the scratch directory by the Director once every Worker
+    has confirmed a stage, replacing the previous manifest atomically.
+
+    A resubmitted job reads the manifest at startup.  It is only used if the
+    fingerprint of the run settings matches and every listed file still exists
+    with the recorded size, otherwise the job starts from the beginning.
+
+    Stage 1 is complete when the thinned workerN.binary files are written, and
+    stage 2 when the final workerN_final files are written.  The stage 1 files
+    are re-sorted by the Readers in stage 2, so a job resumed after stage 1 may
+    use a different number of processes than the job that wrote them.
+
+*/
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "utilities.h"
+
+struct CheckpointManifest
+{
+    int stage;                          // The last completed stage, 0 for none
+    size_t workers;                     // Number of Workers that wrote the files
+    std::string fingerprint;
+    std::vector<std::string> files;
+    std::vector<uint64_t> sizes;
+
+    CheckpointManifest();
+};
+
+// A summary of the settings that determine the contents of the scratch files,
+// a checkpoint written with a different fingerprint is never resumed
+std::string CheckpointFingerprint(const ParallelConfiguration& config, double binSpacing, size_t pointStride);
+
+// Returns the size of a file in bytes, or -1 if it does not exist
+int64_t ScratchFileSize(std::string fileName);
+
+// Builds a manifest for a completed stage, recording the current size of
+// every file
+CheckpointManifest MakeCheckpoint(int stage, size_t workers, std::string fingerprint, const std::vector<std::string>& files);
+
+// Writes the manifest to checkpoint.json in the scratch directory, after
+// syncing the files it lists.  Throws std::runtime_error if anything could not
+// be written or synced.
+void WriteCheckpoint(std::string scratchDirectory, const CheckpointManifest& manifest);
+
+// Loads and validates the manifest in the scratch directory.  A manifest which
+// is missing, unreadable, written for other settings, or whose files are gone
+// or have changed size is returned with stage 0.
+CheckpointManifest LoadCheckpoint(std::string scratchDirectory, std::string fingerprint);
+
+void RemoveCheckpoint(std::string scratchDirectory);
+
+#endif
@@ -7,22 +7,32 @@
 #include <cmath>
 #include <set>
 #include <limits>
+#include <iomanip>
+#include <algorithm>
 
 #include "nanoflann.hpp"
 #include "vector3d.h"
 #include "pointcloud.h"
 #include "utilities.h"
 #include "voxelsorter.h"
+#include "spacing.h"
+#include "leafsize.h"
 
 using namespace nanoflann;
 
 void printUsageInstructions()
 {
     std::cout << "closest_point_check: make sure to specify the input asc file as a command line parameter" << std::endl;
+    std::cout << "                     usage: closest_point_check input.asc [threads] [eps] [leaf_size|auto] [samples]" << std::endl;
     std::cout << "                     This tool will search the contents of a point cloud .asc file and " << std::endl;
-    std::cout << "                     find the distance between the closest two points.  The resulting  " << std::endl;
-    std::cout << "                     value should be used as thinning tolerance for a global thinning and" << std::endl;
-    std::cout << "                     voxelization." << std::endl;
+    std::cout << "                     find the distance from each point to its nearest distinct neighbour," << std::endl;
+    std::cout << "                     printing the closest distance between two points along with the" << std::endl;
+    std::cout << "                     percentiles and a histogram of the distances.  A low percentile is" << std::endl;
+    std::cout << "                     a robust choice of thinning tolerance for a global thinning and" << std::endl;
+    std::cout << "                     voxelization.  A nonzero eps makes the searches approximate, so" << std::endl;
+    std::cout << "                     the distance found may be up to (1 + eps) times the true one, and" << std::endl;
+    std::cout << "                     a number of samples queries only that many points spread through" << std::endl;
+    std::cout << "                     the file." << std::endl;
 }
 
 int main(int argc, char* argv[])
@@ -36,41 +46,56 @@ int main(int argc, char* argv[])
     PointCloud cloud(LoadPointsFromFile(std::string(argv[1])));
     std::cout << "closest_point_check: Loaded " << cloud.pts.size() << " points from file." << std::endl;
 
-    // Thin the points
-    std::cout << "closest_point_check: building kd-tree index" << std::endl;
-    typedef KDTreeSingleIndexAdaptor<L2_Simple_Adaptor<double, PointCloud> ,PointCloud,3> my_kd_tree_t;
-
-    my_kd_tree_t index(3, cloud, KDTreeSingleIndexAdaptorParams(10));
-    index.buildIndex();
-    std::cout << "closest_point_check: index complete" << std::endl;
+    // The tree is built and searched on every core unless a number of threads
+    // is given, the searches are exact unless an eps is given, and every
+    // point is queried unless a number of samples is given
+    SpacingOptions options;
+    options.threads = argc > 2 ? std::stoul(argv[2]) : 0;
+    options.eps = argc > 3 ? std::stof(argv[3]) : 0.0f;
+    options.samples = argc > 5 ? std::stoul(argv[5]) : 0;
 
-    double minDistanceSquared = std::numeric_limits<double>::max();
-    const size_t nResults = 5;
-    std::vector<size_t> resultIndex(nResults);
-    std::vector<double> distanceSquared(nResults);
-
-    for (size_t i = 0; i < cloud.pts.size(); i++)
+    // Time building the tree over the start of the cloud and searching it at
+    // several leaf sizes
+    size_t leafSize = 10;
+    if (argc > 4 && std::string(argv[4]) == "auto")
     {
-        // Construct the query point from the current point
-        double query_pt[3] = { cloud.pts[i].x, cloud.pts[i].y, cloud.pts[i].z};
+        size_t n = std::min(cloud.pts.size(), (size_t)LEAF_SIZE_SAMPLE_POINTS);
+        PointCloud sample(std::vector<Vector3d>(cloud.pts.begin(), cloud.pts.begin() + n));
+        SpacingOptions sampleOptions = options;
+        sampleOptions.samples = 0;
+        std::vector<LeafSizeTiming> timings;
+        leafSize = FastestLeafSize([&](size_t candidate)
+        {
+            SpacingKDTree sampleIndex(sample, candidate);
+            sampleIndex.buildIndex(options.threads);
+            MeasureSpacing(sample, sampleIndex, sampleOptions);
+        }, timings);
+        std::cout << "closest_point_check: leaf size calibration on " << n << " points,";
+        for (const auto& t : timings)
+            std::cout << " " << t.leafSize << ":" << (size_t)(t.seconds * 1e6) << "us";
+        std::cout << ", leaf size " << leafSize << std::endl;
+    }
+    else if (argc > 4)
+        leafSize = std::stoul(argv[4]);
 
-        // Search for the nResults nearest neighbors
-        index.knnSearch(&query_pt[0], nResults, &resultIndex[0], &distanceSquared[0]);
+    std::cout << "closest_point_check: building kd-tree index" << std::endl;
+    SpacingKDTree index(cloud, leafSize);
+    index.buildIndex(options.threads);
+    std::cout << "closest_point_check: index complete" << std::endl;
 
-        // Locate the smallest nonzero distance in the result set
-        double smallestInSet = std::numeric_limits<double>::max();
-        for (double d2 : distanceSquared)
-        {
-            if (d2 > 0 && d2 < smallestInSet)
-                smallestInSet = d2;
-        }
+    SpacingStatistics stats = MeasureSpacing(cloud, index, options);
 
-        // If the smallest distace in the set is less than the smallest
-        // distance found so far, we update the smallest total distance
-        if (smallestInSet < minDistanceSquared)
-            minDistanceSquared = smallestInSet;
+    std::cout << "closest_point_check: queried " << stats.queries << " points, " << stats.duplicates
+              << " have an exact duplicate" << std::endl;
+    std::cout << "closest_point_check: closest distance between points is " << stats.minimum << std::endl;
+    std::cout << "closest_point_check: nearest neighbour distance p1 " << stats.p1 << ", p5 " << stats.p5
+              << ", median " << stats.median << ", p99 " << stats.p99 << std::endl;
+    std::cout << "closest_point_check: nearest neighbour distance histogram" << std::endl;
+    for (size_t b = 0; b < stats.histogram.size(); b++)
+    {
+        std::cout << "    " << std::setw(12) << b * stats.binWidth << " - " << std::setw(12) << (b + 1) * stats.binWidth
+                  << "  " << stats.histogram[b] << std::endl;
     }
-
-    std::cout << "closest_point_check: closest distance between points is " << sqrt(minDistanceSquared) << std::endl;
+    std::cout << "    " << std::setw(12) << stats.p99 << " +" << std::setw(15) << " " << stats.overflow << std::endl;
     return 0;
 }
@@ -0,0 +1,141 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Division of the input files among the Readers by byte ranges.
+
+*/
+
+#include "inputsplit.h"
+#include <cmath>
+#include <algorithm>
+
+static uint64_t fileSize(const std::string& fileName)
+{
+    std::ifstream file(fileName.c_str(), std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+        return 0;
+    return static_cast<uint64_t>(file.tellg());
+}
+
+uint64_t TotalInputBytes(const std::vector<std::string>& files)
+{
+    uint64_t total = 0;
+    for (const auto& f : files)
+        total += fileSize(f);
+    return total;
+}
+
+// The first byte of share p, computed without overflowing for huge inputs
+static uint64_t shareStart(uint64_t total, size_t p, size_t parts)
+{
+    return total / parts * p + total % parts * p / parts;
+}
+
+std::vector<std::vector<InputRange>> SplitInputRanges(const std::vector<std::pair<std::string, uint64_t>>& sizes, size_t parts)
+{
+    std::vector<std::vector<InputRange>> shares(parts);
+    if (parts == 0)
+        return shares;
+
+    uint64_t total = 0;
+    for (const auto& s : sizes)
+        total += s.second;
+
+    // Share p covers the bytes [total * p / parts, total * (p + 1) / parts) of
+    // the concatenated files
+    uint64_t fileStart = 0;
+    for (const auto& s : sizes)
+    {
+        uint64_t fileEnd = fileStart + s.second;
+        for (size_t p = 0; p < parts; p++)
+        {
+            uint64_t shareBegin = shareStart(total, p, parts);
+            uint64_t shareEnd = shareStart(total, p + 1, parts);
+            uint64_t begin = std::max(shareBegin, fileStart);
+            uint64_t end = std::min(shareEnd, fileEnd);
+            if (begin < end)
+                shares[p].push_back(InputRange{s.first, begin - fileStart, end - fileStart});
+        }
+        fileStart = fileEnd;
+    }
+    return shares;
+}
+
+bool IsBinaryInput(const std::string& fileName)
+{
+    auto endsWith = [&fileName](const std::string& suffix)
+    {
+        return fileName.size() >= suffix.size() && fileName.compare(fileName.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+    return endsWith(".bin") || endsWith(".binary");
+}
+
+InputRange AlignedRange(const InputRange& range, size_t recordBytes)
+{
+    // Neighbouring ranges share their cut, so moving every cut the same way
+    // keeps them contiguous.  A partial record at the end of the file is
+    // dropped, as it would be when reading the whole file.
+    InputRange aligned = range;
+    aligned.begin -= range.begin % recordBytes;
+    aligned.end -= range.end % recordBytes;
+    return aligned;
+}
+
+std::vector<std::vector<InputRange>> SplitInputFiles(const std::vector<std::string>& files, size_t parts, size_t recordBytes)
+{
+    std::vector<std::pair<std::string, uint64_t>> sizes;
+    for (const auto& f : files)
+        sizes.push_back(std::make_pair(f, fileSize(f)));
+
+    auto shares = SplitInputRanges(sizes, parts);
+    for (auto& share : shares)
+    {
+        std::vector<InputRange> kept;
+        for (const auto& r : share)
+        {
+            InputRange range = IsBinaryInput(r.fileName) ? AlignedRange(r, recordBytes) : r;
+            if (range.begin < range.end)
+                kept.push_back(range);
+        }
+        share.swap(kept);
+    }
+    return shares;
+}
+
+size_t ReaderCount(size_t worldSize, double readerRatio, uint64_t totalBytes)
+{
+    size_t nReaders = (size_t)(worldSize * readerRatio);
+    size_t byInput = (size_t)(totalBytes / MIN_READER_BYTES);
+
+    if (nReaders > byInput)
+        nReaders = byInput;
+    if (worldSize > 2 && nReaders > worldSize - 2)
+        nReaders = worldSize - 2;
+    if (nReaders < 1)
+        nReaders = 1;
+    return nReaders;
+}
+
+double OptimalReaderShare(double readSecondsPerPoint, double workSecondsPerPoint)
+{
+    if (readSecondsPerPoint <= 0 || workSecondsPerPoint <= 0)
+        return 0.25;
+
+    double readersPerWorker = std::sqrt(readSecondsPerPoint / workSecondsPerPoint);
+    return readersPerWorker / (1.0 + readersPerWorker);
+}
@@ -0,0 +1,137 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Division of the input files among the Readers by byte ranges, and the
+    sizing of the Reader and Worker roles.
+
+    The input files are treated as one long run of bytes which is cut into
+    shares of nearly equal size, one per Reader, so the number of Readers
+    does not depend on how the data was split into files.  A share may hold
+    the end of one file and the start of the next.  The cuts are made at
+    arbitrary bytes, and a text line belongs to the range in which its first
+    byte lies: a range skips the partial line at its start and finishes the
+    line which crosses its end, so every line is read exactly once.  Binary
+    files, the stage 1 scratch files and .bin inputs, hold fixed size records
+    of doubles and their cuts are moved back to the start of a record.
+
+*/
+#ifndef INPUTSPLIT_H
+#define INPUTSPLIT_H
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstdint>
+#include <fstream>
+
+// Readers are never given less than this many bytes of input on average
+#define MIN_READER_BYTES (1 << 20)
+
+struct InputRange
+{
+    std::string fileName;
+    uint64_t begin;
+    uint64_t end;
+};
+
+uint64_t TotalInputBytes(const std::vector<std::string>& files);
+
+// Divides files of the given sizes, in order, into parts shares of nearly equal
+// byte count.  Empty shares are returned when there are fewer bytes than parts.
+std::vector<std::vector<InputRange>> SplitInputRanges(const std::vector<std::pair<std::string, uint64_t>>& sizes, size_t parts);
+
+// True for files of binary point records rather than text lines, which are
+// named .bin or .binary
+bool IsBinaryInput(const std::string& fileName);
+
+// Moves both ends of a range back to the start of a record
+InputRange AlignedRange(const InputRange& range, size_t recordBytes);
+
+// Looks up the size of every file and divides them with SplitInputRanges.  The
+// ranges of binary files are aligned to records of recordBytes bytes.
+std::vector<std::vector<InputRange>> SplitInputFiles(const std::vector<std::string>& files, size_t parts, size_t recordBytes = sizeof(double));
+
+// The number of Readers for a world size and reader ratio.  There is always
+// at least one Reader and one Worker, and no more Readers than the input can
+// keep busy with MIN_READER_BYTES each.
+size_t ReaderCount(size_t worldSize, double readerRatio, uint64_t totalBytes);
+
+// The share of the processes which should be Readers given the time a Reader
+// spends on each point and the time a Worker spends on each point.  Reading
+// finishes before thinning starts, so the run time is close to
+// n * read / readers + n * work / workers, which is least when the ratio of
+// Readers to Workers is sqrt(read / work).
+double OptimalReaderShare(double readSecondsPerPoint, double workSecondsPerPoint);
+
+// Calls f with every line whose first byte lies in the range
+template <typename F>
+void ForEachLineInRange(const InputRange& range, F f)
+{
+    std::ifstream file(range.fileName, std::ios::binary);
+    if (!file.is_open() || range.begin >= range.end)
+        return;
+
+    uint64_t position = range.begin;
+    std::string line;
+    if (range.begin > 0)
+    {
+        // Skip the end of the line that started in the previous range
+        file.seekg(range.begin - 1);
+        if (file.get() != '\n')
+        {
+            std::getline(file, line);
+            position += line.size() + 1;
+        }
+    }
+
+    while (position < range.end && std::getline(file, line))
+    {
+        position += line.size() + 1;
+        f(line);
+    }
+}
+
+// Calls f with a pointer to every record of stride doubles which starts in the
+// range, the range must be aligned to the records
+template <typename F>
+void ForEachRecordInRange(const InputRange& range, size_t stride, F f)
+{
+    std::ifstream file(range.fileName, std::ios::binary);
+    if (!file.is_open() || range.begin >= range.end || stride == 0)
+        return;
+    file.seekg(range.begin);
+
+    const uint64_t recordBytes = stride * sizeof(double);
+    const uint64_t blockRecords = 4096;
+    std::vector<double> block(blockRecords * stride);
+
+    uint64_t remaining = (range.end - range.begin) / recordBytes;
+    while (remaining > 0)
+    {
+        uint64_t want = remaining < blockRecords ? remaining : blockRecords;
+        file.read(reinterpret_cast<char*>(block.data()), want * recordBytes);
+        uint64_t got = static_cast<uint64_t>(file.gcount()) / recordBytes;
+        for (uint64_t i = 0; i < got; i++)
+            f(&block[i * stride]);
+        if (got < want)
+            break;
+        remaining -= got;
+    }
+}
+
+#endif
@@ -0,0 +1,326 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Per-phase timing and throughput counters and the run report.
+
+*/
+
+#include "instrumentation.h"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <sys/resource.h>
+
+static const char* phaseNames[PHASE_COUNT] = {"parse", "read_scratch", "send", "wait", "receive",
+                                              "tree_build", "thinning", "voxelize", "write", "combine", "spill"};
+
+const char* PhaseName(Phase phase)
+{
+    return phaseNames[static_cast<size_t>(phase)];
+}
+
+PhaseCounters::PhaseCounters()
+{
+    seconds = 0;
+    points = 0;
+    bytes = 0;
+}
+
+bool PhaseCounters::active() const
+{
+    return seconds > 0 || points > 0 || bytes > 0;
+}
+
+MemoryCounters::MemoryCounters()
+{
+    peakResident = 0;
+    peakHeld = 0;
+    spilledBytes = 0;
+    spilledRegions = 0;
+    reloadedRegions = 0;
+}
+
+ReadAheadCounters::ReadAheadCounters()
+{
+    queueDepth = 0;
+    bufferBytes = 0;
+    uringBlocks = 0;
+    threadBlocks = 0;
+    stallSeconds = 0;
+}
+
+uint64_t PeakResidentBytes()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+
+    // Linux reports the maximum resident set size in kilobytes
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+}
+
+Instrumentation::Instrumentation()
+{
+    totalSeconds = 0;
+}
+
+void Instrumentation::addTime(Phase phase, double seconds)
+{
+    (*this)[phase].seconds += seconds;
+    totalSeconds += seconds;
+}
+
+void Instrumentation::addPoints(Phase phase, uint64_t points)
+{
+    (*this)[phase].points += points;
+}
+
+void Instrumentation::addBytes(Phase phase, uint64_t bytes)
+{
+    (*this)[phase].bytes += bytes;
+}
+
+void Instrumentation::recordHeld(uint64_t bytes)
+{
+    memory.peakHeld = std::max(memory.peakHeld, bytes);
+}
+
+std::vector<double> Instrumentation::pack() const
+{
+    std::vector<double> packed;
+    for (size_t i = 0; i < PHASE_COUNT; i++)
+    {
+        packed.push_back(counters[i].seconds);
+        packed.push_back(static_cast<double>(counters[i].points));
+        packed.push_back(static_cast<double>(counters[i].bytes));
+    }
+    packed.push_back(static_cast<double>(memory.peakResident));
+    packed.push_back(static_cast<double>(memory.peakHeld));
+    packed.push_back(static_cast<double>(memory.spilledBytes));
+    packed.push_back(static_cast<double>(memory.spilledRegions));
+    packed.push_back(static_cast<double>(memory.reloadedRegions));
+    packed.push_back(static_cast<double>(readAhead.queueDepth));
+    packed.push_back(static_cast<double>(readAhead.bufferBytes));
+    packed.push_back(static_cast<double>(readAhead.uringBlocks));
+    packed.push_back(static_cast<double>(readAhead.threadBlocks));
+    packed.push_back(readAhead.stallSeconds);
+    return packed;
+}
+
+Instrumentation Instrumentation::unpack(const double* packed)
+{
+    Instrumentation instrumentation;
+    for (size_t i = 0; i < PHASE_COUNT; i++)
+    {
+        instrumentation.counters[i].seconds = packed[3 * i];
+        instrumentation.counters[i].points = static_cast<uint64_t>(packed[3 * i + 1]);
+        instrumentation.counters[i].bytes = static_cast<uint64_t>(packed[3 * i + 2]);
+        instrumentation.totalSeconds += packed[3 * i];
+    }
+
+    const double* m = packed + 3 * PHASE_COUNT;
+    instrumentation.memory.peakResident = static_cast<uint64_t>(m[0]);
+    instrumentation.memory.peakHeld = static_cast<uint64_t>(m[1]);
+    instrumentation.memory.spilledBytes = static_cast<uint64_t>(m[2]);
+    instrumentation.memory.spilledRegions = static_cast<uint64_t>(m[3]);
+    instrumentation.memory.reloadedRegions = static_cast<uint64_t>(m[4]);
+
+    const double* r = m + MEMORY_COUNTER_COUNT;
+    instrumentation.readAhead.queueDepth = static_cast<uint64_t>(r[0]);
+    instrumentation.readAhead.bufferBytes = static_cast<uint64_t>(r[1]);
+    instrumentation.readAhead.uringBlocks = static_cast<uint64_t>(r[2]);
+    instrumentation.readAhead.threadBlocks = static_cast<uint64_t>(r[3]);
+    instrumentation.readAhead.stallSeconds = r[4];
+    return instrumentation;
+}
+
+ScopedTimer::ScopedTimer(Instrumentation& instrumentation, Phase phase)
+: target(instrumentation), timedPhase(phase), start(std::chrono::steady_clock::now())
+{
+    nestedStart = target.timedSeconds();
+}
+
+ScopedTimer::~ScopedTimer()
+{
+    double nested = target.timedSeconds() - nestedStart;
+    target.addTime(timedPhase, std::max(0.0, elapsed() - nested));
+}
+
+double ScopedTimer::elapsed() const
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+Summary Summarize(std::vector<double> values)
+{
+    Summary s = {0, 0, 0, 0};
+    if (values.empty())
+        return s;
+
+    std::sort(values.begin(), values.end());
+    size_t n = values.size();
+    s.min = values.front();
+    s.max = values.back();
+    s.median = n % 2 == 1 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2.0;
+    for (auto v : values)
+        s.total += v;
+    return s;
+}
+
+static Json::Value summaryToJson(const Summary& s)
+{
+    Json::Value v;
+    v["min"] = s.min;
+    v["median"] = s.median;
+    v["max"] = s.max;
+    v["total"] = s.total;
+    return v;
+}
+
+Json::Value RunReport(const std::vector<Instrumentation>& ranks, const std::vector<std::string>& roles)
+{
+    Json::Value report;
+    report["processes"] = static_cast<Json::UInt64>(ranks.size());
+
+    // Each phase is summarized over the processes which took part in it, so
+    // the Readers' idle phases don't drag the minimum of the Workers' to zero
+    Json::Value phases(Json::objectValue);
+    for (size_t p = 0; p < PHASE_COUNT; p++)
+    {
+        Phase phase = static_cast<Phase>(p);
+        std::vector<double> seconds, points, bytes, rate;
+        for (const auto& r : ranks)
+        {
+            const PhaseCounters& c = r[phase];
+            if (!c.active())
+                continue;
+            seconds.push_back(c.seconds);
+            points.push_back(static_cast<double>(c.points));
+            bytes.push_back(static_cast<double>(c.bytes));
+            if (c.seconds > 0)
+                rate.push_back(c.points / c.seconds);
+        }
+
+        if (seconds.empty())
+            continue;
+
+        Json::Value summary;
+        summary["ranks"] = static_cast<Json::UInt64>(seconds.size());
+        summary["seconds"] = summaryToJson(Summarize(seconds));
+        summary["points"] = summaryToJson(Summarize(points));
+        summary["bytes"] = summaryToJson(Summarize(bytes));
+        summary["points_per_second"] = summaryToJson(Summarize(rate));
+        phases[PhaseName(phase)] = summary;
+    }
+    report["phases"] = phases;
+
+    // The resident set is summarized over every process, the held and spilled
+    // bytes over the processes which held points
+    std::vector<double> resident, held, spilled;
+    for (const auto& r : ranks)
+    {
+        resident.push_back(static_cast<double>(r.memory.peakResident));
+        if (r.memory.peakHeld == 0)
+            continue;
+        held.push_back(static_cast<double>(r.memory.peakHeld));
+        spilled.push_back(static_cast<double>(r.memory.spilledBytes));
+    }
+    Json::Value memory;
+    memory["peak_resident_bytes"] = summaryToJson(Summarize(resident));
+    memory["peak_held_bytes"] = summaryToJson(Summarize(held));
+    memory["spilled_bytes"] = summaryToJson(Summarize(spilled));
+    report["memory"] = memory;
+
+    // The read-ahead settings and backend of the processes which read blocks,
+    // the backend is "mixed" if io_uring was refused to some of them
+    std::vector<double> stalls;
+    uint64_t depth = 0, bufferBytes = 0, uringBlocks = 0, threadBlocks = 0;
+    for (const auto& r : ranks)
+    {
+        if (r.readAhead.blocks() == 0)
+            continue;
+        stalls.push_back(r.readAhead.stallSeconds);
+        depth = std::max(depth, r.readAhead.queueDepth);
+        bufferBytes = std::max(bufferBytes, r.readAhead.bufferBytes);
+        uringBlocks += r.readAhead.uringBlocks;
+        threadBlocks += r.readAhead.threadBlocks;
+    }
+    Json::Value readAhead;
+    readAhead["queue_depth"] = static_cast<Json::UInt64>(depth);
+    readAhead["buffer_bytes"] = static_cast<Json::UInt64>(bufferBytes);
+    readAhead["backend"] = uringBlocks == 0 ? (threadBlocks == 0 ? "none" : "thread") : (threadBlocks == 0 ? "io_uring" : "mixed");
+    readAhead["blocks"] = static_cast<Json::UInt64>(uringBlocks + threadBlocks);
+    readAhead["stall_seconds"] = summaryToJson(Summarize(stalls));
+    report["read_ahead"] = readAhead;
+
+    Json::Value processes(Json::arrayValue);
+    for (size_t i = 0; i < ranks.size(); i++)
+    {
+        Json::Value entry;
+        entry["rank"] = static_cast<Json::UInt64>(i);
+        entry["role"] = i < roles.size() ? roles[i] : "";
+
+        Json::Value counters(Json::objectValue);
+        for (size_t p = 0; p < PHASE_COUNT; p++)
+        {
+            Phase phase = static_cast<Phase>(p);
+            const PhaseCounters& c = ranks[i][phase];
+            if (!c.active())
+                continue;
+            Json::Value v;
+            v["seconds"] = c.seconds;
+            v["points"] = static_cast<Json::UInt64>(c.points);
+            v["bytes"] = static_cast<Json::UInt64>(c.bytes);
+            counters[PhaseName(phase)] = v;
+        }
+        entry["phases"] = counters;
+
+        const MemoryCounters& m = ranks[i].memory;
+        Json::Value memoryEntry;
+        memoryEntry["peak_resident_bytes"] = static_cast<Json::UInt64>(m.peakResident);
+        memoryEntry["peak_held_bytes"] = static_cast<Json::UInt64>(m.peakHeld);
+        memoryEntry["spilled_bytes"] = static_cast<Json::UInt64>(m.spilledBytes);
+        memoryEntry["spilled_regions"] = static_cast<Json::UInt64>(m.spilledRegions);
+        memoryEntry["reloaded_regions"] = static_cast<Json::UInt64>(m.reloadedRegions);
+        entry["memory"] = memoryEntry;
+
+        const ReadAheadCounters& ra = ranks[i].readAhead;
+        if (ra.blocks() > 0)
+        {
+            Json::Value readAheadEntry;
+            readAheadEntry["uring_blocks"] = static_cast<Json::UInt64>(ra.uringBlocks);
+            readAheadEntry["thread_blocks"] = static_cast<Json::UInt64>(ra.threadBlocks);
+            readAheadEntry["stall_seconds"] = ra.stallSeconds;
+            entry["read_ahead"] = readAheadEntry;
+        }
+        processes.append(entry);
+    }
+    report["ranks"] = processes;
+
+    return report;
+}
+
+void WriteRunReport(std::string fileName, const Json::Value& report)
+{
+    std::ofstream out(fileName.c_str());
+    if (!out.is_open())
+        throw std::invalid_argument("Could not open run report " + fileName + " for output");
+
+    Json::StyledStreamWriter writer;
+    writer.write(out, report);
+}
@@ -0,0 +1,166 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Per-phase timing and throughput counters.  Every process keeps one
+    Instrumentation object which accumulates the wall time, number of points
+    and number of bytes of each phase of the algorithm, summed over both
+    stages.  The phases do not overlap, so the time of a process is split
+    between them rather than counted twice.  It also records the memory high
+    water marks of the process and how much a Worker spilled to scratch.
+
+    At the end of a run the counters of every process are packed into a flat
+    array of doubles, gathered on the Director and written as a JSON report
+    with the minimum, median and maximum of each phase across the processes
+    which took part in it.
+
+*/
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+#include "json/json.h"
+
+enum class Phase {parse, readScratch, send, wait, receive, treeBuild, thinning, voxelize, write, combine, spill};
+
+#define PHASE_COUNT 11
+
+// The name used for the phase in the run report
+const char* PhaseName(Phase phase);
+
+struct PhaseCounters
+{
+    double seconds;
+    uint64_t points;
+    uint64_t bytes;
+
+    PhaseCounters();
+    bool active() const;
+};
+
+// Memory use of a process in bytes.  The peak resident set size is measured
+// by the operating system, the held bytes are the point containers a Worker
+// keeps in memory, and the spill counters are the regions a Worker moved to
+// scratch to stay within its memory budget.
+struct MemoryCounters
+{
+    uint64_t peakResident;
+    uint64_t peakHeld;
+    uint64_t spilledBytes;
+    uint64_t spilledRegions;
+    uint64_t reloadedRegions;
+
+    MemoryCounters();
+};
+
+#define MEMORY_COUNTER_COUNT 5
+
+// How a Reader read its input.  The queue depth and buffer size are the
+// settings it read with, the block counts tell which backend did the reads,
+// and the stall time is how long parsing waited for a block which was not
+// read yet, which is near zero when the reads keep ahead of the parsing.
+struct ReadAheadCounters
+{
+    uint64_t queueDepth;
+    uint64_t bufferBytes;
+    uint64_t uringBlocks;
+    uint64_t threadBlocks;
+    double stallSeconds;
+
+    ReadAheadCounters();
+    inline uint64_t blocks() const { return uringBlocks + threadBlocks; }
+};
+
+#define READAHEAD_COUNTER_COUNT 5
+
+// The peak resident set size of this process so far, zero if unavailable
+uint64_t PeakResidentBytes();
+
+class Instrumentation
+{
+public:
+    Instrumentation();
+
+    inline PhaseCounters& operator[](Phase phase) { return counters[static_cast<size_t>(phase)]; }
+    inline const PhaseCounters& operator[](Phase phase) const { return counters[static_cast<size_t>(phase)]; }
+
+    void addTime(Phase phase, double seconds);
+    void addPoints(Phase phase, uint64_t points);
+    void addBytes(Phase phase, uint64_t bytes);
+
+    // Raises the held bytes high water mark
+    void recordHeld(uint64_t bytes);
+
+    MemoryCounters memory;
+    ReadAheadCounters readAhead;
+
+    // The counters as PHASE_COUNT triples of seconds, points and bytes followed
+    // by the MEMORY_COUNTER_COUNT memory counters and the
+    // READAHEAD_COUNTER_COUNT read-ahead counters, used to gather the counters
+    // of every process with a single MPI call
+    std::vector<double> pack() const;
+    static Instrumentation unpack(const double* packed);
+
+    // The sum of the time added to every phase, used by ScopedTimer to leave
+    // out the time of nested timers
+    inline double timedSeconds() const { return totalSeconds; }
+
+private:
+    PhaseCounters counters[PHASE_COUNT];
+    double totalSeconds;
+};
+
+// Adds the wall time between its construction and destruction to a phase.
+// Time recorded to other phases in the meantime, such as by a nested timer
+// around the sends within a parse loop, is subtracted so phases never overlap.
+class ScopedTimer
+{
+public:
+    ScopedTimer(Instrumentation& instrumentation, Phase phase);
+    ~ScopedTimer();
+
+    double elapsed() const;
+
+private:
+    Instrumentation& target;
+    Phase timedPhase;
+    std::chrono::steady_clock::time_point start;
+    double nestedStart;
+};
+
+struct Summary
+{
+    double min;
+    double median;
+    double max;
+    double total;
+};
+
+// The minimum, median, maximum and sum of a set of values, all zero if empty
+Summary Summarize(std::vector<double> values);
+
+// Builds the run report from the counters of every process, indexed by rank,
+// and the role name of each process
+Json::Value RunReport(const std::vector<Instrumentation>& ranks, const std::vector<std::string>& roles);
+
+void WriteRunReport(std::string fileName, const Json::Value& report);
+
+#endif
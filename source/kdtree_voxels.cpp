@@ -5,13 +5,19 @@
 #include <cstdio>
 #include <fstream>
 #include <cmath>
-#include <set>
+#include <algorithm>
 
 #include "nanoflann.hpp"
 #include "vector3d.h"
 #include "pointcloud.h"
 #include "utilities.h"
 #include "voxelsorter.h"
+#include "voxelgrid.h"
+#include "attributes.h"
+#include "tiling.h"
+#include "thinning.h"
+#include "parallelkdtree.h"
+#include "asyncwriter.h"
 
 using namespace nanoflann;
 
@@ -33,42 +39,70 @@ int main(int argc, char* argv[])
     auto config = LoadConfiguration(argv[1]);
     PrintConfigDetails(config, 14);
 
-    PointCloud cloud(LoadPointsFromFile(config.inputFile));
+    PointAttributes attributes;
+    std::vector<Vector3d> points;
+    if (IsTileIndex(config.inputFile))
+    {
+        // A tiled input is read from its data file in tile order
+        size_t stride = config.attributeColumns.enabled() ? 5 : 3;
+        TileIndex tiles = LoadTileIndex(config.inputFile);
+        if (tiles.stride != stride)
+        {
+            std::cout << "kdtree_voxels: " << config.inputFile << " was tiled with point attributes "
+                      << (tiles.stride == 5 ? "enabled" : "disabled") << ", which must match attribute_columns" << std::endl;
+            return -1;
+        }
+        points.reserve(tiles.points);
+        InputRange all{tiles.dataFile, 0, tiles.points * stride * sizeof(double)};
+        ForEachRecordInRange(all, stride, [&](const double* record)
+        {
+            points.push_back(Vector3d(record[0], record[1], record[2]));
+            if (stride == 5)
+                attributes.pushPacked(record[3], record[4]);
+        });
+    }
+    else
+        points = LoadPointsFromFile(config.inputFile, config.attributeColumns, attributes);
+    PointCloud cloud(std::move(points), std::move(attributes));
     std::cout << "kdtree_voxels: Loaded " << cloud.pts.size() << " points from file." << std::endl;
 
+    // Time thinning the start of the cloud at several leaf sizes
+    if (config.autoLeafSize)
+    {
+        size_t n = std::min(cloud.pts.size(), (size_t)LEAF_SIZE_SAMPLE_POINTS);
+        std::vector<PointCloud> sample{PointCloud(std::vector<Vector3d>(cloud.pts.begin(), cloud.pts.begin() + n))};
+        std::vector<LeafSizeTiming> timings;
+        config.leafSize = CalibrateLeafSize(sample, config.thinningDistance, false, timings);
+        std::cout << "kdtree_voxels: leaf size calibration on " << n << " points,";
+        for (const auto& t : timings)
+            std::cout << " " << t.leafSize << ":" << (size_t)(t.seconds * 1e6) << "us";
+        std::cout << ", leaf size " << config.leafSize << std::endl;
+    }
+
     // Thin the points
     std::cout << "kdtree_voxels: building kd-tree index" << std::endl;
-    typedef KDTreeSingleIndexAdaptor<L2_Simple_Adaptor<double, PointCloud> ,PointCloud,3> my_kd_tree_t;
-
-    my_kd_tree_t index(3, cloud, KDTreeSingleIndexAdaptorParams(10));
-    index.buildIndex();
+    ParallelKDTree<PointCloud> index(cloud, config.leafSize);
+    index.buildIndex(config.threads);
     std::cout << "kdtree_voxels: index complete" << std::endl;
     std::cout << "kdtree_voxels: Thinning point cloud [0%]";
 
-    std::set<size_t> removeIndicies;
+    std::vector<char> removed(cloud.pts.size(), 0);
     const double searchRadius = config.thinningDistance*config.thinningDistance;
     for (size_t i = 0; i < cloud.pts.size(); i++)
     {
-        if (removeIndicies.find(i) == removeIndicies.end())
+        if (!removed[i])
         {
             double query_pt[3] = { cloud.pts[i].x, cloud.pts[i].y, cloud.pts[i].z};
 
-            std::vector<std::pair<size_t,double>> indices_dists;
-            RadiusResultSet<double,size_t> resultSet(searchRadius, indices_dists);
-            index.findNeighbors(resultSet, query_pt, nanoflann::SearchParams());
-
-            for (auto r : resultSet.m_indices_dists)
-            {
-                if (i != r.first)
-                    removeIndicies.insert(r.first);
-            }
+            RemovalMarker marker(removed, searchRadius, i);
+            index.radiusSearchCustomCallback(query_pt, marker);
         }
 
         if (i % 500 == 0)
             std::cout << "\rkdtree_voxels: Thinning point cloud [" << (int)(i * 100 / cloud.pts.size()) << "%]";
     }
 
-    cloud.RemoveAtIndicies(removeIndicies);
+    cloud.RemoveMarked(removed);
     std::cout << "\rkdtree_voxels: Thinning completed, " << cloud.pts.size() << " points remaining." << std::endl;
 
     std::cout << "kdtree_voxels: Sorting into voxels" << std::endl;
@@ -76,6 +110,53 @@ int main(int argc, char* argv[])
     // Make the voxel sorter
     VoxelSorter sorter(config.binWidths.x, config.binWidths.y, config.binWidths.z, config.binOffsets.x, config.binOffsets.y, config.binOffsets.z);
 
+    // Write the per-voxel attribute aggregates next to the output file
+    if (cloud.hasAttributes())
+    {
+        std::unordered_map<VoxelAddress, VoxelAttributes> aggregates;
+        for (size_t n = 0; n < cloud.pts.size(); n++)
+        {
+            accumulateVoxelAttributes(aggregates, sorter.identifyPoint(cloud.pts[n]).address, cloud.pts[n].z,
+                                      cloud.attributes.intensity[n], cloud.attributes.returnNumber[n], cloud.attributes.numberOfReturns[n]);
+        }
+
+        std::string attributeFile = config.outputFile + ".voxattr";
+        std::cout << "kdtree_voxels: Writing voxel attributes to " << attributeFile << std::endl;
+        AsyncOutputFile attributeStream(attributeFile);
+        for (const auto &voxel : aggregates)
+        {
+            attributeStream << voxel.first.i << "," << voxel.first.j << "," << voxel.first.k << "," << voxel.second << '\n';
+        }
+        attributeStream.close();
+    }
+
+    // Open the output file, replacing any earlier one
+    AsyncOutputFile outfile(config.outputFile);
+
+    if (config.voxelBackend == "brick")
+    {
+        // Pick the brick size from the addresses of all of the points
+        std::vector<VoxelAddress> addresses;
+        addresses.reserve(cloud.pts.size());
+        for (auto p : cloud.pts)
+            addresses.push_back(sorter.identifyPoint(p).address);
+
+        // Make the dense brick voxel representation and accumulate the points
+        BrickVoxelGrid voxels(BrickVoxelGrid::chooseBrickEdge(addresses));
+        for (auto a : addresses)
+            incrementVoxelIntensity(voxels, a);
+
+        std::cout << "kdtree_voxels: Voxel grid " << voxels.statistics() << std::endl;
+
+        // Print out the addresses and intensities
+        voxels.forEachVoxel([&outfile](const VoxelAddress& a, uint32_t value)
+        {
+            outfile << a.i << "," << a.j << "," << a.k << "," << value << '\n';
+        });
+        outfile.close();
+        return 0;
+    }
+
     // Make the sparse voxel representation as an unordered_map
     std::unordered_map<VoxelAddress, int> voxels;
 
@@ -87,18 +168,12 @@ int main(int argc, char* argv[])
         incrementVoxelIntensity(voxels, located.address);
     }
 
-    // Attempt to remove the output file
-    std::remove(config.outputFile.c_str());
-
-    // Open the output file
-    std::ofstream outfile;
-    outfile.open(config.outputFile, std::ios_base::app);
-
     // Print out the addresses and intensities
     for (auto voxel : voxels)
     {
-        outfile << voxel.first.i << "," << voxel.first.j << "," << voxel.first.k << "," << voxel.second << std::endl;
+        outfile << voxel.first.i << "," << voxel.first.j << "," << voxel.first.k << "," << voxel.second << '\n';
     }
+    outfile.close();
 
     return 0;
 }
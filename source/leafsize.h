@@ -0,0 +1,80 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Calibration of the k-d tree leaf size.
+
+    The number of points in a leaf trades the depth of the tree against the
+    number of distances computed at the bottom of every search, and which
+    size is fastest depends on the density of the cloud and on the search.
+    Rather than fixing it, a tool can time its own build and searches on a
+    sample of the cloud at each of a handful of candidate sizes and keep the
+    fastest.
+
+*/
+#ifndef LEAFSIZE_H
+#define LEAFSIZE_H
+
+#include <chrono>
+#include <vector>
+
+// The leaf sizes tried by the calibration
+static const size_t LEAF_SIZE_CANDIDATES[] = {4, 8, 10, 16, 24, 32, 48, 64};
+
+// The number of times each candidate is timed, keeping the fastest run so
+// that a single interruption does not decide the choice
+#define LEAF_SIZE_REPEATS 3
+
+// The number of points at the start of the cloud which the single process
+// tools calibrate on
+#define LEAF_SIZE_SAMPLE_POINTS (1 << 17)
+
+struct LeafSizeTiming
+{
+    size_t leafSize;
+    double seconds;
+};
+
+// Times run(leafSize) at every candidate leaf size, appending the fastest of
+// the repeated runs of each to timings, and returns the fastest leaf size
+template <typename Run>
+size_t FastestLeafSize(Run run, std::vector<LeafSizeTiming>& timings)
+{
+    size_t fastest = LEAF_SIZE_CANDIDATES[0];
+    double fastestSeconds = -1;
+    for (size_t leafSize : LEAF_SIZE_CANDIDATES)
+    {
+        double best = -1;
+        for (int repeat = 0; repeat < LEAF_SIZE_REPEATS; repeat++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            run(leafSize);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (best < 0 || seconds < best)
+                best = seconds;
+        }
+        timings.push_back(LeafSizeTiming{leafSize, best});
+        if (fastestSeconds < 0 || best < fastestSeconds)
+        {
+            fastest = leafSize;
+            fastestSeconds = best;
+        }
+    }
+    return fastest;
+}
+
+#endif
@@ -0,0 +1,176 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Morton (Z-order) codes and a parallel radix sort by them.
+
+*/
+
+#include "morton.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <thread>
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+// Below this many keys per thread the threads cost more than they save
+#define RADIX_MIN_THREAD_KEYS 32768
+
+static uint64_t spreadBits(uint64_t x)
+{
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+}
+
+static uint64_t compactBits(uint64_t x)
+{
+    x &= 0x1249249249249249ULL;
+    x = (x ^ (x >> 2)) & 0x10c30c30c30c30c3ULL;
+    x = (x ^ (x >> 4)) & 0x100f00f00f00f00fULL;
+    x = (x ^ (x >> 8)) & 0x1f0000ff0000ffULL;
+    x = (x ^ (x >> 16)) & 0x1f00000000ffffULL;
+    x = (x ^ (x >> 32)) & 0x1fffff;
+    return x;
+}
+
+uint64_t MortonInterleave(uint64_t i, uint64_t j, uint64_t k)
+{
+    return spreadBits(i) | spreadBits(j) << 1 | spreadBits(k) << 2;
+}
+
+void MortonDeinterleave(uint64_t code, uint64_t& i, uint64_t& j, uint64_t& k)
+{
+    i = compactBits(code);
+    j = compactBits(code >> 1);
+    k = compactBits(code >> 2);
+}
+
+// Runs f(t) for every thread number t, the first on the calling thread
+template <typename F>
+static void forEachThread(size_t threads, F f)
+{
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; t++)
+        pool.push_back(std::thread(f, t));
+    f(0);
+    for (auto& thread : pool)
+        thread.join();
+}
+
+static void radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values,
+                      std::vector<uint64_t>& keyScratch, std::vector<uint32_t>& valueScratch, size_t threads)
+{
+    const size_t n = keys.size();
+    threads = std::max<size_t>(1, std::min(threads, n / RADIX_MIN_THREAD_KEYS));
+    keyScratch.resize(n);
+    valueScratch.resize(n);
+
+    // Each thread counts and then scatters its own contiguous chunk, and the
+    // chunks are placed in order within every bucket, so each pass is stable
+    std::vector<std::array<size_t, RADIX_BUCKETS>> offsets(threads);
+    auto chunkBegin = [n, threads](size_t t) { return n / threads * t + n % threads * t / threads; };
+
+    for (int shift = 0; shift < 64; shift += RADIX_BITS)
+    {
+        forEachThread(threads, [&](size_t t)
+        {
+            offsets[t].fill(0);
+            for (size_t i = chunkBegin(t); i < chunkBegin(t + 1); i++)
+                offsets[t][(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+        });
+
+        // Digits that are the same for every key, such as the unused high
+        // bits of the codes, leave the order unchanged
+        size_t start = 0;
+        bool allInOneBucket = false;
+        for (size_t b = 0; b < RADIX_BUCKETS; b++)
+        {
+            size_t total = 0;
+            for (size_t t = 0; t < threads; t++)
+            {
+                size_t count = offsets[t][b];
+                offsets[t][b] = start + total;
+                total += count;
+            }
+            allInOneBucket = allInOneBucket || total == n;
+            start += total;
+        }
+        if (allInOneBucket)
+            continue;
+
+        forEachThread(threads, [&](size_t t)
+        {
+            auto& next = offsets[t];
+            for (size_t i = chunkBegin(t); i < chunkBegin(t + 1); i++)
+            {
+                size_t to = next[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+                keyScratch[to] = keys[i];
+                valueScratch[to] = values[i];
+            }
+        });
+        keys.swap(keyScratch);
+        values.swap(valueScratch);
+    }
+}
+
+void RadixSortByKey(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, size_t threads)
+{
+    std::vector<uint64_t> keyScratch;
+    std::vector<uint32_t> valueScratch;
+    radixSort(keys, values, keyScratch, valueScratch, threads);
+}
+
+const std::vector<uint32_t>& MortonOrder::sort(const std::vector<Vector3d>& points, size_t threads)
+{
+    order.resize(points.size());
+    keys.resize(points.size());
+    if (points.empty())
+        return order;
+
+    Vector3d low = points[0];
+    Vector3d high = points[0];
+    for (const auto& p : points)
+    {
+        low.x = std::min(low.x, p.x);
+        low.y = std::min(low.y, p.y);
+        low.z = std::min(low.z, p.z);
+        high.x = std::max(high.x, p.x);
+        high.y = std::max(high.y, p.y);
+        high.z = std::max(high.z, p.z);
+    }
+
+    // The same cell size on every axis keeps the cells cubic
+    const double cells = (double)((1 << MORTON_COORDINATE_BITS) - 1);
+    double extent = std::max(high.x - low.x, std::max(high.y - low.y, high.z - low.z));
+    double scale = extent > 0 ? cells / extent : 0;
+    for (size_t n = 0; n < points.size(); n++)
+    {
+        const Vector3d& p = points[n];
+        keys[n] = MortonInterleave((uint64_t)((p.x - low.x) * scale), (uint64_t)((p.y - low.y) * scale), (uint64_t)((p.z - low.z) * scale));
+        order[n] = (uint32_t)n;
+    }
+
+    radixSort(keys, order, keyScratch, valueScratch, threads);
+    return order;
+}
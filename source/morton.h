@@ -0,0 +1,62 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Morton (Z-order) codes and a parallel radix sort by them.
+
+    Interleaving the bits of the integer coordinates of a cell gives a key
+    whose order visits space along a Z shaped curve, so points with nearby
+    keys are close together.  Sorting the points of a region by it before
+    building the k-d tree lays out each subtree in a contiguous run of memory.
+
+*/
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <vector>
+#include <cstdint>
+#include "vector3d.h"
+
+// The number of bits of each coordinate held in a code
+#define MORTON_COORDINATE_BITS 21
+
+// Interleaves the low MORTON_COORDINATE_BITS bits of the coordinates, i in
+// the lowest bit, and the reverse
+uint64_t MortonInterleave(uint64_t i, uint64_t j, uint64_t k);
+void MortonDeinterleave(uint64_t code, uint64_t& i, uint64_t& j, uint64_t& k);
+
+// Stable least significant digit radix sort of the keys, carrying the values
+// along, with the counting and scattering of each pass split over threads
+void RadixSortByKey(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, size_t threads);
+
+// Computes the order which sorts points by the Morton code of their cell on a
+// grid of 2^21 cells spanning their bounding box.  The buffers are kept so
+// sorting one region after another doesn't allocate.
+class MortonOrder
+{
+public:
+    // Returns the indices of the points in Morton order
+    const std::vector<uint32_t>& sort(const std::vector<Vector3d>& points, size_t threads);
+
+private:
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> order;
+    std::vector<uint64_t> keyScratch;
+    std::vector<uint32_t> valueScratch;
+};
+
+#endif
@@ -9,7 +9,9 @@
 #include <iterator>
 #include <memory>
 #include <unordered_map>
+#include <unordered_set>
 #include <cstdio>
+#include <algorithm>
 
 #include <thread>
 #include <chrono>
@@ -19,16 +21,40 @@
 #include "vector3d.h"
 #include "pointcloud.h"
 #include "voxelsorter.h"
+#include "voxelgrid.h"
+#include "attributes.h"
+#include "canopyprofile.h"
+#include "checkpoint.h"
+#include "instrumentation.h"
+#include "thinning.h"
+#include "inputsplit.h"
+#include "regionspill.h"
+#include "tiling.h"
+#include "spacing.h"
+#include "subdivision.h"
+#include "readahead.h"
+#include "asyncwriter.h"
 
 using namespace nanoflann;
 
-#define MAX_SEND_SIZE 100 // When the transmit buffers get to this size they send
+#define MAX_POINT_STRIDE 5 // Doubles per point with x, y, z, intensity, and packed returns
 #define START_DELAY 1   // Number of seconds to delay non-director start
+#define CALIBRATION_BYTES (4 << 20) // Bytes of input sampled by the startup calibrations
+#define SAMPLE_RANGES 4             // Ranges spread through a file sampled by the calibrations
+#define MIN_SAMPLE_BYTES (256 << 10) // Fewest bytes of each file sampled for the binning distance
+#define BINNING_REGIONS_PER_WORKER 16 // Regions per Worker an "auto" binning distance leaves at least
 
 enum class ProgramState {reading, thinning, reading2, thinning2, finalize};
 enum class MessageInfo {readerDone, workerDone, startWorking};
 enum class WorkerTypes {director, reader, worker};
 
+/// Returns the files holding the input points, which are the input files with
+/// every tile index replaced by the tiled data file it describes
+std::vector<std::string> inputDataFiles(const ParallelConfiguration &config)
+{
+    return ExpandTileIndices(config.inputFiles, config.attributeColumns.enabled() ? 5 : 3);
+}
+
 /// The Directory class takes the MPI world size and the configuration settings
 /// and from it computes the task assignments of all of the processes in the MPI
 /// world.  This is computed by each process in a deterministic way in order to
@@ -44,14 +70,12 @@ public:
         // The 0-th worker is always the director
         mapping[0] = WorkerTypes::director;
 
-        // If there are i input files and n processes, there will be n/4 readers
-        // where there is at least one reader and no more than the number of
-        // input files.
-        nReaders = (size_t)((float)worldSize / 4.0);
-        if (nReaders < 1)
-            nReaders  = 1;
-        if (nReaders > config.inputFiles.size())
-            nReaders = config.inputFiles.size();
+        // If there are n processes, there will be n times the reader ratio (a
+        // quarter by default) readers where there is at least one reader and
+        // at least one worker.  The input is divided among the readers by byte
+        // ranges, so the number of input files doesn't limit the readers, but
+        // each reader is given at least MIN_READER_BYTES of input.
+        nReaders = ReaderCount(worldSize, config.readerRatio, TotalInputBytes(inputDataFiles(config)));
 
         nWorkers = worldSize - 1 - nReaders;
 
@@ -113,12 +137,59 @@ public:
         programState = ProgramState::reading;
         directory = d;
         config = configuration;
+        started = std::chrono::steady_clock::now();
+
+        // Every process reads the checkpoint manifest at startup so that they
+        // all agree on which stage the run resumes from
+        if (config.resume)
+            checkpoint = LoadCheckpoint(config.scratchDirectory, checkpointFingerprint());
     }
 
     virtual void run() = 0;
 
     virtual std::string name() = 0;
 
+    /// Gathers the phase counters of every process on the Director, which
+    /// writes them as the JSON run report.  This is a collective call that
+    /// every process makes once it has finished running.
+    void reportMetrics()
+    {
+        if (config.runReport.empty())
+            return;
+
+        metrics.memory.peakResident = PeakResidentBytes();
+        std::vector<double> packed = metrics.pack();
+        bool isDirector = worldId == directory->director();
+        std::vector<double> gathered(isDirector ? packed.size() * worldSize : 0);
+        MPI_Gather(packed.data(), packed.size(), MPI_DOUBLE, gathered.data(), packed.size(), MPI_DOUBLE,
+                   directory->director(), MPI_COMM_WORLD);
+
+        if (!isDirector)
+            return;
+
+        std::vector<Instrumentation> ranks;
+        std::vector<std::string> roles;
+        for (size_t rank = 0; rank < worldSize; rank++)
+        {
+            ranks.push_back(Instrumentation::unpack(&gathered[rank * packed.size()]));
+            roles.push_back(roleName(rank));
+        }
+
+        Json::Value report = RunReport(ranks, roles);
+        report["readers"] = static_cast<Json::UInt64>(directory->numberOfReaders());
+        report["workers"] = static_cast<Json::UInt64>(directory->numberOfWorkers());
+        report["reader_ratio"] = config.readerRatio;
+        report["thinning_distance"] = config.thinningDistance;
+        report["thinning_distance_auto"] = config.autoThinningDistance;
+        report["binning_distance"] = config.binningDistance;
+        report["binning_distance_auto"] = config.autoBinningDistance;
+        report["leaf_size"] = static_cast<Json::UInt64>(config.leafSize);
+        report["leaf_size_auto"] = config.autoLeafSize;
+        report["wall_seconds"] = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        WriteRunReport(config.runReport, report);
+        std::cout << "Director has written the run report to " << config.runReport << std::endl;
+    }
+
 protected:
     size_t worldId;
     size_t worldSize;
@@ -127,15 +198,58 @@ protected:
     std::shared_ptr<Directory> directory;
     std::unique_ptr<VoxelSorter> sorter;
     double dv;
+    CheckpointManifest checkpoint;
+    Instrumentation metrics;
+    std::chrono::steady_clock::time_point started;
+
+    std::string roleName(size_t rank)
+    {
+        switch (directory->getProcessType(rank))
+        {
+            case WorkerTypes::director:
+                return "Director";
+            case WorkerTypes::reader:
+                return "Reader " + std::to_string(directory->readerFromRank(rank));
+            default:
+                return "Worker " + std::to_string(directory->workerFromRank(rank));
+        }
+    }
+
+    /// The edge length of the thinning bins
+    double binSpacing()
+    {
+        return BinSpacing(config);
+    }
+
+    std::string checkpointFingerprint()
+    {
+        return CheckpointFingerprint(config, binSpacing(), pointStride());
+    }
+
+    std::string workerFileName(size_t worker, std::string suffix)
+    {
+        return config.scratchDirectory + "worker" + std::to_string(worker) + suffix;
+    }
+
+    /// The thinned stage 1 scratch files, which come from the checkpoint when
+    /// resuming and otherwise hold one file per Worker of this run
+    std::vector<std::string> stageOneFiles()
+    {
+        if (checkpoint.stage == 1)
+            return checkpoint.files;
+
+        std::vector<std::string> scratchFiles;
+        for (size_t i = 0; i < directory->numberOfWorkers(); i++)
+            scratchFiles.push_back(workerFileName(i, ".binary"));
+        return scratchFiles;
+    }
 
     /// Initializes the process' internal VoxelSorter with the information from
     /// the configuration object and a flag that determines whether the bins
     /// are shifted by half of the bin spacing (used in the initial sorting step)
     void initializeSorter(bool isShifted)
     {
-        int mult = 0;
-        while (config.voxelDistance * ++mult < config.binningDistance);
-        dv = config.voxelDistance * mult;
+        dv = binSpacing();
         // std::cout << "  grouping distance = " << dv << std::endl;
         if (isShifted)
             sorter.reset(new VoxelSorter(dv, dv, dv, dv/2.0, dv/2.0, dv/2.0));
@@ -143,17 +257,42 @@ protected:
             sorter.reset(new VoxelSorter(dv, dv, dv, 0, 0, 0));
     }
 
+    /// The number of doubles used for each point in MPI messages and binary
+    /// scratch files, which carry the point attributes when they are enabled
+    size_t pointStride()
+    {
+        return config.attributeColumns.enabled() ? 5 : 3;
+    }
+
+    /// The file name suffix for a level of the voxel pyramid, level 0 keeps the
+    /// original single resolution file names
+    std::string levelSuffix(size_t level)
+    {
+        return level == 0 ? "" : "_L" + std::to_string(level);
+    }
+
+    /// The buffer size and direct I/O setting of the output files, which are
+    /// written by a background thread
+    AsyncWriterSettings writerSettings()
+    {
+        AsyncWriterSettings settings;
+        settings.bufferBytes = config.writeBufferBytes;
+        settings.directIO = config.directIO;
+        return settings;
+    }
+
     /// Blocks the process thread until an MPI communication is recieved with a
     /// MessageInfo::startWorking signal.
     void waitForStartInstruction()
     {
+        ScopedTimer timer(metrics, Phase::wait);
         int rawMessageCode;
         MPI_Status status;
         bool gotStartMessage = false;
         while (!gotStartMessage)
         {
             MPI_Probe(MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &status);
-            MPI_Recv(&rawMessageCode, 1, MPI_INT, MPI_ANY_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, &status);
+            MPI_Recv(&rawMessageCode, 1, MPI_INT, status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, &status);
 
             if (static_cast<MessageInfo>(rawMessageCode) == MessageInfo::startWorking)
             {
@@ -181,6 +320,10 @@ public:
         std::cout << "  -> Configuration details: " << std::endl;
         PrintConfigDetails(config, 14);
 
+        // The Director doesn't sort any points, but the bin spacing is needed
+        // for the header of the combined results
+        initializeSorter(false);
+
         for (size_t i = 0; i < directory->numberOfReaders(); i++)
             readers.push_back(false);
 
@@ -193,47 +336,113 @@ public:
 
     void run() override
     {
-        // Wait for all of the readers to say they're done
-        waitFor(readers, MessageInfo::readerDone);
-        std::cout << "Director has confirmed that all readers have finished distributing stage 1 data" << std::endl;
+        std::string fingerprint = checkpointFingerprint();
+        std::vector<std::string> scratchFiles = stageOneFiles();
+        CheckpointManifest completed = checkpoint;
 
-        // Tell the workers to start thinning
-        for (size_t i = 0; i < directory->numberOfWorkers(); i++)
-            directory->tellProcessToStart(directory->workerByNumber(i));
+        if (checkpoint.stage > 0)
+            std::cout << "Director is resuming after stage " << checkpoint.stage << " from the checkpoint in " << config.scratchDirectory << std::endl;
 
-        // Wait for the workers to say they're done
-        waitFor(workers, MessageInfo::workerDone);
-        std::cout << "Director has confirmed that all workers have finished stage 1 thinning" << std::endl;
+        if (checkpoint.stage < 1)
+        {
+            // Wait for all of the readers to say they're done
+            waitFor(readers, MessageInfo::readerDone);
+            std::cout << "Director has confirmed that all readers have finished distributing stage 1 data" << std::endl;
 
-        // Tell the readers to begin stage 2
-        for (size_t i = 0; i < directory->numberOfReaders(); i++)
-            directory->tellProcessToStart(directory->readerByNumber(i));
+            // Tell the workers to start thinning
+            for (size_t i = 0; i < directory->numberOfWorkers(); i++)
+                directory->tellProcessToStart(directory->workerByNumber(i));
 
-        // Wait for the readers to say they're done
-        waitFor(readers, MessageInfo::readerDone);
-        std::cout << "Director has confirmed that all readers have finished distributing stage 2 data" << std::endl;
+            // Wait for the workers to say they're done
+            waitFor(workers, MessageInfo::workerDone);
+            std::cout << "Director has confirmed that all workers have finished stage 1 thinning" << std::endl;
 
-        // Tell the workers to start thinning
-        for (size_t i = 0; i < directory->numberOfWorkers(); i++)
-            directory->tellProcessToStart(directory->workerByNumber(i));
+            // Record that the stage 1 scratch files are complete
+            completed = MakeCheckpoint(1, directory->numberOfWorkers(), fingerprint, scratchFiles);
+            WriteCheckpoint(config.scratchDirectory, completed);
+        }
+
+        if (checkpoint.stage < 2)
+        {
+            programState = ProgramState::reading2;
+
+            // Tell the readers to begin stage 2
+            for (size_t i = 0; i < directory->numberOfReaders(); i++)
+                directory->tellProcessToStart(directory->readerByNumber(i));
+
+            // Wait for the readers to say they're done
+            waitFor(readers, MessageInfo::readerDone);
+            std::cout << "Director has confirmed that all readers have finished distributing stage 2 data" << std::endl;
 
-        waitFor(workers, MessageInfo::workerDone);
-        std::cout << "Director has confirmed that all workers have finished stage 2 thinning and sorting" << std::endl;
+            // Tell the workers to start thinning
+            for (size_t i = 0; i < directory->numberOfWorkers(); i++)
+                directory->tellProcessToStart(directory->workerByNumber(i));
+
+            waitFor(workers, MessageInfo::workerDone);
+            std::cout << "Director has confirmed that all workers have finished stage 2 thinning and sorting" << std::endl;
+
+            // Record that the final files are complete, the stage 1 files are
+            // kept in the manifest so that they are cleaned up at the end
+            std::vector<std::string> finalFiles = finalWorkerFiles(directory->numberOfWorkers());
+            finalFiles.insert(finalFiles.end(), scratchFiles.begin(), scratchFiles.end());
+            completed = MakeCheckpoint(2, directory->numberOfWorkers(), fingerprint, finalFiles);
+            WriteCheckpoint(config.scratchDirectory, completed);
+        }
+
+        programState = ProgramState::finalize;
+        finalWorkers = completed.workers;
         std::cout << "Director reports that the run is now complete" << std::endl;
 
         // Combine the files
         combineResults();
+
+        if (config.canopyProducts)
+            computeCanopyProducts();
+
+        // The results are safely combined, so the scratch files and the
+        // checkpoint are no longer needed
+        for (auto f : completed.files)
+            std::remove(f.c_str());
+        RemoveCheckpoint(config.scratchDirectory);
     }
 
 private:
     std::vector<bool> readers;
     std::vector<bool> workers;
+    size_t finalWorkers;
+
+    /// Every final file written by the given number of Workers
+    std::vector<std::string> finalWorkerFiles(size_t nWorkers)
+    {
+        std::vector<std::string> files;
+        for (size_t i = 0; i < nWorkers; i++)
+        {
+            for (size_t level = 0; level < config.voxelResolutions.size(); level++)
+            {
+                files.push_back(workerFileName(i, "_final" + levelSuffix(level) + ".sparsevox"));
+                if (config.attributeColumns.enabled())
+                    files.push_back(workerFileName(i, "_final" + levelSuffix(level) + ".voxattr"));
+            }
+        }
+        return files;
+    }
 
     void combineResults()
     {
-        std::string outputFileName = "combined_results.sparsevox";
+        for (size_t level = 0; level < config.voxelResolutions.size(); level++)
+        {
+            combineResults(level, ".sparsevox");
+            if (config.attributeColumns.enabled())
+                combineResults(level, ".voxattr");
+        }
+    }
+
+    void combineResults(size_t level, std::string extension)
+    {
+        ScopedTimer timer(metrics, Phase::combine);
+        std::string outputFileName = "combined_results" + levelSuffix(level) + extension;
         std::string line;
-        std::ofstream outputFile(outputFileName);
+        AsyncOutputFile outputFile(outputFileName, writerSettings());
         if (!outputFile.is_open())
         {
             std::cout << "Error opening file " << outputFileName << " for output!" << std::endl;
@@ -241,31 +450,46 @@ private:
         }
 
         // Write the heading information
-        outputFile << "[info]" << std::endl;
-        outputFile << "spacing=" << config.voxelDistance << std::endl;
-        outputFile << "thinning=" << config.thinningDistance << std::endl;
-        outputFile << "binning=" << dv << std::endl;
-        outputFile << "[voxels]" << std::endl;
-
-        for (size_t i = 0; i < directory->numberOfWorkers(); i++)
+        outputFile << "[info]" << '\n';
+        outputFile << "spacing=" << config.voxelResolutions[level] << '\n';
+        outputFile << "thinning=" << config.thinningDistance << '\n';
+        outputFile << "binning=" << dv << '\n';
+        if (extension == ".voxattr")
+            outputFile << "columns=i,j,k," << VOXEL_ATTRIBUTE_COLUMNS << '\n';
+        outputFile << "[voxels]" << '\n';
+
+        for (size_t i = 0; i < finalWorkers; i++)
         {
-            std::string readFileName = config.scratchDirectory + "worker" + std::to_string(i) + "_final.sparsevox";
+            std::string readFileName = workerFileName(i, "_final" + levelSuffix(level) + extension);
             std::cout << "Director is combining results from " << readFileName << std::endl;
             std::ifstream infile(readFileName);
             if (infile.is_open())
             {
                 while (std::getline(infile, line))
                 {
-                    outputFile << line << std::endl;
+                    outputFile << line << '\n';
                 }
             }
             infile.close();
-            std::remove(readFileName.c_str());
         }
 
+        metrics.addBytes(Phase::combine, outputFile.bytes());
         outputFile.close();
     }
 
+    /// Reduces the finest level of the combined results into the column
+    /// profiles and the canopy height and gap fraction raster
+    void computeCanopyProducts()
+    {
+        ScopedTimer timer(metrics, Phase::combine);
+        double spacing;
+        auto voxels = LoadSparseVoxels("combined_results.sparsevox", spacing);
+        auto products = ComputeCanopyProducts(std::move(voxels), spacing, config.groundHeight, config.groundRadius, std::thread::hardware_concurrency());
+        WriteCanopyRaster("combined_results.chm", products.raster);
+        WriteColumnProfiles("combined_results.profiles", products.profiles, spacing);
+        std::cout << "Director has written " << products.profiles.size() << " column profiles and the canopy height raster" << std::endl;
+    }
+
     bool areDone(const std::vector<bool> &vectorOfBools)
     {
         for (auto b : vectorOfBools)
@@ -276,6 +500,7 @@ private:
 
     void waitFor(std::vector<bool> &vectorOfBools, MessageInfo code)
     {
+        ScopedTimer timer(metrics, Phase::wait);
         // Reset the readers
         for (size_t i = 0; i < vectorOfBools.size(); i++)
             vectorOfBools[i] = false;
@@ -287,7 +512,7 @@ private:
             MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
             if (status.MPI_TAG == 0)
             {
-                MPI_Recv(&rawMessageCode, 1, MPI_INT, MPI_ANY_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, &status);
+                MPI_Recv(&rawMessageCode, 1, MPI_INT, status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, &status);
             }
 
             if (static_cast<MessageInfo>(rawMessageCode) == code)
@@ -316,23 +541,41 @@ public:
         readerNumber = directory->readerFromRank(worldId);
         std::cout << "Reader " << readerNumber << " (process rank " << worldId << ") checking in" << std::endl;
 
-        // Figure out which files this reader is supposed to read
-        files = getMyFilesFromList(config.inputFiles);
+        // Figure out which byte ranges of the input files this reader is
+        // supposed to read.  Ranges of tiled inputs start and end on tile
+        // boundaries so that each tile is sent by a single reader.
+        auto shares = SplitInputFiles(inputDataFiles(config), directory->numberOfReaders(), pointStride() * sizeof(double));
+        SnapToTiles(shares, config.inputFiles);
+        ranges = shares[readerNumber];
+
+        readAhead.depth = config.readAheadDepth;
+        readAhead.blockBytes = config.readAheadBytes;
+        readAhead.useUring = config.ioUring;
+        metrics.readAhead.queueDepth = readAhead.depth;
+        metrics.readAhead.bufferBytes = readAhead.blockBytes;
     }
 
     std::string name() override { return "Reader " + std::to_string(directory->readerFromRank(worldId)); }
 
     void run() override
     {
-        // Construct the first stage voxel sorter
-        initializeSorter(true);
+        // Stage 1 is skipped entirely when resuming from a checkpoint
+        if (checkpoint.stage < 1)
+        {
+            // Construct the first stage voxel sorter
+            initializeSorter(true);
 
-        // Start with reading and transmitting all of the files
-        for (auto f : files)
-            readFile(f);
+            // Start with reading and transmitting all of the input ranges
+            for (const auto &r : ranges)
+                readRange(r);
 
-        // Tell the Director we're done
-        directory->sendToDirector(MessageInfo::readerDone);
+            // Tell the Director we're done
+            directory->sendToDirector(MessageInfo::readerDone);
+        }
+
+        // After stage 2 only the Director has work left to do
+        if (checkpoint.stage >= 2)
+            return;
 
         // Wait for the director to tell us to proceed
         waitForStartInstruction();
@@ -340,15 +583,14 @@ public:
         // Reset the sorter to the unshifted position or the second stage
         initializeSorter(false);
 
-        // There should be one scratch file per worker
-        std::vector<std::string> scratchFiles;
-        for (size_t i = 0; i < directory->numberOfWorkers(); i++)
-            scratchFiles.push_back(config.scratchDirectory + "worker" + std::to_string(i) + ".binary");
-        files = getMyFilesFromList(scratchFiles);
+        // The scratch files are divided among the readers by record aligned
+        // byte ranges, their number does not depend on the number of readers
+        // or workers in this run
+        auto scratchRanges = SplitInputFiles(stageOneFiles(), directory->numberOfReaders(), pointStride() * sizeof(double))[readerNumber];
 
-        // Read and transmit all of the scratch files
-        for (auto f: files)
-            readBinaryFile(f);
+        // Read and transmit all of the scratch file ranges
+        for (const auto &r : scratchRanges)
+            readBinaryRange(r, Phase::readScratch);
 
         // Tell the Director we're done
         directory->sendToDirector(MessageInfo::readerDone);
@@ -357,76 +599,71 @@ public:
     }
 
 private:
-    std::vector<std::string> files;
-    std::unordered_map<size_t, std::vector<Vector3d>> transmitBuffers;
+    std::vector<InputRange> ranges;
+    std::unordered_map<size_t, PointCloud> transmitBuffers;
     std::hash<VoxelAddress> hasher;
     size_t readerNumber;
-    double sendBuffer[MAX_SEND_SIZE * 3];
+    std::vector<double> sendBuffer;
+    ReadAheadSettings readAhead;
+    ReadAheadTotals readAheadTotals;
 
-    std::vector<std::string> getMyFilesFromList(std::vector<std::string> allFiles)
+    /// Copies the blocks read ahead so far and the time spent waiting for them
+    /// into the run metrics
+    void recordReadAhead()
     {
-        std::vector<std::string> v;
-        for (size_t i = 0; i < allFiles.size(); i++)
-        {
-            if (i % directory->numberOfReaders() == readerNumber)
-                v.push_back(allFiles[i]);
-        }
-        return v;
+        metrics.readAhead.uringBlocks = readAheadTotals.uringBlocks;
+        metrics.readAhead.threadBlocks = readAheadTotals.threadBlocks;
+        metrics.readAhead.stallSeconds = readAheadTotals.stallSeconds;
     }
 
-    void sendVectorsToWorker(size_t workerNumber, const std::vector<Vector3d> &sendList)
+    void sendVectorsToWorker(size_t workerNumber, const PointCloud &sendList)
     {
         // Load the buffer
+        sendBuffer.resize(sendList.pts.size() * MAX_POINT_STRIDE);
         size_t i = 0;
-        for (Vector3d v : sendList)
+        for (size_t n = 0; n < sendList.pts.size(); n++)
         {
+            const Vector3d &v = sendList.pts[n];
             sendBuffer[i++] = v.z;
             sendBuffer[i++] = v.y;
             sendBuffer[i++] = v.x;
+
+            if (sendList.hasAttributes())
+            {
+                sendBuffer[i++] = sendList.attributes.intensity[n];
+                sendBuffer[i++] = sendList.attributes.packedReturns(n);
+            }
         }
 
-        MPI_Send(sendBuffer, i, MPI_DOUBLE, directory->workerByNumber(workerNumber), 1, MPI_COMM_WORLD);
+        ScopedTimer timer(metrics, Phase::send);
+        MPI_Send(sendBuffer.data(), i, MPI_DOUBLE, directory->workerByNumber(workerNumber), 1, MPI_COMM_WORLD);
+        metrics.addPoints(Phase::send, sendList.size());
+        metrics.addBytes(Phase::send, i * sizeof(double));
     }
 
 
-    void readBinaryFile(std::string fileName)
+    /// Adds a point, and its attributes when they are being carried, to the
+    /// transmit buffer of the given worker and sends the buffer if it is full
+    void bufferPointForWorker(size_t worker, const Vector3d &v, const PointAttributes &attributes, size_t index)
     {
-        transmitBuffers.clear();
+        PointCloud &buffer = transmitBuffers[worker];
+        buffer.pts.push_back(v);
+        if (config.attributeColumns.enabled())
+            buffer.attributes.append(attributes, index);
 
-        size_t totalCount = 0;
-        std::cout << "Reader " << directory->readerFromRank(worldId) << " is processing " << fileName << std::endl;
-        std::ifstream fileStream(fileName, std::ios::binary);
-
-        double ix, iy, iz;
-        while(fileStream.read(reinterpret_cast<char *>(&ix), sizeof(ix)))
+        // Send the transmit buffer if it's ready
+        if (buffer.size() >= config.messagePoints)
         {
-            fileStream.read(reinterpret_cast<char *>(&iy), sizeof(iy));
-            fileStream.read(reinterpret_cast<char *>(&iz), sizeof(iz));
-            Vector3d v(ix, iy, iz);
-            totalCount++;
-            VoxelAddress address = sorter->identify(ix, iy, iz);
-
-            size_t worker = hasher(address) % directory->numberOfWorkers();
-
-            // Retrieve the transmit buffer for this worker
-            auto mapIterator = transmitBuffers.find(worker);
-            if (mapIterator == transmitBuffers.end())
-                transmitBuffers[worker] = std::vector<Vector3d>();
-            transmitBuffers[worker].push_back(v);
-
-            // std::cout << "Reader " << directory->readerFromRank(worldId) << " read point " << v << " for " << worker << std::endl;
-
-            // Send the transmit buffer if it's ready
-            if (transmitBuffers[worker].size() > MAX_SEND_SIZE - 1)
-            {
-                if (config.debug) std::cout << "(DEBUG) Reader " << readerNumber << " transmitting points to worker " << worker << std::endl;
-                sendVectorsToWorker(worker, transmitBuffers[worker]);
-                transmitBuffers[worker].clear();
-            }
+            if (config.debug) std::cout << "(DEBUG) Reader " << readerNumber << " transmitting points to worker " << worker << std::endl;
+            sendVectorsToWorker(worker, buffer);
+            buffer.clear();
         }
+    }
 
-        // Clear the remaining transmit buffers
-        for (auto pair : transmitBuffers)
+    /// Sends any points left in the transmit buffers
+    void flushTransmitBuffers()
+    {
+        for (auto &pair : transmitBuffers)
         {
             if (pair.second.size() > 0)
             {
@@ -434,37 +671,72 @@ private:
                 pair.second.clear();
             }
         }
-
-        // Delete the binary file when we're done with it
-        std::cout << name() << " is deleting " << fileName << std::endl;
-        std::remove(fileName.c_str());
     }
 
-    void readFile(std::string fileName)
+    /// Reads the binary point records within a byte range of a scratch file or
+    /// a binary input file, the time is counted against the given phase
+    void readBinaryRange(const InputRange &range, Phase phase)
     {
         transmitBuffers.clear();
 
-        std::cout << "Reader " << readerNumber << " is processing " << fileName << std::endl;
+        size_t totalCount = 0;
+        std::cout << "Reader " << readerNumber << " is processing " << range.fileName << " bytes " << range.begin << " to " << range.end << std::endl;
+        ScopedTimer timer(metrics, phase);
 
-        std::ifstream workingFile(fileName);
-        std::string workingLine;
+        PointAttributes attributes;
+        ForEachRecordReadAhead(range, pointStride(), readAhead, readAheadTotals, [&](const double *record)
+        {
+            Vector3d v(record[0], record[1], record[2]);
+            totalCount++;
+            VoxelAddress address = sorter->identify(v.x, v.y, v.z);
 
-        if (!workingFile.good())
+            size_t worker = hasher(address) % directory->numberOfWorkers();
+
+            attributes.clear();
+            if (config.attributeColumns.enabled())
+                attributes.pushPacked(record[3], record[4]);
+
+            bufferPointForWorker(worker, v, attributes, 0);
+        });
+        metrics.addPoints(phase, totalCount);
+        metrics.addBytes(phase, totalCount * pointStride() * sizeof(double));
+        recordReadAhead();
+
+        flushTransmitBuffers();
+    }
+
+    /// Reads the points which start within a byte range of an input file
+    void readRange(const InputRange &range)
+    {
+        if (IsBinaryInput(range.fileName))
         {
-            std::cout << "Reader " << readerNumber << " found that file " << fileName << " could not be read!" << std::endl;
+            readBinaryRange(range, Phase::parse);
+            return;
+        }
+
+        transmitBuffers.clear();
+
+        std::cout << "Reader " << readerNumber << " is processing " << range.fileName << " bytes " << range.begin << " to " << range.end << std::endl;
+        ScopedTimer timer(metrics, Phase::parse);
+
+        if (!std::ifstream(range.fileName).good())
+        {
+            std::cout << "Reader " << readerNumber << " found that file " << range.fileName << " could not be read!" << std::endl;
         }
 
         double sx, sy, sz;
+        PointAttributes attributes;
 
         size_t count = 0;
 
-        while (std::getline(workingFile, workingLine))
+        ForEachLineReadAhead(range, readAhead, readAheadTotals, [&](const std::string &workingLine)
         {
+            metrics.addBytes(Phase::parse, workingLine.size() + 1);
             std::istringstream i(workingLine);
             std::vector<std::string> tokens{std::istream_iterator<std::string>(i), std::istream_iterator<std::string>()};
 
             if (tokens.size() < 3)
-                continue;
+                return;
 
             count++;
             // Read the values in the text lines
@@ -488,33 +760,16 @@ private:
             size_t worker = hasher(address) % directory->numberOfWorkers();
             if (config.debug) std::cout << "(DEBUG) Reader " << readerNumber << " assigned point " << v << " to Worker " << worker << std::endl;
 
-            // Retrieve the transmit buffer for this worker
-            auto mapIterator = transmitBuffers.find(worker);
-            if (mapIterator == transmitBuffers.end())
-                transmitBuffers[worker] = std::vector<Vector3d>();
-            transmitBuffers[worker].push_back(v);
-
-            // std::cout << "Reader " << directory->readerFromRank(worldId) << " read point " << v << " for " << worker << std::endl;
-
-            // Send the transmit buffer if it's ready
-            if (transmitBuffers[worker].size() > MAX_SEND_SIZE - 1)
-            {
-                if (config.debug) std::cout << "(DEBUG) Reader " << readerNumber << " transmitting points to worker " << worker << std::endl;
+            attributes.clear();
+            if (config.attributeColumns.enabled())
+                ParseAttributes(tokens, config.attributeColumns, attributes);
 
-                sendVectorsToWorker(worker, transmitBuffers[worker]);
-                transmitBuffers[worker].clear();
-            }
-        }
+            bufferPointForWorker(worker, v, attributes, 0);
+        });
+        metrics.addPoints(Phase::parse, count);
+        recordReadAhead();
 
-        // Clear the remaining transmit buffers
-        for (auto pair : transmitBuffers)
-        {
-            if (pair.second.size() > 0)
-            {
-                sendVectorsToWorker(pair.first, pair.second);
-                pair.second.clear();
-            }
-        }
+        flushTransmitBuffers();
     }
 };
 
@@ -522,11 +777,13 @@ class Worker: public Process
 {
 public:
     Worker(size_t id, size_t size, const ParallelConfiguration &configuration, std::shared_ptr<Directory> d)
-    :Process(id, size, configuration, d)
+    :Process(id, size, configuration, d), thinningContext(configuration.mortonOrder)
     {
         // Delay this thread in order to let the Director print to stdout uninterrupted
         std::this_thread::sleep_for(std::chrono::seconds(2));
 
+        thinningContext.setLeafSize(config.leafSize);
+
         workerNumber = directory->workerFromRank(worldId);
         std::cout << "Worker " << workerNumber << " (process rank " << worldId << ") checking in" << std::endl;
     }
@@ -535,27 +792,33 @@ public:
 
     void run() override
     {
-        // Construct the first stage voxel sorter
-        initializeSorter(true);
+        // Stage 1 is skipped entirely when resuming from a checkpoint
+        if (checkpoint.stage < 1)
+        {
+            // Construct the first stage voxel sorter
+            initializeSorter(true);
 
-        // Wait for incoming data: if it's from the readers add it to our local
-        // buffers and sort it into place, if it's from the Director start
-        // doing the thinning
-        receiveData();
+            // Wait for incoming data: if it's from the readers add it to our local
+            // buffers and sort it into place, if it's from the Director start
+            // doing the thinning
+            receiveData();
 
-        // Do the thinning
-        size_t original = totalPoints();
-        for (auto pair : rawData)
-        {
-            thinRegion(rawData[pair.first]);
-        }
+            // Do the thinning, unless it was done as the points arrived
+            if (!config.streamingThinning)
+                thinRegions();
 
-        writeBinaryRegions(config.scratchDirectory + "worker" + std::to_string(workerNumber) + ".binary");
-        std::cout << "Worker " << workerNumber << " has thined " << rawData.size() << " regions" << std::endl;
+            writeBinaryRegions(workerFileName(workerNumber, ".binary"));
+            std::cout << "Worker " << workerNumber << " has thined " << rawData.size() << " regions" << std::endl;
+            releaseSpill();
 
-        // Write the intermediate files to the scratch directory
-        // Tell the director that we're done
-        directory->sendToDirector(MessageInfo::workerDone);
+            // Write the intermediate files to the scratch directory
+            // Tell the director that we're done
+            directory->sendToDirector(MessageInfo::workerDone);
+        }
+
+        // After stage 2 only the Director has work left to do
+        if (checkpoint.stage >= 2)
+            return;
 
         // Reset the sorter to the second stage position
         initializeSorter(false);
@@ -565,76 +828,239 @@ public:
         // doing the thinning
         receiveData();
 
-        // Do the thinning
-        original = totalPoints();
-        for (auto pair : rawData)
-        {
-            thinRegion(rawData[pair.first]);
-        }
+        // Do the thinning, unless it was done as the points arrived
+        if (!config.streamingThinning)
+            thinRegions();
 
         std::cout << "Worker " << workerNumber << " has thinned " << rawData.size() << " regions" << std::endl;
 
-        // Perform the final voxelization
+        // Perform the final voxelization at the finest resolution, the coarser
+        // levels of the voxel pyramid are reduced from it rather than re-binned
+        ScopedTimer timer(metrics, Phase::voxelize);
+        metrics.addPoints(Phase::voxelize, totalPoints());
         VoxelSorter finalSorter(config.voxelDistance, config.voxelDistance, config.voxelDistance, 0, 0, 0);
+        std::vector<std::unordered_map<VoxelAddress, int>> levels(config.voxelResolutions.size());
 
-        size_t count = 0;
-        std::unordered_map<VoxelAddress, int> voxels;
-        for (auto pair : rawData)
+        if (config.voxelBackend == "brick")
         {
-            for (auto p : pair.second.pts)
+            BrickVoxelGrid voxels(BrickVoxelGrid::chooseBrickEdge(sampleFinalAddresses(finalSorter)));
+            forEachRegion([&](PointCloud &cloud)
             {
-                auto located = finalSorter.identifyPoint(p);
-                incrementVoxelIntensity(voxels, located.address);
-            }
-        }
+                for (const auto &p : cloud.pts)
+                {
+                    auto located = finalSorter.identifyPoint(p);
+                    incrementVoxelIntensity(voxels, located.address);
+                }
+            });
+            std::cout << "Worker " << workerNumber << " voxel grid: " << voxels.statistics() << std::endl;
 
-        std::string outputFile = config.scratchDirectory + "worker" + std::to_string(workerNumber) + "_final.sparsevox";
-        std::ofstream outfile;
-        outfile.open(outputFile.c_str(), std::ios::out);
+            {
+                ScopedTimer writeTimer(metrics, Phase::write);
+                AsyncOutputFile outfile(finalFileName(0), writerSettings());
+                voxels.forEachVoxel([&outfile](const VoxelAddress& a, uint32_t value)
+                {
+                    outfile << a.i << "," << a.j << "," << a.k << "," << value << '\n';
+                });
+                metrics.addBytes(Phase::write, outfile.bytes());
+                outfile.close();
+            }
 
-        for (auto voxel : voxels)
+            reducePyramid(levels, [&voxels](int factor) { return coarsenVoxels(voxels, factor); });
+        }
+        else
         {
-            count += voxel.second;
-            outfile << voxel.first.i << "," << voxel.first.j << "," << voxel.first.k << "," << voxel.second << std::endl;
+            forEachRegion([&](PointCloud &cloud)
+            {
+                for (const auto &p : cloud.pts)
+                {
+                    auto located = finalSorter.identifyPoint(p);
+                    incrementVoxelIntensity(levels[0], located.address);
+                }
+            });
+            writeSparseVoxels(finalFileName(0), levels[0]);
+
+            reducePyramid(levels, [&levels](int factor) { return coarsenVoxels(levels[0], factor); });
         }
 
+        for (size_t level = 1; level < levels.size(); level++)
+            writeSparseVoxels(finalFileName(level), levels[level]);
+
+        if (config.attributeColumns.enabled())
+            writeVoxelAttributes(finalSorter);
+        releaseSpill();
+
         // Tell the director we're done
         directory->sendToDirector(MessageInfo::workerDone);
     }
 
 private:
     std::unordered_map<VoxelAddress, PointCloud> rawData;
-    double recvBuffer[MAX_SEND_SIZE * 3];
+    std::vector<double> recvBuffer;
 
     size_t workerNumber;
 
+    /// The bytes allocated for the points held in rawData, the spill file
+    /// which holds the regions moved out of memory to stay within the memory
+    /// budget, and the message in which each region last received points
+    uint64_t heldBytes;
+    std::unique_ptr<RegionSpill> spill;
+    std::unordered_map<VoxelAddress, uint64_t> lastReceived;
+    uint64_t messagesReceived;
+
+    /// The kept points of each region when the points are thinned as they
+    /// arrive rather than after all of them have been received.  They count
+    /// towards heldBytes, and a spilled region's thinner is dropped and
+    /// rebuilt from its kept points when more points arrive for it.
+    std::unordered_map<VoxelAddress, StreamingThinner> thinners;
+
+    /// The k-d tree and removal mask shared by every region this Worker thins
+    ThinningContext thinningContext;
+
     size_t totalPoints()
     {
         size_t count = 0;
-        for (auto pair : rawData)
+        for (const auto &pair : rawData)
         {
             count += pair.second.size();
+            if (spill)
+                count += spill->points(pair.first);
         }
         return count;
     }
 
+    /// Visits every region with f, reloading the regions that were spilled.
+    /// Afterwards a region is spilled again if the Worker is over its budget.
+    template <typename F>
+    void forEachRegion(F f)
+    {
+        for (auto &pair : rawData)
+        {
+            if (spill && spill->holds(pair.first))
+            {
+                ScopedTimer timer(metrics, Phase::spill);
+                heldBytes -= pair.second.memoryFootprint();
+                spill->reload(pair.first, pair.second);
+                heldBytes += pair.second.memoryFootprint();
+                metrics.memory.reloadedRegions++;
+                metrics.recordHeld(heldBytes);
+            }
+
+            heldBytes -= pair.second.memoryFootprint();
+            f(pair.second);
+            heldBytes += pair.second.memoryFootprint();
+
+            if (spill && heldBytes > config.workerMemoryBudget)
+                spillRegion(pair.first);
+        }
+    }
+
+    /// Moves a region to the spill file
+    void spillRegion(const VoxelAddress &address)
+    {
+        ScopedTimer timer(metrics, Phase::spill);
+        PointCloud &cloud = rawData[address];
+        uint64_t written = spill->bytesWritten();
+        heldBytes -= cloud.memoryFootprint();
+        spill->spill(address, cloud);
+        auto thinner = thinners.find(address);
+        if (thinner != thinners.end())
+        {
+            heldBytes -= thinner->second.memoryFootprint();
+            thinners.erase(thinner);
+        }
+        metrics.memory.spilledBytes += spill->bytesWritten() - written;
+        metrics.memory.spilledRegions++;
+    }
+
+    /// Spills the regions which have gone longest without receiving points
+    /// until the Worker holds no more than three quarters of its budget, so
+    /// that it doesn't spill again with every message
+    void spillColdRegions()
+    {
+        std::vector<std::pair<uint64_t, VoxelAddress>> regions;
+        for (const auto &pair : rawData)
+        {
+            if (pair.second.size() > 0)
+                regions.push_back(std::make_pair(lastReceived[pair.first], pair.first));
+        }
+        std::sort(regions.begin(), regions.end(), [](const std::pair<uint64_t, VoxelAddress> &a, const std::pair<uint64_t, VoxelAddress> &b)
+        {
+            return a.first < b.first;
+        });
+
+        uint64_t target = config.workerMemoryBudget / 4 * 3;
+        for (const auto &r : regions)
+        {
+            if (heldBytes <= target)
+                break;
+            spillRegion(r.second);
+        }
+    }
+
+    /// Returns the streaming thinner of a region, creating it empty for a new
+    /// region.  A region spilled while receiving is reloaded and its kept
+    /// points offered to a new thinner again, which accepts all of them.
+    StreamingThinner &thinnerOf(const VoxelAddress &address)
+    {
+        auto thinner = thinners.find(address);
+        if (thinner != thinners.end())
+            return thinner->second;
+
+        thinner = thinners.emplace(address, StreamingThinner(config.thinningDistance)).first;
+        PointCloud &region = rawData[address];
+        if (spill && spill->holds(address))
+        {
+            ScopedTimer timer(metrics, Phase::spill);
+            heldBytes -= region.memoryFootprint();
+            spill->reload(address, region);
+            heldBytes += region.memoryFootprint();
+            metrics.memory.reloadedRegions++;
+        }
+        for (const auto &p : region.pts)
+            thinner->second.offer(p);
+        heldBytes += thinner->second.memoryFootprint();
+        return thinner->second;
+    }
+
+    /// Removes the spill file at the end of a stage
+    void releaseSpill()
+    {
+        if (spill && metrics.memory.spilledRegions > 0)
+            std::cout << "Worker " << workerNumber << " has spilled " << metrics.memory.spilledRegions << " regions ("
+                      << (metrics.memory.spilledBytes >> 20) << " MB) to stay within its memory budget" << std::endl;
+        spill.reset();
+    }
+
     void receiveData()
     {
         size_t totalRecv = 0;
 
         rawData.clear();
+        thinners.clear();
+        lastReceived.clear();
+        heldBytes = 0;
+        messagesReceived = 0;
+
+        // The old spill file has to be removed before the new one is opened,
+        // as they have the same name
+        spill.reset();
+        if (config.workerMemoryBudget > 0)
+            spill.reset(new RegionSpill(workerFileName(workerNumber, ".spill"), pointStride()));
 
         MPI_Status status;
         bool isReceiving = true;
         while (isReceiving)
         {
-            MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+            {
+                ScopedTimer timer(metrics, Phase::wait);
+                MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+            }
 
             // Tag 0 means this is an administrative message
             if (status.MPI_TAG == 0)
             {
                 int rawMessageCode;
-                MPI_Recv(&rawMessageCode, 1, MPI_INT, MPI_ANY_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, &status);
+                MPI_Recv(&rawMessageCode, 1, MPI_INT, status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, &status);
                 if (static_cast<MessageInfo>(rawMessageCode) == MessageInfo::startWorking)
                     isReceiving = false;
             }
@@ -643,76 +1069,557 @@ private:
             else if (status.MPI_TAG == 1)
             {
                 if (config.debug) std::cout << "(DEBUG) Worker " << workerNumber << " preparing to recieve data" << std::endl;
-                int recvCount;
-                MPI_Get_count(&status, MPI_DOUBLE, &recvCount);
-                MPI_Recv(recvBuffer, recvCount, MPI_DOUBLE, MPI_ANY_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, &status);
+                ScopedTimer timer(metrics, Phase::receive);
+                int count;
+                MPI_Get_count(&status, MPI_DOUBLE, &count);
+                size_t recvCount = (size_t)count;
+                recvBuffer.resize(recvCount);
+                MPI_Recv(recvBuffer.data(), count, MPI_DOUBLE, status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, &status);
 
                 if (config.debug) std::cout << "(DEBUG) Worker " << workerNumber << " recieved " << recvCount << " doubles" << std::endl;
 
-                // Unpack the buffer
-                for (size_t i = 0; i < recvCount; )
+                // Unpack the buffer, the points are packed as z, y, x followed
+                // by the attributes if they are enabled.  In streaming mode
+                // the unpacking is counted as thinning, since each point is
+                // checked against the points kept before it as it is stored.
+                std::unique_ptr<ScopedTimer> streamingTimer(config.streamingThinning ? new ScopedTimer(metrics, Phase::thinning) : nullptr);
+                size_t stride = pointStride();
+                for (size_t i = 0; i + stride <= recvCount; i += stride)
                 {
-                    Vector3d v(recvBuffer[i++], recvBuffer[i++], recvBuffer[i++]);
+                    Vector3d v(recvBuffer[i + 2], recvBuffer[i + 1], recvBuffer[i]);
                     // std::cout << "Worker " << directory->workerFromRank(worldId) << " received " << v << std::endl;
 
                     auto located = sorter->identifyPoint(v);
-                    auto mapIterator = rawData.find(located.address);
-                    if (mapIterator == rawData.end())
-                        rawData[located.address] = PointCloud();
-                    rawData[located.address].pts.push_back(v);
-
                     totalRecv++;
+                    metrics.addPoints(Phase::receive, 1);
+                    if (config.streamingThinning)
+                    {
+                        metrics.addPoints(Phase::thinning, 1);
+                        StreamingThinner &thinner = thinnerOf(located.address);
+                        size_t thinnerFootprint = thinner.memoryFootprint();
+                        bool kept = thinner.offer(v);
+                        heldBytes += thinner.memoryFootprint() - thinnerFootprint;
+                        if (!kept)
+                            continue;
+                    }
+
+                    PointCloud &region = rawData[located.address];
+                    size_t footprint = region.memoryFootprint();
+                    region.pts.push_back(v);
+                    if (stride == MAX_POINT_STRIDE)
+                        region.attributes.pushPacked(recvBuffer[i + 3], recvBuffer[i + 4]);
+                    heldBytes += region.memoryFootprint() - footprint;
+                    if (spill)
+                        lastReceived[located.address] = messagesReceived;
                 }
+                metrics.addBytes(Phase::receive, recvCount * sizeof(double));
+                messagesReceived++;
+                metrics.recordHeld(heldBytes);
             }
+
+            if (spill && heldBytes > config.workerMemoryBudget)
+                spillColdRegions();
         }
 
+        // The kept points are all in rawData now
+        for (const auto &pair : thinners)
+            heldBytes -= pair.second.memoryFootprint();
+        thinners.clear();
     }
 
-    void thinRegion(PointCloud &cloud)
+    std::string finalFileName(size_t level, std::string extension = ".sparsevox")
     {
-        typedef KDTreeSingleIndexAdaptor<L2_Simple_Adaptor<double, PointCloud> ,PointCloud,3> my_kd_tree_t;
-        my_kd_tree_t index(3, cloud, KDTreeSingleIndexAdaptorParams(10));
-        index.buildIndex();
+        return workerFileName(workerNumber, "_final" + levelSuffix(level) + extension);
+    }
 
-        std::set<size_t> removeIndicies;
-        const double searchRadius = config.thinningDistance * config.thinningDistance;
-        for (size_t i = 0; i < cloud.pts.size(); i++)
+    /// Fills in the coarse levels of the voxel pyramid.  Each level is reduced
+    /// from the coarsest finer level whose spacing divides its own, and levels
+    /// which can only come from the finest level are produced by reduceFinest
+    /// so that the finest level does not have to be held as a sparse map.
+    template <typename F>
+    void reducePyramid(std::vector<std::unordered_map<VoxelAddress, int>> &levels, F reduceFinest)
+    {
+        for (size_t level = 1; level < levels.size(); level++)
         {
-            if (removeIndicies.find(i) == removeIndicies.end())
+            size_t source = PyramidSourceLevel(config, level);
+            int factor = ResolutionFactor(config, level) / ResolutionFactor(config, source);
+            if (source == 0)
+                levels[level] = reduceFinest(factor);
+            else
+                levels[level] = coarsenVoxels(levels[source], factor);
+        }
+    }
+
+    /// Aggregates the attributes of the points in every final voxel, reduces
+    /// the aggregates through the voxel pyramid and writes a .voxattr file for
+    /// each level
+    void writeVoxelAttributes(const VoxelSorter &finalSorter)
+    {
+        std::vector<std::unordered_map<VoxelAddress, VoxelAttributes>> levels(config.voxelResolutions.size());
+        forEachRegion([&](PointCloud &cloud)
+        {
+            for (size_t n = 0; n < cloud.pts.size(); n++)
             {
-                double query_pt[3] = { cloud.pts[i].x, cloud.pts[i].y, cloud.pts[i].z};
+                auto located = finalSorter.identifyPoint(cloud.pts[n]);
+                accumulateVoxelAttributes(levels[0], located.address, cloud.pts[n].z, cloud.attributes.intensity[n],
+                                          cloud.attributes.returnNumber[n], cloud.attributes.numberOfReturns[n]);
+            }
+        });
 
-                std::vector<std::pair<size_t,double>> indices_dists;
-                RadiusResultSet<double,size_t> resultSet(searchRadius, indices_dists);
-                index.findNeighbors(resultSet, query_pt, nanoflann::SearchParams());
+        for (size_t level = 1; level < levels.size(); level++)
+        {
+            size_t source = PyramidSourceLevel(config, level);
+            int factor = ResolutionFactor(config, level) / ResolutionFactor(config, source);
+            levels[level] = coarsenVoxelAttributes(levels[source], factor);
+        }
+
+        ScopedTimer timer(metrics, Phase::write);
+        for (size_t level = 0; level < levels.size(); level++)
+        {
+            AsyncOutputFile outfile(finalFileName(level, ".voxattr"), writerSettings());
+            for (const auto &voxel : levels[level])
+            {
+                outfile << voxel.first.i << "," << voxel.first.j << "," << voxel.first.k << "," << voxel.second << '\n';
+            }
+            metrics.addBytes(Phase::write, outfile.bytes());
+            outfile.close();
+        }
+    }
+
+    void writeSparseVoxels(std::string fileName, const std::unordered_map<VoxelAddress, int> &voxels)
+    {
+        ScopedTimer timer(metrics, Phase::write);
+        AsyncOutputFile outfile(fileName, writerSettings());
+        for (const auto &voxel : voxels)
+        {
+            outfile << voxel.first.i << "," << voxel.first.j << "," << voxel.first.k << "," << voxel.second << '\n';
+        }
+        metrics.addBytes(Phase::write, outfile.bytes());
+        outfile.close();
+    }
+
+    /// Collects the final voxel addresses of an evenly strided sample of the
+    /// thinned points, used to choose the brick size of the dense voxel grid
+    std::vector<VoxelAddress> sampleFinalAddresses(const VoxelSorter &finalSorter)
+    {
+        const size_t maxSamples = 100000;
+        size_t stride = totalPoints() / maxSamples + 1;
 
-                for (auto r : resultSet.m_indices_dists)
+        std::vector<VoxelAddress> sample;
+        size_t n = 0;
+        forEachRegion([&](PointCloud &cloud)
+        {
+            for (const auto &p : cloud.pts)
+            {
+                if (n++ % stride == 0)
+                    sample.push_back(finalSorter.identifyPoint(p).address);
+            }
+        });
+        return sample;
+    }
+
+    /// Thins every region.  With a region point budget the regions with more
+    /// points than the budget are thinned in parts and the smallest regions
+    /// held in memory are thinned together in batches of about the budget,
+    /// taken in Morton order of their addresses so each batch is compact.
+    void thinRegions()
+    {
+        const size_t budget = config.regionPointBudget;
+        if (budget == 0)
+        {
+            forEachRegion([this](PointCloud &cloud) { thinRegion(cloud); });
+            return;
+        }
+
+        std::vector<std::pair<uint64_t, VoxelAddress>> small;
+        for (const auto &pair : rawData)
+        {
+            if (pair.second.size() > 0 && pair.second.size() < budget / COALESCE_DIVISOR && !(spill && spill->holds(pair.first)))
+                small.push_back(std::make_pair(MortonCode(pair.first.i, pair.first.j, pair.first.k), pair.first));
+        }
+        std::sort(small.begin(), small.end(), [](const std::pair<uint64_t, VoxelAddress> &a, const std::pair<uint64_t, VoxelAddress> &b)
+        {
+            return a.first < b.first;
+        });
+
+        // The map keeps its values in place, so the batched regions are
+        // recognised by their address in memory
+        std::unordered_set<const PointCloud *> batched;
+        std::vector<PointCloud *> batch;
+        size_t batchPoints = 0;
+        size_t batches = 0;
+        for (size_t n = 0; n < small.size(); n++)
+        {
+            PointCloud &cloud = rawData[small[n].second];
+            batch.push_back(&cloud);
+            batched.insert(&cloud);
+            batchPoints += cloud.size();
+            if (batchPoints >= budget || n + 1 == small.size())
+            {
+                ScopedTimer timer(metrics, Phase::thinning);
+                metrics.addPoints(Phase::thinning, batchPoints);
+                for (auto c : batch)
+                    heldBytes -= c->memoryFootprint();
+                ThinCoalesced(thinningContext, batch, config.thinningDistance);
+                for (auto c : batch)
+                    heldBytes += c->memoryFootprint();
+                batch.clear();
+                batchPoints = 0;
+                batches++;
+            }
+        }
+
+        size_t subdivided = 0;
+        size_t parts = 0;
+        forEachRegion([&](PointCloud &cloud)
+        {
+            if (batched.count(&cloud))
+                return;
+            if (cloud.size() <= budget)
+            {
+                thinRegion(cloud);
+                return;
+            }
+
+            ScopedTimer timer(metrics, Phase::thinning);
+            metrics.addPoints(Phase::thinning, cloud.size());
+            parts += ThinSubdivided(thinningContext, cloud, config.thinningDistance, budget);
+            subdivided++;
+        });
+
+        std::cout << "Worker " << workerNumber << " has thinned " << batched.size() << " small regions in " << batches
+                  << " batches and " << subdivided << " large regions in " << parts << " parts" << std::endl;
+    }
+
+    void thinRegion(PointCloud &cloud)
+    {
+        {
+            ScopedTimer timer(metrics, Phase::treeBuild);
+            thinningContext.build(cloud);
+            metrics.addPoints(Phase::treeBuild, cloud.pts.size());
+        }
+
+        ScopedTimer timer(metrics, Phase::thinning);
+        metrics.addPoints(Phase::thinning, cloud.pts.size());
+        cloud.RemoveMarked(thinningContext.markRedundant(config.thinningDistance));
+    }
+
+    void writeBinaryRegions(std::string fileName)
+    {
+        ScopedTimer timer(metrics, Phase::write);
+        metrics.addPoints(Phase::write, totalPoints());
+        AsyncOutputFile fileStream(fileName, writerSettings(), totalPoints() * pointStride() * sizeof(double));
+        double record[MAX_POINT_STRIDE];
+        forEachRegion([&](PointCloud &cloud)
+        {
+            for (size_t n = 0; n < cloud.pts.size(); n++)
+            {
+                record[0] = cloud.pts[n].x;
+                record[1] = cloud.pts[n].y;
+                record[2] = cloud.pts[n].z;
+                if (cloud.hasAttributes())
                 {
-                    if (i != r.first)
-                        removeIndicies.insert(r.first);
+                    record[3] = cloud.attributes.intensity[n];
+                    record[4] = cloud.attributes.packedReturns(n);
                 }
+                fileStream.write(reinterpret_cast<char*>(record), sizeof(double) * pointStride());
             }
+        });
+        metrics.addBytes(Phase::write, fileStream.bytes());
+        fileStream.close();
+    }
+};
+
+
+/// Parses the points of a range of an input file
+std::vector<Vector3d> loadInputSample(const ParallelConfiguration &config, const InputRange &sample)
+{
+    std::vector<Vector3d> points;
+    if (IsBinaryInput(sample.fileName))
+    {
+        size_t stride = config.attributeColumns.enabled() ? 5 : 3;
+        ForEachRecordInRange(AlignedRange(sample, stride * sizeof(double)), stride, [&points](const double *record)
+        {
+            points.push_back(Vector3d(record[0], record[1], record[2]));
+        });
+    }
+    else
+    {
+        ForEachLineInRange(sample, [&points](const std::string &line)
+        {
+            std::istringstream i(line);
+            std::vector<std::string> tokens{std::istream_iterator<std::string>(i), std::istream_iterator<std::string>()};
+            if (tokens.size() >= 3)
+                points.push_back(Vector3d(std::stod(tokens[0]), std::stod(tokens[1]), std::stod(tokens[2])));
+        });
+    }
+    return points;
+}
+
+/// Parses the points at the start of the first input file, which are the
+/// sample the startup calibrations are measured on
+std::vector<Vector3d> loadCalibrationSample(const ParallelConfiguration &config)
+{
+    return loadInputSample(config, InputRange{inputDataFiles(config).front(), 0, CALIBRATION_BYTES});
+}
+
+/// Parses up to about the given number of bytes of an input file, read from a
+/// few ranges spread through it, or the whole file when it is no larger
+std::vector<Vector3d> loadSpreadSample(const ParallelConfiguration &config, const std::string &fileName, uint64_t bytes)
+{
+    std::ifstream file(fileName.c_str(), std::ios::binary | std::ios::ate);
+    uint64_t size = file.is_open() ? static_cast<uint64_t>(file.tellg()) : 0;
+    if (size <= bytes)
+        return loadInputSample(config, InputRange{fileName, 0, size});
+
+    std::vector<Vector3d> points;
+    uint64_t rangeBytes = bytes / SAMPLE_RANGES;
+    for (uint64_t r = 0; r < SAMPLE_RANGES; r++)
+    {
+        uint64_t begin = (size - rangeBytes) / (SAMPLE_RANGES - 1) * r;
+        auto part = loadInputSample(config, InputRange{fileName, begin, begin + rangeBytes});
+        points.insert(points.end(), part.begin(), part.end());
+    }
+    return points;
+}
+
+/// Estimates the spacing of the points of one input file from a sample of
+/// it, returning zero when the sample is too small
+double estimateFileSpacing(const ParallelConfiguration &config, const std::string &fileName)
+{
+    std::vector<Vector3d> points = loadSpreadSample(config, fileName, CALIBRATION_BYTES);
+    if (points.size() < 1000)
+        return 0;
+
+    PointCloud cloud(std::move(points));
+    SpacingKDTree index(cloud, 10);
+    index.buildIndex(1);
+    SpacingOptions options;
+    options.threads = 1;
+    return MeasureSpacing(cloud, index, options).p1;
+}
+
+/// Estimates the thinning distance as the smallest of the 1st percentiles of
+/// the nearest neighbour distances within each input file.  Every process
+/// samples a share of the files, and the first process reduces the estimates
+/// and broadcasts the distance before any points are thinned.
+double estimateThinningDistance(const ParallelConfiguration &config, int worldRank, int worldSize)
+{
+    std::vector<std::string> files = inputDataFiles(config);
+    std::vector<double> estimates(files.size(), 0);
+    for (size_t f = worldRank; f < files.size(); f += worldSize)
+        estimates[f] = estimateFileSpacing(config, files[f]);
+
+    std::vector<double> gathered(files.size(), 0);
+    MPI_Reduce(estimates.data(), gathered.data(), (int)files.size(), MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    double distance = 0;
+    if (worldRank == 0)
+    {
+        for (size_t f = 0; f < files.size(); f++)
+        {
+            if (gathered[f] > 0)
+            {
+                std::cout << "Thinning distance estimate: " << files[f] << " p1 spacing " << gathered[f] << std::endl;
+                if (distance == 0 || gathered[f] < distance)
+                    distance = gathered[f];
+            }
+            else
+                std::cout << "Thinning distance estimate: " << files[f] << " has too few points to sample" << std::endl;
         }
-        cloud.RemoveAtIndicies(removeIndicies);
+        std::cout << "Thinning distance estimate: thinning distance " << distance << std::endl;
     }
 
-    void writeBinaryRegions(std::string fileName)
+    MPI_Bcast(&distance, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    return distance;
+}
+
+/// Measures how long it takes to parse and to thin the points at the start of
+/// the first input file and picks the share of Readers which balances the two.
+/// Only the first process measures, and the result is broadcast so that every
+/// process constructs the same Directory.
+double calibrateReaderRatio(const ParallelConfiguration &config, int worldRank)
+{
+    double ratio = config.readerRatio;
+    if (worldRank == 0)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Vector3d> points = loadCalibrationSample(config);
+        double parseSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        size_t n = points.size();
+        if (n >= 1000)
+        {
+            PointCloud cloud(std::move(points));
+            start = std::chrono::steady_clock::now();
+            ThinPointCloud(cloud, config.thinningDistance);
+            double thinSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            // Workers thin every point twice, once in each stage
+            ratio = OptimalReaderShare(parseSeconds / n, 2.0 * thinSeconds / n);
+            std::cout << "Reader ratio calibration: parsing " << (size_t)(n / parseSeconds) << " points/s, thinning "
+                      << (size_t)(n / thinSeconds) << " points/s, reader ratio " << ratio << std::endl;
+        }
+        else
+        {
+            std::cout << "Reader ratio calibration: too few points in the sample, using " << ratio << std::endl;
+        }
+    }
+
+    MPI_Bcast(&ratio, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    return ratio;
+}
+
+/// Chooses the binning distance from a sample spread through every input
+/// file.  The number of points in the input is estimated from the bytes per
+/// point of the sample.  The chosen distance is the largest multiple of the
+/// coarsest voxel size which still gives every Worker about
+/// BINNING_REGIONS_PER_WORKER regions to balance and, with a memory budget,
+/// keeps the largest region within half of it.  Larger multiples give fewer
+/// and larger regions, so the multiple is doubled until one fails and then
+/// found by bisection, binning the sample a logarithmic number of times.
+/// Only the first process measures and the distance is broadcast.
+double chooseBinningDistance(const ParallelConfiguration &config, size_t workers, int worldRank)
+{
+    double distance = config.binningDistance;
+    if (worldRank == 0)
     {
-        std::ofstream fileStream(fileName.c_str(), std::ios::binary);
-        for (auto pair : rawData)
+        std::vector<std::string> files = inputDataFiles(config);
+        uint64_t perFile = std::max<uint64_t>(CALIBRATION_BYTES / files.size(), MIN_SAMPLE_BYTES);
+        uint64_t sampledBytes = 0;
+        std::vector<Vector3d> points;
+        for (const auto &f : files)
+        {
+            auto sample = loadSpreadSample(config, f, perFile);
+            sampledBytes += std::min(perFile, TotalInputBytes({f}));
+            points.insert(points.end(), sample.begin(), sample.end());
+        }
+
+        if (points.size() >= 1000)
         {
-            for (auto p : pair.second.pts)
+            double totalPoints = (double)TotalInputBytes(files) * points.size() / sampledBytes;
+            double scale = totalPoints / points.size();
+            double pointBytes = (config.attributeColumns.enabled() ? 5 : 3) * sizeof(double);
+
+            Vector3d lo = points.front();
+            Vector3d hi = lo;
+            for (const auto &p : points)
             {
-                // .write(reinterpret_cast<char *>(&x), sizeof(x))
-                fileStream.write(reinterpret_cast<char*>(&p.x), sizeof(p.x));
-                fileStream.write(reinterpret_cast<char*>(&p.y), sizeof(p.y));
-                fileStream.write(reinterpret_cast<char*>(&p.z), sizeof(p.z));
+                lo = Vector3d(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+                hi = Vector3d(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+            }
+            double extent = std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+
+            // Bins with too few points to show up in the sample are missed, so
+            // the regions are undercounted and the choice errs small
+            double coarsest = config.voxelResolutions.back();
+            size_t chosenRegions = 0;
+            double chosenLargest = 0;
+            auto acceptable = [&](int64_t mult)
+            {
+                double dv = coarsest * mult;
+                VoxelSorter sorter(dv, dv, dv, 0, 0, 0);
+                std::unordered_map<VoxelAddress, size_t> bins;
+                for (const auto &p : points)
+                    bins[sorter.identifyPoint(p).address]++;
+
+                size_t largest = 0;
+                for (const auto &bin : bins)
+                    largest = std::max(largest, bin.second);
+
+                bool balanced = bins.size() >= BINNING_REGIONS_PER_WORKER * workers;
+                bool fits = config.workerMemoryBudget == 0 || largest * scale * pointBytes <= config.workerMemoryBudget / 2;
+                if (mult > 1 && !(balanced && fits))
+                    return false;
+                chosenRegions = bins.size();
+                chosenLargest = largest * scale;
+                return true;
+            };
+
+            // Multiples beyond the extent of the sample hold it in one bin
+            int64_t lastMult = std::max<int64_t>(1, (int64_t)std::floor(std::max(extent, coarsest) / coarsest));
+            int64_t good = 1;
+            int64_t bad = lastMult + 1;
+            acceptable(good);
+            for (int64_t mult = 2; mult <= lastMult; mult *= 2)
+            {
+                if (!acceptable(mult))
+                {
+                    bad = mult;
+                    break;
+                }
+                good = mult;
+            }
+            while (bad - good > 1)
+            {
+                int64_t mult = good + (bad - good) / 2;
+                if (acceptable(mult))
+                    good = mult;
+                else
+                    bad = mult;
             }
 
+            // Each accepted multiple is larger than the ones before it, so the
+            // counts kept are those of the chosen one
+            distance = coarsest * good;
+
+            std::cout << "Binning distance calibration: about " << (size_t)totalPoints << " points, binning distance "
+                      << distance << " (" << (int)std::round(distance / coarsest) << " times the coarsest voxel), at least "
+                      << chosenRegions << " regions, the largest about " << (size_t)chosenLargest << " points" << std::endl;
+            std::cout << "Binning distance calibration: predicted load per Worker about " << (size_t)(totalPoints / workers)
+                      << " points (" << totalPoints / workers * pointBytes / (1 << 20) << " MB) in "
+                      << chosenRegions / workers << " or more regions" << std::endl;
+        }
+        else
+        {
+            std::cout << "Binning distance calibration: too few points in the sample, using " << distance << std::endl;
         }
     }
-};
 
+    MPI_Bcast(&distance, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    return distance;
+}
+
+/// Bins the points at the start of the first input file as the Readers would
+/// for the first stage, at the rounded bin spacing and offset by half a bin,
+/// and times thinning the bins at several k-d tree leaf sizes, picking the
+/// fastest.  As with the reader ratio only the first process measures and the
+/// leaf size is broadcast to the Workers.
+size_t calibrateLeafSize(const ParallelConfiguration &config, int worldRank)
+{
+    uint64_t leafSize = config.leafSize;
+    if (worldRank == 0)
+    {
+        std::vector<Vector3d> points = loadCalibrationSample(config);
+        if (points.size() >= 1000)
+        {
+            double dv = BinSpacing(config);
+            VoxelSorter sorter(dv, dv, dv, dv / 2.0, dv / 2.0, dv / 2.0);
+            std::unordered_map<VoxelAddress, std::vector<Vector3d>> bins;
+            for (const auto &p : points)
+                bins[sorter.identifyPoint(p).address].push_back(p);
+
+            std::vector<PointCloud> regions;
+            regions.reserve(bins.size());
+            for (auto &bin : bins)
+                regions.push_back(PointCloud(std::move(bin.second)));
+
+            std::vector<LeafSizeTiming> timings;
+            leafSize = CalibrateLeafSize(regions, config.thinningDistance, config.mortonOrder, timings);
+            std::cout << "Leaf size calibration: " << points.size() << " points in " << regions.size() << " regions,";
+            for (const auto &t : timings)
+                std::cout << " " << t.leafSize << ":" << (size_t)(t.seconds * 1e6) << "us";
+            std::cout << ", leaf size " << leafSize << std::endl;
+        }
+        else
+        {
+            std::cout << "Leaf size calibration: too few points in the sample, using " << leafSize << std::endl;
+        }
+    }
+
+    MPI_Bcast(&leafSize, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    return leafSize;
+}
 
 int main(int argc, char** argv)
 {
@@ -732,11 +1639,22 @@ int main(int argc, char** argv)
     }
 
     auto config = LoadParallelConfiguration(argv[1]);
+    if (config.autoThinningDistance)
+        config.thinningDistance = estimateThinningDistance(config, world_rank, world_size);
+    if (config.autoReaderRatio)
+        config.readerRatio = calibrateReaderRatio(config, world_rank);
 
     // Construct the process directory, which allows this process to know the
     // ranks and assignments of the various other processes.
     std::shared_ptr<Directory> processDirectory(new Directory(world_size, config));
 
+    // The binning distance depends on the number of Workers, and the leaf
+    // size is measured on regions of the binning distance
+    if (config.autoBinningDistance)
+        config.binningDistance = chooseBinningDistance(config, processDirectory->numberOfWorkers(), world_rank);
+    if (config.autoLeafSize)
+        config.leafSize = calibrateLeafSize(config, world_rank);
+
     // Construct and run the process object
     std::unique_ptr<Process> processWorker;
     switch (processDirectory->getProcessType(world_rank))
@@ -752,6 +1670,7 @@ int main(int argc, char** argv)
             break;
     }
     processWorker->run();
+    processWorker->reportMetrics();
 
     MPI_Finalize();
 }
@@ -0,0 +1,259 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    k-d tree whose construction is split over threads.
+
+    nanoflann builds its tree on one thread, which dominates the start up
+    of the single process tools on clouds of millions of points.  The tree
+    is built top down by splitting the index array at each node, and the two
+    halves are independent, so ParallelKDTree hands one half of every split
+    near the root to another thread.  Each thread allocates its nodes from
+    its own pool, since the node pool isn't thread safe.
+
+    The splits are made exactly as nanoflann makes them, so the tree is the
+    same as the one buildIndex() builds, and the queries are nanoflann's.
+
+*/
+#ifndef PARALLELKDTREE_H
+#define PARALLELKDTREE_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <thread>
+#include <numeric>
+#include <algorithm>
+#include "nanoflann.hpp"
+
+// Subtrees with fewer points than this are built on the thread which split them
+#define PARALLEL_KDTREE_MIN_POINTS 65536
+
+template <typename Dataset>
+class ParallelKDTree : public nanoflann::KDTreeSingleIndexAdaptor<nanoflann::L2_Simple_Adaptor<double, Dataset>, Dataset, 3>
+{
+    typedef nanoflann::KDTreeSingleIndexAdaptor<nanoflann::L2_Simple_Adaptor<double, Dataset>, Dataset, 3> Base;
+    typedef typename Base::Node Node;
+    typedef typename Base::BoundingBox BoundingBox;
+
+public:
+    ParallelKDTree(const Dataset& data, size_t leafSize)
+    : Base(3, data, nanoflann::KDTreeSingleIndexAdaptorParams(leafSize))
+    {
+    }
+
+    using Base::buildIndex;
+
+    // Builds the index with up to the given number of threads, where zero
+    // uses every core
+    void buildIndex(size_t threads)
+    {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+
+        this->freeIndex();
+        taskPools.clear();
+
+        this->m_size = this->dataset.kdtree_get_point_count();
+        this->vind.resize(this->m_size);
+        std::iota(this->vind.begin(), this->vind.end(), 0);
+        this->m_size_at_index_build = this->m_size;
+        if (this->m_size == 0)
+            return;
+
+        computeBoundingBox(this->root_bbox);
+
+        // Splitting off a task at each of the first levels gives every
+        // thread a subtree
+        int spawnLevels = 0;
+        while ((size_t(1) << spawnLevels) < threads)
+            spawnLevels++;
+        this->root_node = divideTree(this->pool, 0, this->m_size, this->root_bbox, spawnLevels);
+    }
+
+private:
+    std::mutex poolsMutex;
+    std::vector<std::unique_ptr<nanoflann::PooledAllocator>> taskPools;
+
+    inline double point(size_t index, int axis) const { return this->dataset.kdtree_get_pt(index, axis); }
+
+    nanoflann::PooledAllocator& newTaskPool()
+    {
+        std::lock_guard<std::mutex> lock(poolsMutex);
+        taskPools.push_back(std::unique_ptr<nanoflann::PooledAllocator>(new nanoflann::PooledAllocator()));
+        return *taskPools.back();
+    }
+
+    void computeBoundingBox(BoundingBox& bbox)
+    {
+        for (int i = 0; i < 3; i++)
+            bbox[i].low = bbox[i].high = point(0, i);
+        for (size_t k = 1; k < this->m_size; k++)
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                bbox[i].low = std::min(bbox[i].low, point(k, i));
+                bbox[i].high = std::max(bbox[i].high, point(k, i));
+            }
+        }
+    }
+
+    Node* divideTree(nanoflann::PooledAllocator& pool, size_t left, size_t right, BoundingBox& bbox, int spawnLevels)
+    {
+        Node* node = pool.template allocate<Node>();
+        auto& vind = this->vind;
+
+        if (right - left <= this->m_leaf_max_size)
+        {
+            node->child1 = node->child2 = NULL;
+            node->node_type.lr.left = left;
+            node->node_type.lr.right = right;
+
+            for (int i = 0; i < 3; i++)
+                bbox[i].low = bbox[i].high = point(vind[left], i);
+            for (size_t k = left + 1; k < right; k++)
+            {
+                for (int i = 0; i < 3; i++)
+                {
+                    bbox[i].low = std::min(bbox[i].low, point(vind[k], i));
+                    bbox[i].high = std::max(bbox[i].high, point(vind[k], i));
+                }
+            }
+            return node;
+        }
+
+        size_t idx;
+        int cutfeat;
+        double cutval;
+        middleSplit(&vind[0] + left, right - left, idx, cutfeat, cutval, bbox);
+        node->node_type.sub.divfeat = cutfeat;
+
+        BoundingBox left_bbox(bbox);
+        left_bbox[cutfeat].high = cutval;
+        BoundingBox right_bbox(bbox);
+        right_bbox[cutfeat].low = cutval;
+
+        if (spawnLevels > 0 && right - left >= PARALLEL_KDTREE_MIN_POINTS)
+        {
+            nanoflann::PooledAllocator& taskPool = newTaskPool();
+            auto child = std::async(std::launch::async, [&]()
+            {
+                return divideTree(taskPool, left, left + idx, left_bbox, spawnLevels - 1);
+            });
+            node->child2 = divideTree(pool, left + idx, right, right_bbox, spawnLevels - 1);
+            node->child1 = child.get();
+        }
+        else
+        {
+            node->child1 = divideTree(pool, left, left + idx, left_bbox, 0);
+            node->child2 = divideTree(pool, left + idx, right, right_bbox, 0);
+        }
+
+        node->node_type.sub.divlow = left_bbox[cutfeat].high;
+        node->node_type.sub.divhigh = right_bbox[cutfeat].low;
+        for (int i = 0; i < 3; i++)
+        {
+            bbox[i].low = std::min(left_bbox[i].low, right_bbox[i].low);
+            bbox[i].high = std::max(left_bbox[i].high, right_bbox[i].high);
+        }
+        return node;
+    }
+
+    void computeMinMax(const size_t* ind, size_t count, int axis, double& low, double& high) const
+    {
+        low = high = point(ind[0], axis);
+        for (size_t i = 1; i < count; i++)
+        {
+            double value = point(ind[i], axis);
+            if (value < low) low = value;
+            if (value > high) high = value;
+        }
+    }
+
+    void middleSplit(size_t* ind, size_t count, size_t& index, int& cutfeat, double& cutval, const BoundingBox& bbox)
+    {
+        const double EPS = 0.00001;
+        double max_span = bbox[0].high - bbox[0].low;
+        for (int i = 1; i < 3; i++)
+            max_span = std::max(max_span, bbox[i].high - bbox[i].low);
+
+        // nanoflann measures the spread of the axis chosen so far rather than
+        // of axis i here, and the same is done so the trees are identical
+        double max_spread = -1;
+        cutfeat = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            double span = bbox[i].high - bbox[i].low;
+            if (span > (1 - EPS) * max_span)
+            {
+                double low, high;
+                computeMinMax(ind, count, cutfeat, low, high);
+                if (high - low > max_spread)
+                {
+                    cutfeat = i;
+                    max_spread = high - low;
+                }
+            }
+        }
+
+        double split_val = (bbox[cutfeat].low + bbox[cutfeat].high) / 2;
+        double low, high;
+        computeMinMax(ind, count, cutfeat, low, high);
+        if (split_val < low) cutval = low;
+        else if (split_val > high) cutval = high;
+        else cutval = split_val;
+
+        size_t lim1, lim2;
+        planeSplit(ind, count, cutfeat, cutval, lim1, lim2);
+
+        if (lim1 > count / 2) index = lim1;
+        else if (lim2 < count / 2) index = lim2;
+        else index = count / 2;
+    }
+
+    // Orders ind so the points below cutval come first, then those equal to it
+    void planeSplit(size_t* ind, size_t count, int cutfeat, double cutval, size_t& lim1, size_t& lim2)
+    {
+        size_t left = 0;
+        size_t right = count - 1;
+        for (;;)
+        {
+            while (left <= right && point(ind[left], cutfeat) < cutval) ++left;
+            while (right && left <= right && point(ind[right], cutfeat) >= cutval) --right;
+            if (left > right || !right) break;
+            std::swap(ind[left], ind[right]);
+            ++left;
+            --right;
+        }
+
+        lim1 = left;
+        right = count - 1;
+        for (;;)
+        {
+            while (left <= right && point(ind[left], cutfeat) <= cutval) ++left;
+            while (right && left <= right && point(ind[right], cutfeat) > cutval) --right;
+            if (left > right || !right) break;
+            std::swap(ind[left], ind[right]);
+            ++left;
+            --right;
+        }
+        lim2 = left;
+    }
+};
+
+#endif
@@ -20,6 +20,7 @@ Copyright (C) 2013-2016  Matthew Jarvis
 
 #include <vector>
 #include <set>
+#include <utility>
 
 #include "pointcloud.h"
 #include "vector3d.h"
@@ -28,7 +29,13 @@ PointCloud::PointCloud() { };
 
 PointCloud::PointCloud(std::vector<Vector3d>&& v)
 {
-    pts = v;
+    pts = std::move(v);
+}
+
+PointCloud::PointCloud(std::vector<Vector3d>&& v, PointAttributes&& a)
+{
+    pts = std::move(v);
+    attributes = std::move(a);
 }
 
 void PointCloud::RemoveAtIndicies(const std::set<size_t>& remove)
@@ -38,5 +45,51 @@ void PointCloud::RemoveAtIndicies(const std::set<size_t>& remove)
         // std::cout << "removing index " << *i << " -> " << pts[*i] << std::endl;
         pts[*i] = pts.back();
         pts.pop_back();
+
+        if (hasAttributes())
+        {
+            attributes.moveElement(attributes.size() - 1, *i);
+            attributes.pop_back();
+        }
+    }
+}
+
+void PointCloud::RemoveMarked(const std::vector<char>& removed)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < pts.size(); i++)
+    {
+        if (removed[i])
+            continue;
+
+        if (kept != i)
+        {
+            pts[kept] = pts[i];
+            if (hasAttributes())
+                attributes.moveElement(i, kept);
+        }
+        kept++;
     }
+
+    pts.resize(kept);
+    if (hasAttributes())
+        attributes.resize(kept);
+}
+
+void PointCloud::clear()
+{
+    pts.clear();
+    attributes.clear();
+}
+
+void PointCloud::swap(PointCloud& other)
+{
+    pts.swap(other.pts);
+    std::swap(attributes, other.attributes);
+}
+
+size_t PointCloud::memoryFootprint() const
+{
+    return pts.capacity() * sizeof(Vector3d) + attributes.intensity.capacity() * sizeof(float)
+         + attributes.returnNumber.capacity() + attributes.numberOfReturns.capacity();
 }
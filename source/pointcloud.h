@@ -24,12 +24,16 @@ Copyright (C) 2013-2016  Matthew Jarvis
 #include <set>
 #include <vector>
 #include "vector3d.h"
+#include "attributes.h"
 
 class PointCloud
 {
 public:
 	std::vector<Vector3d>  pts;
 
+	// Optional per-point attributes, either empty or the same length as pts
+	PointAttributes attributes;
+
 	// Must return the number of data points
 	inline size_t kdtree_get_point_count() const { return pts.size(); }
 
@@ -60,9 +64,20 @@ public:
 
     PointCloud();
     PointCloud(std::vector<Vector3d>&&);
+    PointCloud(std::vector<Vector3d>&&, PointAttributes&&);
 
     void RemoveAtIndicies(const std::set<size_t>&);
+
+    // Removes the points whose entry in the mask is set, keeping the order of
+    // the remaining points and their attributes
+    void RemoveMarked(const std::vector<char>& removed);
     inline size_t size() const { return pts.size(); }
+    inline bool hasAttributes() const { return !attributes.empty(); }
+    void clear();
+    void swap(PointCloud& other);
+
+    // The bytes allocated for the points and their attributes
+    size_t memoryFootprint() const;
 
 };
 
@@ -0,0 +1,472 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Asynchronous read-ahead of the input byte ranges.
+
+*/
+
+#include "readahead.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+ReadAheadSettings::ReadAheadSettings()
+{
+    depth = READAHEAD_DEPTH;
+    blockBytes = READAHEAD_BLOCK_BYTES;
+    useUring = true;
+    failSubmission = SIZE_MAX;
+}
+
+ReadAheadTotals::ReadAheadTotals()
+{
+    uringBlocks = 0;
+    threadBlocks = 0;
+    stallSeconds = 0;
+}
+
+#ifdef HAVE_IO_URING
+
+// A minimal io_uring submission and completion queue pair for reads, set up
+// with the raw system calls.  Each read carries a tag which comes back with
+// its completion.
+class UringQueue
+{
+public:
+    UringQueue()
+    : ringFd(-1), sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqes(MAP_FAILED), sqRingBytes(0), cqRingBytes(0), sqesBytes(0)
+    {
+    }
+
+    ~UringQueue()
+    {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqesBytes);
+        if (cqRing != MAP_FAILED)
+            munmap(cqRing, cqRingBytes);
+        if (sqRing != MAP_FAILED)
+            munmap(sqRing, sqRingBytes);
+        if (ringFd >= 0)
+            close(ringFd);
+    }
+
+    // Returns false if the kernel does not offer io_uring to this process
+    bool open(unsigned entries)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ringFd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (ringFd < 0)
+            return false;
+
+        sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+        sqRing = mmap(nullptr, sqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        cqRing = mmap(nullptr, cqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        sqes = mmap(nullptr, sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED)
+            return false;
+
+        char* sq = static_cast<char*>(sqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        char* cq = static_cast<char*>(cqRing);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    // Queues a read of bytes at offset into buffer and submits it, returning
+    // true if the kernel took the read.  An entry the kernel did not take is
+    // withdrawn, so a later submission can't pick it up.  refuse fails the
+    // submission without entering the kernel, as if it had refused it.
+    bool read(int fd, char* buffer, size_t bytes, uint64_t offset, uint64_t tag, iovec& vector, bool refuse)
+    {
+        vector.iov_base = buffer;
+        vector.iov_len = bytes;
+
+        unsigned tail = *sqTail;
+        unsigned index = tail & sqMask;
+        io_uring_sqe& sqe = static_cast<io_uring_sqe*>(sqes)[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READV;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(&vector);
+        sqe.len = 1;
+        sqe.off = offset;
+        sqe.user_data = tag;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        int submitted = -1;
+        while (!refuse)
+        {
+            submitted = (int)syscall(__NR_io_uring_enter, ringFd, 1, 0, 0, nullptr, 0);
+            if (submitted >= 0 || errno != EINTR)
+                break;
+        }
+        if (submitted == 1)
+            return true;
+
+        // Without a polling thread the kernel only takes entries while it is
+        // entered, so once it has returned the head shows whether it did
+        if (__atomic_load_n(sqHead, __ATOMIC_ACQUIRE) != tail)
+            return true;
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+        return false;
+    }
+
+    // Waits for the next completion, the result is the byte count or -errno
+    bool wait(uint64_t& tag, int& result)
+    {
+        for (;;)
+        {
+            unsigned head = *cqHead;
+            if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+            {
+                const io_uring_cqe& cqe = cqes[head & cqMask];
+                tag = cqe.user_data;
+                result = cqe.res;
+                __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+            if (syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+                return false;
+        }
+    }
+
+    // One iovec per slot, which must stay put until its read completes
+    std::vector<iovec> vectors;
+
+private:
+    int ringFd;
+    void* sqRing;
+    void* cqRing;
+    void* sqes;
+    size_t sqRingBytes;
+    size_t cqRingBytes;
+    size_t sqesBytes;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    io_uring_cqe* cqes;
+};
+
+#else
+
+// Without io_uring the queue never opens and the read-ahead thread is used
+class UringQueue
+{
+public:
+    bool open(unsigned) { return false; }
+    bool read(int, char*, size_t, uint64_t, uint64_t, int, bool) { return false; }
+    bool wait(uint64_t&, int&) { return false; }
+    std::vector<int> vectors;
+};
+
+#endif
+
+ReadAhead::ReadAhead(const std::string& fileName, uint64_t begin, uint64_t end, const ReadAheadSettings& settings)
+: begin(begin), end(std::max(begin, end)), consumed(0), exhausted(false), stallSeconds(0), pending(0), submissions(0),
+  failSubmission(settings.failSubmission), refused(false), stopping(false)
+{
+    blockBytes = std::max<size_t>(1, settings.blockBytes);
+    blockCount = (size_t)((this->end - begin + blockBytes - 1) / blockBytes);
+
+    fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || blockCount == 0)
+        return;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, begin, this->end - begin, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    size_t depth = std::min(std::max<size_t>(1, settings.depth), blockCount);
+    slots.resize(depth);
+    for (auto& slot : slots)
+    {
+        slot.buffer.reset(new char[std::min<uint64_t>(blockBytes, this->end - begin)]);
+        slot.size = 0;
+        slot.ready = false;
+        slot.failed = false;
+        slot.queued = false;
+    }
+
+    if (settings.useUring)
+    {
+        ring.reset(new UringQueue());
+        if (ring->open((unsigned)depth))
+        {
+            ring->vectors.resize(depth);
+            for (size_t block = 0; block < depth && ring && !refused; block++)
+            {
+                // A ring which refuses the first read is given up for the
+                // thread, after a later refusal the blocks are read
+                // synchronously
+                if (!submit(block) && block == 0)
+                    ring.reset();
+            }
+        }
+        else
+            ring.reset();
+    }
+    if (!ring)
+        reader = std::thread(&ReadAhead::readLoop, this);
+}
+
+ReadAhead::~ReadAhead()
+{
+    if (reader.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        changed.notify_all();
+        reader.join();
+    }
+
+    // The kernel may still be writing into the buffers of queued reads
+    uint64_t tag;
+    int result;
+    while (ring && pending > 0 && ring->wait(tag, result))
+    {
+        pending--;
+        slotOf((size_t)tag).queued = false;
+    }
+
+    // If the ring failed before they completed the buffers are left to the
+    // kernel rather than freed under it
+    for (auto& slot : slots)
+    {
+        if (slot.queued)
+            slot.buffer.release();
+    }
+    ring.reset();
+
+    if (fd >= 0)
+        close(fd);
+}
+
+size_t ReadAhead::blockLength(size_t block) const
+{
+    return (size_t)std::min<uint64_t>(blockBytes, end - blockOffset(block));
+}
+
+const char* ReadAhead::backend() const
+{
+    return ring ? "io_uring" : "thread";
+}
+
+void ReadAhead::addTo(ReadAheadTotals& totals) const
+{
+    if (ring)
+        totals.uringBlocks += consumed;
+    else
+        totals.threadBlocks += consumed;
+    totals.stallSeconds += stallSeconds;
+}
+
+// Reads the rest of a block from done bytes on with pread, stopping short at
+// the end of the file, and returns false on a read error
+bool ReadAhead::readWhole(size_t block, size_t& done)
+{
+    Slot& slot = slotOf(block);
+    const size_t length = blockLength(block);
+    while (done < length)
+    {
+        ssize_t got = pread(fd, slot.buffer.get() + done, length - done, blockOffset(block) + done);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0)
+            return false;
+        if (got == 0)
+            break;
+        done += (size_t)got;
+    }
+    return true;
+}
+
+void ReadAhead::readLoop()
+{
+    for (size_t block = 0; block < blockCount; block++)
+    {
+        Slot& slot = slotOf(block);
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [&]() { return stopping || !slot.ready; });
+            if (stopping)
+                return;
+        }
+
+        size_t done = 0;
+        bool ok = readWhole(block, done);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            slot.size = done;
+            slot.failed = !ok;
+            slot.ready = true;
+        }
+        changed.notify_all();
+
+        // Nothing follows a failed read or the end of the file
+        if (!ok || done < blockLength(block))
+            return;
+    }
+}
+
+bool ReadAhead::submit(size_t block)
+{
+    if (refused)
+        return false;
+
+    Slot& slot = slotOf(block);
+    bool refuse = submissions++ == failSubmission;
+    if (!ring->read(fd, slot.buffer.get(), blockLength(block), blockOffset(block), block, ring->vectors[block % slots.size()], refuse))
+    {
+        refused = true;
+        return false;
+    }
+    slot.queued = true;
+    pending++;
+    return true;
+}
+
+void ReadAhead::awaitRing(size_t block)
+{
+    Slot& wanted = slotOf(block);
+    while (!wanted.ready)
+    {
+        // A read which could not be queued is made here instead
+        if (!wanted.queued)
+        {
+            size_t done = 0;
+            bool ok = readWhole(block, done);
+            wanted.size = done;
+            wanted.failed = !ok;
+            wanted.ready = true;
+            break;
+        }
+
+        // If the ring can't report completions the queued reads may still be
+        // writing into their buffers, so none of them can be read again and
+        // the range ends here
+        uint64_t tag;
+        int result;
+        if (!ring->wait(tag, result))
+        {
+            wanted.size = 0;
+            wanted.failed = true;
+            wanted.ready = true;
+            break;
+        }
+        pending--;
+
+        // A read which failed or stopped short is finished synchronously,
+        // its buffer is no longer the kernel's
+        Slot& slot = slotOf((size_t)tag);
+        slot.queued = false;
+        size_t done = result > 0 ? (size_t)result : 0;
+        bool ok = readWhole((size_t)tag, done);
+        slot.size = done;
+        slot.failed = !ok;
+        slot.ready = true;
+    }
+}
+
+void ReadAhead::awaitThread(size_t block)
+{
+    Slot& slot = slotOf(block);
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [&]() { return slot.ready; });
+}
+
+void ReadAhead::release(size_t block)
+{
+    Slot& slot = slotOf(block);
+    if (ring)
+    {
+        slot.ready = false;
+        // A read the ring refuses is made synchronously when it is wanted
+        size_t following = block + slots.size();
+        if (following < blockCount)
+            submit(following);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        slot.ready = false;
+    }
+    changed.notify_all();
+}
+
+bool ReadAhead::next(const char*& data, size_t& size)
+{
+    if (fd < 0 || exhausted)
+        return false;
+    if (consumed > 0)
+        release(consumed - 1);
+    if (consumed >= blockCount)
+    {
+        exhausted = true;
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (ring)
+        awaitRing(consumed);
+    else
+        awaitThread(consumed);
+    stallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Slot& slot = slotOf(consumed);
+    if (slot.failed || slot.size == 0)
+    {
+        exhausted = true;
+        return false;
+    }
+    data = slot.buffer.get();
+    size = slot.size;
+    consumed++;
+
+    // A short block is the end of the file
+    if (size < blockLength(consumed - 1))
+        exhausted = true;
+    return true;
+}
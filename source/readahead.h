@@ -0,0 +1,241 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Asynchronous read-ahead of the input byte ranges.
+
+    A Reader used to alternate between waiting on the disk and parsing, so
+    neither the disk nor the processor was ever busy for the whole stage.
+    A ReadAhead reads a byte range of a file in large blocks into a ring of
+    buffers, keeping up to the queue depth of them in flight, and hands the
+    blocks over in order.  While the caller parses and sends one block the
+    following ones are being read.
+
+    On Linux the reads are queued with io_uring, through its system calls
+    directly since liburing is not required.  Where io_uring is missing or
+    refused, as it is by older kernels and by some container sandboxes, a
+    dedicated thread reads the blocks with pread instead.  Both hand back
+    the same blocks, only the backend reported in the run metrics differs.
+
+    ForEachLineReadAhead and ForEachRecordReadAhead split the blocks into
+    the lines and records of a range with the same rules as the streaming
+    ForEachLineInRange and ForEachRecordInRange of inputsplit.h.
+
+*/
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include "inputsplit.h"
+
+// The default number of blocks in flight and the size of each block
+#define READAHEAD_DEPTH 4
+#define READAHEAD_BLOCK_BYTES (4 << 20)
+
+struct ReadAheadSettings
+{
+    size_t depth;
+    size_t blockBytes;
+    bool useUring;
+
+    // The number of the io_uring submission to fail as if the kernel had
+    // refused it, used by the tests of the fallback, SIZE_MAX for none
+    size_t failSubmission;
+
+    ReadAheadSettings();
+};
+
+// What a run of ReadAhead objects did, summed by the caller
+struct ReadAheadTotals
+{
+    uint64_t uringBlocks;
+    uint64_t threadBlocks;
+    double stallSeconds;
+
+    ReadAheadTotals();
+};
+
+class UringQueue;
+
+class ReadAhead
+{
+public:
+    ReadAhead(const std::string& fileName, uint64_t begin, uint64_t end, const ReadAheadSettings& settings = ReadAheadSettings());
+    ~ReadAhead();
+
+    ReadAhead(const ReadAhead&) = delete;
+    ReadAhead& operator=(const ReadAhead&) = delete;
+
+    bool isOpen() const { return fd >= 0; }
+
+    // Points data at the next block of the range, which stays valid until the
+    // following call, and returns false once the range is exhausted or a read
+    // failed.  Blocks hold whole multiples of the block size except the last.
+    bool next(const char*& data, size_t& size);
+
+    // "io_uring" or "thread"
+    const char* backend() const;
+
+    // Adds the blocks handed over and the time spent waiting for them
+    void addTo(ReadAheadTotals& totals) const;
+
+private:
+    struct Slot
+    {
+        std::unique_ptr<char[]> buffer;
+        size_t size;
+        bool ready;
+        bool failed;
+        bool queued;    // A ring read into the buffer has not completed
+    };
+
+    int fd;
+    uint64_t begin;
+    uint64_t end;
+    size_t blockBytes;
+    size_t blockCount;
+    size_t consumed;
+    bool exhausted;
+    std::vector<Slot> slots;
+    double stallSeconds;
+
+    // The queued reads of the io_uring backend.  After a refused submission
+    // nothing more is queued and the remaining blocks are read synchronously.
+    std::unique_ptr<UringQueue> ring;
+    size_t pending;
+    size_t submissions;
+    size_t failSubmission;
+    bool refused;
+
+    // The reading thread of the fallback backend
+
+    std::thread reader;
+    std::mutex lock;
+    std::condition_variable changed;
+    bool stopping;
+
+    uint64_t blockOffset(size_t block) const { return begin + (uint64_t)block * blockBytes; }
+    size_t blockLength(size_t block) const;
+    Slot& slotOf(size_t block) { return slots[block % slots.size()]; }
+
+    bool readWhole(size_t block, size_t& done);
+    void readLoop();
+    bool submit(size_t block);
+    void awaitRing(size_t block);
+    void awaitThread(size_t block);
+    void release(size_t block);
+};
+
+// Calls f with every line whose first byte lies in the range, reading the
+// range through a ReadAhead.  The line which crosses the end of the range is
+// finished with a short synchronous read past it.
+template <typename F>
+void ForEachLineReadAhead(const InputRange& range, const ReadAheadSettings& settings, ReadAheadTotals& totals, F f)
+{
+    if (range.begin >= range.end)
+        return;
+
+    // The byte before the range tells whether it starts on a line boundary
+    ReadAhead input(range.fileName, range.begin > 0 ? range.begin - 1 : 0, range.end, settings);
+    if (!input.isOpen())
+        return;
+
+    bool skipping = range.begin > 0;
+    std::string line;
+    const char* data;
+    size_t size;
+    while (input.next(data, size))
+    {
+        const char* p = data;
+        const char* e = data + size;
+        if (skipping)
+        {
+            // Skip the end of the line that started in the previous range
+            const char* newline = static_cast<const char*>(std::memchr(p, '\n', e - p));
+            if (newline == nullptr)
+                continue;
+            p = newline + 1;
+            skipping = false;
+        }
+        while (p < e)
+        {
+            const char* newline = static_cast<const char*>(std::memchr(p, '\n', e - p));
+            if (newline == nullptr)
+            {
+                line.append(p, e);
+                break;
+            }
+            line.append(p, newline);
+            f(line);
+            line.clear();
+            p = newline + 1;
+        }
+    }
+    input.addTo(totals);
+
+    // A partial line left over started within the range and ends after it
+    if (!skipping && !line.empty())
+    {
+        std::ifstream file(range.fileName, std::ios::binary);
+        file.seekg(range.end);
+        std::string rest;
+        if (file.good() && std::getline(file, rest))
+            line += rest;
+        f(line);
+    }
+}
+
+// Calls f with a pointer to every record of stride doubles which starts in the
+// range, the range must be aligned to the records.  The blocks are rounded to
+// whole records so no record is split between two of them.
+template <typename F>
+void ForEachRecordReadAhead(const InputRange& range, size_t stride, const ReadAheadSettings& settings, ReadAheadTotals& totals, F f)
+{
+    if (range.begin >= range.end || stride == 0)
+        return;
+
+    const size_t recordBytes = stride * sizeof(double);
+    ReadAheadSettings recordSettings = settings;
+    recordSettings.blockBytes = std::max<size_t>(1, settings.blockBytes / recordBytes) * recordBytes;
+
+    ReadAhead input(range.fileName, range.begin, range.begin + (range.end - range.begin) / recordBytes * recordBytes, recordSettings);
+    if (!input.isOpen())
+        return;
+
+    const char* data;
+    size_t size;
+    while (input.next(data, size))
+    {
+        const double* records = reinterpret_cast<const double*>(data);
+        size_t count = size / recordBytes;
+        for (size_t i = 0; i < count; i++)
+            f(records + i * stride);
+    }
+    input.addTo(totals);
+}
+
+#endif
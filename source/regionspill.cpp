@@ -0,0 +1,125 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Spilling of the thinning regions of a Worker to local scratch.
+
+*/
+
+#include "regionspill.h"
+#include <cstdio>
+#include <stdexcept>
+
+RegionSpill::RegionSpill(const std::string& fileName, size_t stride)
+: name(fileName), stride(stride), end(0)
+{
+    file.open(name.c_str(), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        throw std::invalid_argument("Could not open spill file " + name);
+}
+
+RegionSpill::~RegionSpill()
+{
+    file.close();
+    std::remove(name.c_str());
+}
+
+void RegionSpill::spill(const VoxelAddress& address, PointCloud& cloud)
+{
+    if (cloud.size() == 0)
+        return;
+
+    std::vector<double> records(cloud.size() * stride);
+    for (size_t n = 0; n < cloud.size(); n++)
+    {
+        double* record = &records[n * stride];
+        record[0] = cloud.pts[n].x;
+        record[1] = cloud.pts[n].y;
+        record[2] = cloud.pts[n].z;
+        if (stride == 5)
+        {
+            record[3] = cloud.attributes.intensity[n];
+            record[4] = cloud.attributes.packedReturns(n);
+        }
+    }
+
+    file.seekp(end);
+    file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(double));
+    if (!file.good())
+        throw std::runtime_error("Could not write to spill file " + name);
+
+    segments[address].push_back(Segment{end, cloud.size()});
+    end += records.size() * sizeof(double);
+
+    // Swapping with empty containers releases the capacity as well
+    PointCloud().swap(cloud);
+}
+
+void RegionSpill::reload(const VoxelAddress& address, PointCloud& cloud)
+{
+    auto found = segments.find(address);
+    if (found == segments.end())
+        return;
+
+    PointCloud loaded;
+    size_t total = points(address) + cloud.size();
+    loaded.pts.reserve(total);
+
+    file.flush();
+    std::vector<double> records;
+    for (const auto& segment : found->second)
+    {
+        records.resize(segment.points * stride);
+        file.seekg(segment.offset);
+        file.read(reinterpret_cast<char*>(records.data()), records.size() * sizeof(double));
+        if (!file.good())
+            throw std::runtime_error("Could not read from spill file " + name);
+
+        for (size_t n = 0; n < segment.points; n++)
+        {
+            const double* record = &records[n * stride];
+            loaded.pts.push_back(Vector3d(record[0], record[1], record[2]));
+            if (stride == 5)
+                loaded.attributes.pushPacked(record[3], record[4]);
+        }
+    }
+
+    // The points still held arrived after every spilled point
+    loaded.pts.insert(loaded.pts.end(), cloud.pts.begin(), cloud.pts.end());
+    for (size_t n = 0; n < cloud.attributes.size(); n++)
+        loaded.attributes.append(cloud.attributes, n);
+
+    cloud.swap(loaded);
+    segments.erase(found);
+}
+
+bool RegionSpill::holds(const VoxelAddress& address) const
+{
+    return segments.count(address) > 0;
+}
+
+size_t RegionSpill::points(const VoxelAddress& address) const
+{
+    auto found = segments.find(address);
+    if (found == segments.end())
+        return 0;
+
+    size_t count = 0;
+    for (const auto& segment : found->second)
+        count += segment.points;
+    return count;
+}
@@ -0,0 +1,80 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Spilling of the thinning regions of a Worker to local scratch.  When a
+    Worker holds more points than its memory budget allows, the regions which
+    have gone longest without receiving points are appended to a spill file
+    in the binary scratch record layout and their memory is released.  A
+    region may be spilled several times as more points arrive for it, and
+    reloading puts the spilled points back in front of the ones still held,
+    so the points keep the order in which they were received and the
+    thinning result does not depend on the budget.
+
+*/
+#ifndef REGIONSPILL_H
+#define REGIONSPILL_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <unordered_map>
+#include <cstdint>
+
+#include "pointcloud.h"
+#include "voxelsorter.h"
+
+class RegionSpill
+{
+public:
+    // Opens an empty spill file of records of stride doubles, which are the
+    // x, y and z of a point followed by its attributes when stride is 5
+    RegionSpill(const std::string& fileName, size_t stride);
+
+    // Removes the spill file
+    ~RegionSpill();
+
+    // Appends the points of a region to the spill file and releases the
+    // memory of the cloud
+    void spill(const VoxelAddress& address, PointCloud& cloud);
+
+    // Puts the spilled points of a region in front of the points the cloud
+    // holds and forgets them, the spill file is not shrunk
+    void reload(const VoxelAddress& address, PointCloud& cloud);
+
+    bool holds(const VoxelAddress& address) const;
+
+    // The number of points of a region which are in the spill file
+    size_t points(const VoxelAddress& address) const;
+
+    inline uint64_t bytesWritten() const { return end; }
+
+private:
+    struct Segment
+    {
+        uint64_t offset;
+        uint64_t points;
+    };
+
+    std::string name;
+    size_t stride;
+    std::fstream file;
+    uint64_t end;
+    std::unordered_map<VoxelAddress, std::vector<Segment>> segments;
+};
+
+#endif
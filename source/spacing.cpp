@@ -0,0 +1,153 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Statistics of the spacing between the points of a cloud.
+
+*/
+
+#include "spacing.h"
+#include <cmath>
+#include <limits>
+
+std::vector<size_t> SpacingSampleIndices(size_t points, size_t samples)
+{
+    if (samples == 0 || samples > points)
+        samples = points;
+
+    std::vector<size_t> indices(samples);
+    for (size_t s = 0; s < samples; s++)
+        indices[s] = (size_t)((unsigned long long)s * points / samples);
+    return indices;
+}
+
+double SpacingPercentile(const std::vector<double>& sorted, double q)
+{
+    if (sorted.empty())
+        return 0;
+    size_t rank = (size_t)std::floor(q * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+SpacingStatistics SummarizeSpacing(std::vector<double> distances, size_t queries, size_t duplicates)
+{
+    SpacingStatistics stats;
+    stats.queries = queries;
+    stats.duplicates = duplicates;
+    stats.measured = distances.size();
+    stats.histogram.assign(SPACING_HISTOGRAM_BINS, 0);
+    if (distances.empty())
+        return stats;
+
+    std::sort(distances.begin(), distances.end());
+    stats.minimum = distances.front();
+    stats.p1 = SpacingPercentile(distances, 0.01);
+    stats.p5 = SpacingPercentile(distances, 0.05);
+    stats.median = SpacingPercentile(distances, 0.5);
+    stats.p99 = SpacingPercentile(distances, 0.99);
+
+    // The bins cover the distances up to the 99th percentile, so a few very
+    // isolated points do not squeeze the rest into the first bin
+    stats.binWidth = stats.p99 / SPACING_HISTOGRAM_BINS;
+    for (double d : distances)
+    {
+        if (d > stats.p99)
+            stats.overflow++;
+        else
+            stats.histogram[std::min((size_t)(d / stats.binWidth), stats.histogram.size() - 1)]++;
+    }
+    return stats;
+}
+
+// The distances found by one thread and its count of duplicates
+struct SpacingPart
+{
+    std::vector<double> distances;
+    size_t duplicates;
+};
+
+static SpacingPart measureQueries(const PointCloud& cloud, const SpacingKDTree& index, const std::vector<size_t>& queries,
+                                  size_t first, size_t last, const nanoflann::SearchParams& params)
+{
+    SpacingPart part{std::vector<double>(), 0};
+    part.distances.reserve(last - first);
+
+    size_t resultIndex[SPACING_NEIGHBOURS];
+    double distanceSquared[SPACING_NEIGHBOURS];
+    for (size_t q = first; q < last; q++)
+    {
+        const size_t i = queries[q];
+        double query_pt[3] = { cloud.pts[i].x, cloud.pts[i].y, cloud.pts[i].z };
+
+        nanoflann::KNNResultSet<double> results(SPACING_NEIGHBOURS);
+        results.init(resultIndex, distanceSquared);
+        index.findNeighbors(results, query_pt, params);
+
+        // The nearest distinct neighbour is the closest nonzero result, any
+        // other point at zero distance is a duplicate of the query
+        bool duplicate = false;
+        double nearest = std::numeric_limits<double>::max();
+        for (size_t r = 0; r < results.size(); r++)
+        {
+            if (distanceSquared[r] > 0)
+                nearest = std::min(nearest, distanceSquared[r]);
+            else if (resultIndex[r] != i)
+                duplicate = true;
+        }
+
+        if (duplicate)
+            part.duplicates++;
+        if (nearest < std::numeric_limits<double>::max())
+            part.distances.push_back(std::sqrt(nearest));
+    }
+    return part;
+}
+
+SpacingStatistics MeasureSpacing(const PointCloud& cloud, const SpacingKDTree& index, const SpacingOptions& options)
+{
+    std::vector<size_t> queries = SpacingSampleIndices(cloud.pts.size(), options.samples);
+    nanoflann::SearchParams params(32, options.eps);
+
+    size_t threads = options.threads;
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    if (threads > queries.size())
+        threads = std::max<size_t>(queries.size(), 1);
+
+    std::vector<std::future<SpacingPart>> parts;
+    size_t perThread = queries.size() / threads;
+    size_t extra = queries.size() % threads;
+    size_t first = 0;
+    for (size_t t = 0; t < threads; t++)
+    {
+        size_t last = first + perThread + (t < extra ? 1 : 0);
+        parts.push_back(std::async(std::launch::async, measureQueries, std::cref(cloud), std::cref(index),
+                                   std::cref(queries), first, last, std::cref(params)));
+        first = last;
+    }
+
+    std::vector<double> distances;
+    distances.reserve(queries.size());
+    size_t duplicates = 0;
+    for (auto& f : parts)
+    {
+        SpacingPart part = f.get();
+        distances.insert(distances.end(), part.distances.begin(), part.distances.end());
+        duplicates += part.duplicates;
+    }
+    return SummarizeSpacing(std::move(distances), queries.size(), duplicates);
+}
@@ -0,0 +1,90 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Statistics of the spacing between the points of a cloud.
+
+    For every queried point the distance to its nearest distinct neighbour is
+    found with a k-d tree search, skipping any exact duplicates of the point,
+    which are counted instead.  The smallest of these distances is the one
+    closest_point_check has always reported, but a single close pair decides
+    it, so the percentiles and histogram of the distances are kept as well.
+    A low percentile is a far more stable choice of thinning distance.
+
+    The queries are split between threads, each collecting its own distances
+    and duplicate count, and can be limited to an evenly spaced sample of the
+    points.  The tree is still built over every point, so each sampled
+    distance is exact.
+
+*/
+#ifndef SPACING_H
+#define SPACING_H
+
+#include <vector>
+#include "pointcloud.h"
+#include "parallelkdtree.h"
+
+// The number of neighbours found for each query, which includes the query
+// point itself, so up to SPACING_NEIGHBOURS - 2 duplicates are skipped
+#define SPACING_NEIGHBOURS 5
+
+// The number of bins of the spacing histogram
+#define SPACING_HISTOGRAM_BINS 20
+
+typedef ParallelKDTree<PointCloud> SpacingKDTree;
+
+struct SpacingOptions
+{
+    size_t threads = 0;     // Zero uses every core
+    size_t samples = 0;     // Zero queries every point
+    float eps = 0;          // Nonzero makes the searches approximate
+};
+
+struct SpacingStatistics
+{
+    size_t queries = 0;     // Points queried
+    size_t duplicates = 0;  // Queried points with an exact duplicate
+    size_t measured = 0;    // Queried points with a distinct neighbour found
+
+    // Nearest distinct neighbour distances
+    double minimum = 0;
+    double p1 = 0;
+    double p5 = 0;
+    double median = 0;
+    double p99 = 0;
+
+    // Counts of the distances in [b * binWidth, (b + 1) * binWidth), covering
+    // the distances up to the 99th percentile, and of the distances beyond
+    double binWidth = 0;
+    std::vector<size_t> histogram;
+    size_t overflow = 0;
+};
+
+// Returns the indices of up to samples points spread evenly through a cloud
+// of the given size, or of every point when samples is zero or not smaller
+std::vector<size_t> SpacingSampleIndices(size_t points, size_t samples);
+
+// Returns the value at fraction q of the sorted distances
+double SpacingPercentile(const std::vector<double>& sorted, double q);
+
+// Summarizes the nearest distinct neighbour distances
+SpacingStatistics SummarizeSpacing(std::vector<double> distances, size_t queries, size_t duplicates);
+
+// Measures the spacing of the cloud using an index already built over it
+SpacingStatistics MeasureSpacing(const PointCloud& cloud, const SpacingKDTree& index, const SpacingOptions& options);
+
+#endif
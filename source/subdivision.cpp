@@ -0,0 +1,197 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Adaptive subdivision of the thinning regions.
+
+*/
+
+#include "subdivision.h"
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+
+// The octree over the point indices of one cloud.  Every node reorders its
+// range of the index array by octant, keeping the points of each octant in
+// their original order, and the leaves are the parts thinned in turn.
+class OctreeSplitter
+{
+public:
+    struct Part
+    {
+        size_t begin;
+        size_t end;
+        Vector3d lo;
+        Vector3d hi;
+    };
+
+    OctreeSplitter(const PointCloud& cloud, double thinningDistance, size_t budget)
+    : cloud(cloud), distance(thinningDistance), budget(budget)
+    {
+        order.resize(cloud.pts.size());
+        std::iota(order.begin(), order.end(), 0);
+    }
+
+    void split()
+    {
+        if (cloud.pts.empty())
+            return;
+        Vector3d lo = cloud.pts.front();
+        Vector3d hi = lo;
+        for (const auto& p : cloud.pts)
+        {
+            lo = Vector3d(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+            hi = Vector3d(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+        }
+        split(0, order.size(), lo, hi, 0);
+    }
+
+    std::vector<size_t> order;
+    std::vector<Part> parts;
+
+private:
+    const PointCloud& cloud;
+    const double distance;
+    const size_t budget;
+    std::vector<size_t> scratch;
+
+    void split(size_t begin, size_t end, const Vector3d& lo, const Vector3d& hi, int depth)
+    {
+        double width = std::min(hi.x - lo.x, std::min(hi.y - lo.y, hi.z - lo.z));
+        if (end - begin <= budget || depth >= SUBDIVISION_MAX_DEPTH || width < SUBDIVISION_MIN_WIDTH * distance)
+        {
+            parts.push_back(Part{begin, end, lo, hi});
+            return;
+        }
+
+        // A stable counting sort by octant
+        const Vector3d c = (lo + hi) * 0.5;
+        size_t counts[8] = {0};
+        for (size_t n = begin; n < end; n++)
+            counts[octant(cloud.pts[order[n]], c)]++;
+
+        size_t starts[9];
+        starts[0] = begin;
+        for (int o = 0; o < 8; o++)
+            starts[o + 1] = starts[o] + counts[o];
+        scratch.assign(order.begin() + begin, order.begin() + end);
+        size_t next[8];
+        std::copy(starts, starts + 8, next);
+        for (size_t index : scratch)
+            order[next[octant(cloud.pts[index], c)]++] = index;
+
+        for (int o = 0; o < 8; o++)
+        {
+            if (starts[o] == starts[o + 1])
+                continue;
+            Vector3d childLo((o & 1) ? c.x : lo.x, (o & 2) ? c.y : lo.y, (o & 4) ? c.z : lo.z);
+            Vector3d childHi((o & 1) ? hi.x : c.x, (o & 2) ? hi.y : c.y, (o & 4) ? hi.z : c.z);
+            split(starts[o], starts[o + 1], childLo, childHi, depth + 1);
+        }
+    }
+
+    static inline int octant(const Vector3d& p, const Vector3d& c)
+    {
+        return (p.x >= c.x ? 1 : 0) | (p.y >= c.y ? 2 : 0) | (p.z >= c.z ? 4 : 0);
+    }
+};
+
+// Returns the distance from the point to the box, zero inside it
+static inline double distanceToBox(const Vector3d& p, const Vector3d& lo, const Vector3d& hi)
+{
+    double dx = std::max(0.0, std::max(lo.x - p.x, p.x - hi.x));
+    double dy = std::max(0.0, std::max(lo.y - p.y, p.y - hi.y));
+    double dz = std::max(0.0, std::max(lo.z - p.z, p.z - hi.z));
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+// Returns true if the boxes are within the distance of each other
+static inline bool boxesNear(const OctreeSplitter::Part& a, const OctreeSplitter::Part& b, double distance)
+{
+    return a.lo.x - b.hi.x <= distance && b.lo.x - a.hi.x <= distance &&
+           a.lo.y - b.hi.y <= distance && b.lo.y - a.hi.y <= distance &&
+           a.lo.z - b.hi.z <= distance && b.lo.z - a.hi.z <= distance;
+}
+
+size_t ThinSubdivided(ThinningContext& context, PointCloud& cloud, double thinningDistance, size_t budget)
+{
+    if (budget == 0 || cloud.pts.size() <= budget)
+    {
+        context.thin(cloud, thinningDistance);
+        return 1;
+    }
+
+    OctreeSplitter octree(cloud, thinningDistance, budget);
+    octree.split();
+
+    // Each part is thinned with the points kept by the parts before it which
+    // are close to its box placed ahead of its own points.  They are kept
+    // points, so none of them is within the distance of another, and they
+    // remove the points of the part close to them as if they came first.
+    PointCloud part;
+    std::vector<char> removed(cloud.pts.size(), 0);
+    for (size_t current = 0; current < octree.parts.size(); current++)
+    {
+        const auto& box = octree.parts[current];
+        part.pts.clear();
+        for (size_t done = 0; done < current; done++)
+        {
+            const auto& neighbour = octree.parts[done];
+            if (!boxesNear(box, neighbour, thinningDistance))
+                continue;
+            for (size_t n = neighbour.begin; n < neighbour.end; n++)
+            {
+                const Vector3d& p = cloud.pts[octree.order[n]];
+                if (!removed[octree.order[n]] && distanceToBox(p, box.lo, box.hi) < thinningDistance)
+                    part.pts.push_back(p);
+            }
+        }
+        size_t halo = part.pts.size();
+        for (size_t n = box.begin; n < box.end; n++)
+            part.pts.push_back(cloud.pts[octree.order[n]]);
+
+        context.build(part);
+        const std::vector<char>& partRemoved = context.markRedundant(thinningDistance);
+        for (size_t n = box.begin; n < box.end; n++)
+        {
+            if (partRemoved[halo + n - box.begin])
+                removed[octree.order[n]] = 1;
+        }
+    }
+
+    cloud.RemoveMarked(removed);
+    return octree.parts.size();
+}
+
+void ThinCoalesced(ThinningContext& context, const std::vector<PointCloud*>& clouds, double thinningDistance)
+{
+    PointCloud batch;
+    for (const PointCloud* cloud : clouds)
+        batch.pts.insert(batch.pts.end(), cloud->pts.begin(), cloud->pts.end());
+
+    context.build(batch);
+    const std::vector<char>& removed = context.markRedundant(thinningDistance);
+
+    size_t offset = 0;
+    std::vector<char> cloudRemoved;
+    for (PointCloud* cloud : clouds)
+    {
+        cloudRemoved.assign(removed.begin() + offset, removed.begin() + offset + cloud->pts.size());
+        offset += cloud->pts.size();
+        cloud->RemoveMarked(cloudRemoved);
+    }
+}
@@ -0,0 +1,69 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Adaptive subdivision of the thinning regions.
+
+    Every region is one cubic bin, so the bin around a scanner station can
+    hold a thousand times the points of a typical bin, and its k-d tree
+    dominates the time and memory of the Worker holding it.  A region with
+    more points than the budget is split into octants about the centre of
+    its bounding box, and the octants with more than the budget are split
+    again, so each part is thinned with a tree of about the budget.
+
+    The parts are thinned one after another.  Each is thinned with a tree
+    over its own points, in their original order, behind the points already
+    kept by earlier parts which lie within the thinning distance of its box.
+    Those kept points are never within the distance of each other, so none
+    of them is removed, and every point of the part close to one of them is.
+    No two points within the distance of each other are left, as when the
+    region is thinned whole, though which of a close pair across two parts
+    is kept follows the order of the parts rather than of the points.
+    Splitting stops at parts a few thinning distances across, where most of
+    a part would be within the distance of its neighbours anyway.
+
+    The many regions with only a handful of points are thinned together in
+    batches instead, sharing one tree.  Thinning more points together only
+    removes points which are within the distance of another, so batching
+    never leaves a close pair that thinning alone would have removed.
+
+*/
+#ifndef SUBDIVISION_H
+#define SUBDIVISION_H
+
+#include <vector>
+#include "pointcloud.h"
+#include "thinning.h"
+
+// The deepest level of the octree an overfull region is split to
+#define SUBDIVISION_MAX_DEPTH 12
+
+// Octants are not split when narrower than this many thinning distances
+#define SUBDIVISION_MIN_WIDTH 4
+
+// Regions with fewer points than the budget divided by this are batched
+#define COALESCE_DIVISOR 8
+
+// Removes the redundant points from the cloud, thinning it in octants of at
+// most budget points, and returns the number of octants thinned
+size_t ThinSubdivided(ThinningContext& context, PointCloud& cloud, double thinningDistance, size_t budget);
+
+// Removes the redundant points from each of the clouds, thinning all of them
+// with one tree
+void ThinCoalesced(ThinningContext& context, const std::vector<PointCloud*>& clouds, double thinningDistance);
+
+#endif
@@ -0,0 +1,251 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Reproducible synthetic point clouds for tests and benchmarks.
+
+*/
+
+#include "synthetic.h"
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <utility>
+
+SyntheticRandom::SyntheticRandom(uint64_t seed)
+{
+    state = seed;
+}
+
+uint64_t SyntheticRandom::next()
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+double SyntheticRandom::uniform()
+{
+    // The top 53 bits fill the mantissa of a double exactly
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double SyntheticRandom::normal(double mean, double sigma)
+{
+    double u1 = 1.0 - uniform();
+    double u2 = uniform();
+    return mean + sigma * std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * M_PI * u2);
+}
+
+std::vector<Vector3d> GenerateUniformCloud(size_t count, double density, uint64_t seed)
+{
+    if (density <= 0)
+        throw std::invalid_argument("The density of a synthetic cloud must be positive");
+
+    double side = std::cbrt(count / density);
+    SyntheticRandom random(seed);
+
+    std::vector<Vector3d> points;
+    points.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        double x = random.uniform(0, side);
+        double y = random.uniform(0, side);
+        double z = random.uniform(0, side);
+        points.push_back(Vector3d(x, y, z));
+    }
+    return points;
+}
+
+void WriteAscFile(std::string fileName, const std::vector<Vector3d>& points)
+{
+    std::ofstream out(fileName.c_str());
+    if (!out.is_open())
+        throw std::invalid_argument("Could not open " + fileName + " for output");
+
+    out.precision(10);
+    for (const auto& p : points)
+        out << p.x << " " << p.y << " " << p.z << "\n";
+}
+
+SyntheticCanopySettings::SyntheticCanopySettings()
+{
+    points = 1000000;
+    seed = 1;
+    width = 50;
+    trees = 60;
+    clusters = 8;
+    stations = 4;
+    groundFraction = 0.3;
+    trunkFraction = 0.1;
+    duplicateFraction = 0.2;
+    duplicateJitter = 0.002;
+    chunkSize = 1 << 18;
+}
+
+// Keeps a coordinate inside the plot by reflecting it at the edges
+static double reflect(double v, double width)
+{
+    v = std::fmod(std::fabs(v), 2 * width);
+    return v > width ? 2 * width - v : v;
+}
+
+SyntheticCanopy::SyntheticCanopy(const SyntheticCanopySettings& s)
+{
+    settings = s;
+    if (settings.points == 0 || settings.width <= 0 || settings.chunkSize == 0)
+        throw std::invalid_argument("A synthetic canopy needs points, a positive width and a chunk size");
+    if (settings.stations < 1)
+        settings.stations = 1;
+    if (settings.clusters < 1)
+        settings.clusters = 1;
+
+    SyntheticRandom random(settings.seed);
+
+    // Place the cluster centers uniformly and scatter the trees around them
+    std::vector<std::pair<double, double>> centers;
+    for (size_t c = 0; c < settings.clusters; c++)
+    {
+        double cx = random.uniform(0, settings.width);
+        double cy = random.uniform(0, settings.width);
+        centers.push_back(std::make_pair(cx, cy));
+    }
+
+    double spread = settings.width / (4.0 * std::sqrt((double)settings.clusters));
+    for (size_t t = 0; t < settings.trees; t++)
+    {
+        SyntheticTree tree;
+        const auto& center = centers[random.next() % centers.size()];
+        tree.x = reflect(random.normal(center.first, spread), settings.width);
+        tree.y = reflect(random.normal(center.second, spread), settings.width);
+        tree.base = ground(tree.x, tree.y);
+        tree.height = random.uniform(12, 30);
+        tree.crownBase = tree.height * random.uniform(0.35, 0.6);
+        tree.crownRadius = tree.height * random.uniform(0.12, 0.22);
+        tree.trunkRadius = tree.height * random.uniform(0.008, 0.015);
+        tree.clumpRadius = tree.crownRadius * 0.25;
+
+        // Foliage clumps are spread through the crown ellipsoid
+        double halfDepth = (tree.height - tree.crownBase) / 2.0;
+        double crownCenter = tree.base + tree.crownBase + halfDepth;
+        size_t clumps = 6 + random.next() % 10;
+        while (tree.clumps.size() < clumps)
+        {
+            double dx = random.uniform(-1, 1);
+            double dy = random.uniform(-1, 1);
+            double dz = random.uniform(-1, 1);
+            if (dx * dx + dy * dy + dz * dz > 1)
+                continue;
+            tree.clumps.push_back(Vector3d(tree.x + dx * tree.crownRadius, tree.y + dy * tree.crownRadius, crownCenter + dz * halfDepth));
+        }
+        trees.push_back(tree);
+    }
+
+    // The stations sit on a grid at instrument height above the ground
+    size_t across = (size_t)std::ceil(std::sqrt((double)settings.stations));
+    for (size_t n = 0; n < settings.stations; n++)
+    {
+        double x = (n % across + 0.5) * settings.width / across;
+        double y = (n / across + 0.5) * settings.width / across;
+        stations.push_back(Vector3d(x, y, ground(x, y) + 1.5));
+    }
+}
+
+double SyntheticCanopy::ground(double x, double y) const
+{
+    return 0.8 * std::sin(x / 13.0) + 0.5 * std::cos(y / 9.0) + 0.01 * x;
+}
+
+SyntheticPoint SyntheticCanopy::surfacePoint(SyntheticRandom& random) const
+{
+    SyntheticPoint p;
+    double surface = random.uniform();
+
+    if (trees.empty() || surface < settings.groundFraction)
+    {
+        double x = random.uniform(0, settings.width);
+        double y = random.uniform(0, settings.width);
+        p.position = Vector3d(x, y, ground(x, y) + random.normal(0, 0.02));
+        p.intensity = static_cast<float>(random.normal(45, 6));
+        p.numberOfReturns = static_cast<uint8_t>(1 + random.next() % 3);
+        p.returnNumber = p.numberOfReturns;
+    }
+    else if (surface < settings.groundFraction + settings.trunkFraction)
+    {
+        const SyntheticTree& tree = trees[random.next() % trees.size()];
+        double angle = random.uniform(0, 2 * M_PI);
+        double h = random.uniform(0, tree.crownBase);
+        double r = tree.trunkRadius * (1.0 - 0.5 * h / tree.height);
+        p.position = Vector3d(tree.x + r * std::cos(angle), tree.y + r * std::sin(angle), tree.base + h);
+        p.intensity = static_cast<float>(random.normal(32, 4));
+        p.numberOfReturns = 1;
+        p.returnNumber = 1;
+    }
+    else
+    {
+        const SyntheticTree& tree = trees[random.next() % trees.size()];
+        const Vector3d& clump = tree.clumps[random.next() % tree.clumps.size()];
+        double x = random.normal(clump.x, tree.clumpRadius);
+        double y = random.normal(clump.y, tree.clumpRadius);
+        double z = random.normal(clump.z, tree.clumpRadius);
+        p.position = Vector3d(x, y, z);
+        p.intensity = static_cast<float>(random.normal(20, 5));
+        p.numberOfReturns = static_cast<uint8_t>(1 + random.next() % 4);
+        p.returnNumber = static_cast<uint8_t>(1 + random.next() % p.numberOfReturns);
+    }
+
+    if (p.intensity < 0)
+        p.intensity = 0;
+    return p;
+}
+
+void SyntheticCanopy::generateChunk(size_t chunk, std::vector<SyntheticPoint>& points) const
+{
+    uint64_t first = (uint64_t)chunk * settings.chunkSize;
+    size_t count = (size_t)std::min<uint64_t>(settings.chunkSize, settings.points - first);
+
+    SyntheticRandom random(settings.seed ^ (0xD1B54A32D192ED03ULL * (chunk + 1)));
+    const Vector3d& station = stations[stationOfChunk(chunk)];
+
+    // Surfaces further than the near range of the station are sampled less
+    double nearRange = settings.width / (2.0 * std::sqrt((double)stations.size()));
+
+    points.clear();
+    points.reserve(count);
+    while (points.size() < count)
+    {
+        SyntheticPoint p = surfacePoint(random);
+        double d = p.position.DistanceTo(station);
+        if (d > nearRange && random.uniform() > (nearRange * nearRange) / (d * d))
+            continue;
+
+        points.push_back(p);
+
+        if (points.size() < count && random.uniform() < settings.duplicateFraction)
+        {
+            SyntheticPoint duplicate = p;
+            double j = settings.duplicateJitter;
+            double dx = random.uniform(-j, j);
+            double dy = random.uniform(-j, j);
+            double dz = random.uniform(-j, j);
+            duplicate.position = Vector3d(p.position.x + dx, p.position.y + dy, p.position.z + dz);
+            points.push_back(duplicate);
+        }
+    }
+}
@@ -0,0 +1,136 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Reproducible synthetic point clouds for tests and benchmarks.  The random
+    numbers come from a SplitMix64 generator with its own conversion to
+    doubles, so a given seed produces the same points on every platform and
+    standard library.
+
+    The synthetic canopy is a square forest plot for scale testing.  It has a
+    gently rolling ground surface, trees placed in clusters, each with a
+    cylindrical trunk and a crown made of gaussian clumps of foliage, and a
+    set of scan stations on a grid.  Every point is seen from one station and
+    is kept with a probability that falls off with the square of its distance
+    from that station, so the surfaces near the stations and the regions where
+    stations overlap are oversampled as they are in real terrestrial scans.
+    A fraction of the points are followed by near duplicates that lie within
+    a small jitter of the original, which is what thinning removes.
+
+    The points are produced in fixed size chunks.  Every chunk is seen from a
+    single station and has its own seed, so the cloud is the same no matter
+    how many threads generate it, and any chunk can be produced on its own.
+
+*/
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "vector3d.h"
+
+class SyntheticRandom
+{
+public:
+    SyntheticRandom(uint64_t seed);
+
+    uint64_t next();
+
+    // A uniformly distributed double in [0, 1)
+    double uniform();
+
+    // A uniformly distributed double in [low, high)
+    inline double uniform(double low, double high) { return low + (high - low) * uniform(); }
+
+    // A normally distributed double from the Box-Muller transform
+    double normal(double mean, double sigma);
+
+private:
+    uint64_t state;
+};
+
+struct SyntheticPoint
+{
+    Vector3d position;
+    float intensity;
+    uint8_t returnNumber;
+    uint8_t numberOfReturns;
+};
+
+struct SyntheticTree
+{
+    double x;
+    double y;
+    double base;                        // Ground height at the trunk
+    double height;
+    double crownBase;
+    double crownRadius;
+    double trunkRadius;
+    std::vector<Vector3d> clumps;       // Centers of the foliage clumps
+    double clumpRadius;
+};
+
+struct SyntheticCanopySettings
+{
+    uint64_t points;
+    uint64_t seed;
+    double width;                       // Edge length of the square plot
+    size_t trees;
+    size_t clusters;                    // Number of clusters the trees are grouped into
+    size_t stations;
+    double groundFraction;              // Share of the points on the ground
+    double trunkFraction;               // Share of the points on the trunks
+    double duplicateFraction;           // Share of the points followed by a duplicate
+    double duplicateJitter;             // Maximum offset of a duplicate in each axis
+    size_t chunkSize;
+
+    SyntheticCanopySettings();
+};
+
+class SyntheticCanopy
+{
+public:
+    SyntheticCanopy(const SyntheticCanopySettings& settings);
+
+    inline size_t numberOfChunks() const { return (size_t)((settings.points + settings.chunkSize - 1) / settings.chunkSize); }
+    inline size_t stationOfChunk(size_t chunk) const { return chunk % stations.size(); }
+    inline const std::vector<Vector3d>& stationPositions() const { return stations; }
+    inline const std::vector<SyntheticTree>& treeList() const { return trees; }
+
+    // Height of the ground surface at x, y
+    double ground(double x, double y) const;
+
+    // Replaces the contents of points with the points of the given chunk
+    void generateChunk(size_t chunk, std::vector<SyntheticPoint>& points) const;
+
+private:
+    SyntheticCanopySettings settings;
+    std::vector<SyntheticTree> trees;
+    std::vector<Vector3d> stations;
+
+    SyntheticPoint surfacePoint(SyntheticRandom& random) const;
+};
+
+// Generates count points spread uniformly through a cube whose size is chosen
+// so that there are density points per cubic meter on average
+std::vector<Vector3d> GenerateUniformCloud(size_t count, double density, uint64_t seed);
+
+// Writes the points as an x y z .asc file readable by LoadPointsFromFile
+void WriteAscFile(std::string fileName, const std::vector<Vector3d>& points);
+
+#endif
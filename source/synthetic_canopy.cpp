@@ -0,0 +1,173 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <vector>
+#include <string>
+#include <deque>
+#include <memory>
+#include <algorithm>
+#include <future>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+
+#include "json/json.h"
+#include "synthetic.h"
+
+struct OutputSettings
+{
+    std::string prefix;
+    std::string format;
+    bool attributes;
+    bool splitStations;
+    size_t threads;
+};
+
+void printUsageInstructions()
+{
+    std::cout << "synthetic_canopy: make sure to specify the config argument as a command line parameter" << std::endl;
+    std::cout << "                  usage: synthetic_canopy config.json" << std::endl;
+    std::cout << "                  This tool writes a reproducible synthetic forest plot scan for scale testing." << std::endl;
+    std::cout << "                  See sample_data/synthetic_canopy.json for the settings." << std::endl;
+}
+
+/// Formats the points of one chunk in the output format, this runs on the
+/// worker threads so the text conversion is done in parallel as well
+std::string formatChunk(const SyntheticCanopy& canopy, size_t chunk, const OutputSettings& output)
+{
+    std::vector<SyntheticPoint> points;
+    canopy.generateChunk(chunk, points);
+
+    std::string data;
+    if (output.format == "binary")
+    {
+        // The same records as the mpi_voxels scratch files, x, y, z and then
+        // the intensity and packed return numbers when attributes are written
+        size_t stride = output.attributes ? 5 : 3;
+        data.resize(points.size() * stride * sizeof(double));
+        char* cursor = &data[0];
+        for (const auto& p : points)
+        {
+            double record[5] = {p.position.x, p.position.y, p.position.z, p.intensity,
+                                (double)(p.returnNumber * 256 + p.numberOfReturns)};
+            std::memcpy(cursor, record, stride * sizeof(double));
+            cursor += stride * sizeof(double);
+        }
+        return data;
+    }
+
+    char line[128];
+    data.reserve(points.size() * 40);
+    for (const auto& p : points)
+    {
+        int n;
+        if (output.attributes)
+            n = std::snprintf(line, sizeof(line), "%.4f %.4f %.4f %.1f %d %d\n", p.position.x, p.position.y, p.position.z,
+                              p.intensity, p.returnNumber, p.numberOfReturns);
+        else
+            n = std::snprintf(line, sizeof(line), "%.4f %.4f %.4f\n", p.position.x, p.position.y, p.position.z);
+        data.append(line, n);
+    }
+    return data;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        printUsageInstructions();
+        return -1;
+    }
+
+    std::ifstream configFile(argv[1]);
+    std::string text((std::istreambuf_iterator<char>(configFile)), std::istreambuf_iterator<char>());
+    Json::Value root;
+    Json::Reader reader;
+    if (!reader.parse(text, root))
+    {
+        std::cout << "synthetic_canopy: could not parse " << argv[1] << std::endl;
+        return -1;
+    }
+
+    SyntheticCanopySettings settings;
+    settings.points = root.get("points", (Json::UInt64)settings.points).asUInt64();
+    settings.seed = root.get("seed", (Json::UInt64)settings.seed).asUInt64();
+    settings.width = root.get("width", settings.width).asDouble();
+    settings.trees = root.get("trees", (Json::UInt64)settings.trees).asUInt64();
+    settings.clusters = root.get("clusters", (Json::UInt64)settings.clusters).asUInt64();
+    settings.stations = root.get("stations", (Json::UInt64)settings.stations).asUInt64();
+    settings.groundFraction = root.get("ground_fraction", settings.groundFraction).asDouble();
+    settings.trunkFraction = root.get("trunk_fraction", settings.trunkFraction).asDouble();
+    settings.duplicateFraction = root.get("duplicate_fraction", settings.duplicateFraction).asDouble();
+    settings.duplicateJitter = root.get("duplicate_jitter", settings.duplicateJitter).asDouble();
+    settings.chunkSize = root.get("chunk_size", (Json::UInt64)settings.chunkSize).asUInt64();
+
+    OutputSettings output;
+    output.prefix = root.get("output", "synthetic").asString();
+    output.format = root.get("format", "asc").asString();
+    output.attributes = root.get("attributes", false).asBool();
+    output.splitStations = root.get("split_stations", false).asBool();
+    output.threads = root.get("threads", 0).asUInt64();
+    if (output.threads == 0)
+        output.threads = std::max(1u, std::thread::hardware_concurrency());
+
+    if (output.format != "asc" && output.format != "binary")
+    {
+        std::cout << "synthetic_canopy: format must be \"asc\" or \"binary\"" << std::endl;
+        return -1;
+    }
+
+    SyntheticCanopy canopy(settings);
+    std::cout << "synthetic_canopy: " << settings.points << " points, " << canopy.treeList().size() << " trees, "
+              << canopy.stationPositions().size() << " stations, " << canopy.numberOfChunks() << " chunks on "
+              << output.threads << " threads" << std::endl;
+
+    // One output file, or one per station
+    std::string extension = output.format == "binary" ? ".bin" : ".asc";
+    size_t nFiles = output.splitStations ? canopy.stationPositions().size() : 1;
+    std::vector<std::string> fileNames;
+    std::vector<std::unique_ptr<std::ofstream>> files;
+    for (size_t f = 0; f < nFiles; f++)
+    {
+        fileNames.push_back(output.splitStations ? output.prefix + "_s" + std::to_string(f) + extension : output.prefix + extension);
+        files.emplace_back(new std::ofstream(fileNames.back().c_str(), std::ios::binary));
+        if (!files.back()->is_open())
+        {
+            std::cout << "synthetic_canopy: could not open " << fileNames.back() << " for output" << std::endl;
+            return -1;
+        }
+    }
+
+    // Chunks are generated ahead on the worker threads and written in order,
+    // so the output doesn't depend on the number of threads
+    std::deque<std::future<std::string>> pending;
+    size_t next = 0;
+    size_t nChunks = canopy.numberOfChunks();
+    for (size_t written = 0; written < nChunks; written++)
+    {
+        while (next < nChunks && pending.size() < output.threads + 1)
+        {
+            pending.push_back(std::async(std::launch::async, formatChunk, std::cref(canopy), next, std::cref(output)));
+            next++;
+        }
+
+        std::string data = pending.front().get();
+        pending.pop_front();
+
+        size_t file = output.splitStations ? canopy.stationOfChunk(written) : 0;
+        files[file]->write(data.data(), data.size());
+
+        if ((written + 1) % 16 == 0 || written + 1 == nChunks)
+            std::cout << "\rsynthetic_canopy: written " << written + 1 << " of " << nChunks << " chunks" << std::flush;
+    }
+    std::cout << std::endl;
+
+    for (size_t f = 0; f < nFiles; f++)
+    {
+        files[f]->close();
+        std::cout << "synthetic_canopy: wrote " << fileNames[f] << std::endl;
+    }
+
+    return 0;
+}
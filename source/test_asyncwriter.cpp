@@ -0,0 +1,106 @@
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <gtest/gtest.h>
+#include "asyncwriter.h"
+
+static std::string readFile(const std::string& fileName)
+{
+    std::ifstream in(fileName.c_str(), std::ios::binary);
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+static AsyncWriterSettings smallBuffers(bool directIO)
+{
+    AsyncWriterSettings settings;
+    settings.bufferBytes = 1;
+    settings.directIO = directIO;
+    return settings;
+}
+
+TEST (AsyncWriter, TextMatchesTheStreamFormatting)
+{
+    std::string fileName = "./test_asyncwriter.txt";
+    std::ostringstream expected;
+    {
+        // Buffers are rounded up to the alignment, so many buffers are handed
+        // over while the lines are written
+        AsyncOutputFile out(fileName, smallBuffers(false));
+        ASSERT_TRUE(out.is_open());
+        for (int i = 0; i < 5000; i++)
+        {
+            out << i << "," << -i << "," << i * 0.125 << "," << (unsigned)i * 7 << '\n';
+            expected << i << "," << -i << "," << i * 0.125 << "," << (unsigned)i * 7 << '\n';
+        }
+        ASSERT_EQ(expected.str().size(), out.bytes());
+        out.close();
+        ASSERT_TRUE(out.good());
+    }
+    ASSERT_EQ(expected.str(), readFile(fileName));
+    std::remove(fileName.c_str());
+}
+
+TEST (AsyncWriter, BinaryWritesKeepTheExactSize)
+{
+    std::string fileName = "./test_asyncwriter.bin";
+    std::vector<double> values(100003);
+    for (size_t i = 0; i < values.size(); i++)
+        values[i] = i * 1.5;
+
+    for (bool directIO : {false, true})
+    {
+        {
+            // A reservation larger than the data does not pad the file
+            AsyncOutputFile out(fileName, smallBuffers(directIO), values.size() * sizeof(double) * 2);
+            out.write(reinterpret_cast<const char*>(values.data()), 10 * sizeof(double));
+            for (size_t i = 10; i < values.size(); i++)
+                out.write(reinterpret_cast<const char*>(&values[i]), sizeof(double));
+            ASSERT_EQ(values.size() * sizeof(double), out.bytes());
+        }
+
+        std::string contents = readFile(fileName);
+        ASSERT_EQ(values.size() * sizeof(double), contents.size());
+        ASSERT_EQ(0, std::memcmp(values.data(), contents.data(), contents.size()));
+    }
+    std::remove(fileName.c_str());
+}
+
+TEST (AsyncWriter, UnopenedAndClosedFilesRefuseWrites)
+{
+    AsyncOutputFile missing("./no_such_directory/test_asyncwriter.txt");
+    ASSERT_FALSE(missing.is_open());
+    ASSERT_TRUE(missing.fail());
+
+    std::string fileName = "./test_asyncwriter.txt";
+    AsyncWriter writer(fileName);
+    ASSERT_TRUE(writer.isOpen());
+    writer.sputn("abc", 3);
+    ASSERT_TRUE(writer.close());
+    ASSERT_FALSE(writer.isOpen());
+    ASSERT_EQ(0, writer.sputn("def", 3));
+    ASSERT_EQ("abc", readFile(fileName));
+    std::remove(fileName.c_str());
+}
+
+TEST (AsyncWriter, FailedWritesThrowOnClose)
+{
+    // Every write to /dev/full fails with ENOSPC in the background thread
+    AsyncOutputFile out("/dev/full", smallBuffers(false));
+    ASSERT_TRUE(out.is_open());
+    for (int i = 0; i < 1000; i++)
+        out << i << '\n';
+    ASSERT_THROW(out.close(), std::runtime_error);
+    ASSERT_TRUE(out.bad());
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
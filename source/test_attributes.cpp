@@ -0,0 +1,127 @@
+#include <cmath>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <unordered_map>
+#include <gtest/gtest.h>
+#include "voxelsorter.h"
+#include "attributes.h"
+
+TEST (PointAttributes, ParseColumns)
+{
+    AttributeColumns columns;
+    ASSERT_FALSE(columns.enabled());
+
+    columns.intensity = 3;
+    columns.returnNumber = 4;
+    columns.numberOfReturns = 5;
+    ASSERT_TRUE(columns.enabled());
+
+    PointAttributes attributes;
+    ParseAttributes({"1.0", "2.0", "3.0", "117", "2", "3"}, columns, attributes);
+    ParseAttributes({"1.0", "2.0", "3.0", "40"}, columns, attributes);
+
+    ASSERT_EQ(2, attributes.size());
+    ASSERT_FLOAT_EQ(117, attributes.intensity[0]);
+    ASSERT_EQ(2, attributes.returnNumber[0]);
+    ASSERT_EQ(3, attributes.numberOfReturns[0]);
+    ASSERT_FLOAT_EQ(40, attributes.intensity[1]);
+    ASSERT_EQ(0, attributes.returnNumber[1]);
+}
+
+TEST (PointAttributes, PackedReturns)
+{
+    PointAttributes attributes;
+    attributes.push_back(12.5, 3, 4);
+    attributes.pushPacked(attributes.intensity[0], attributes.packedReturns(0));
+
+    ASSERT_FLOAT_EQ(12.5, attributes.intensity[1]);
+    ASSERT_EQ(3, attributes.returnNumber[1]);
+    ASSERT_EQ(4, attributes.numberOfReturns[1]);
+}
+
+TEST (VoxelAttributes, Aggregates)
+{
+    VoxelAttributes a;
+    a.add(1.0, 10, 1, 2);
+    a.add(2.0, 20, 2, 2);
+    a.add(3.0, 30, 1, 1);
+
+    ASSERT_EQ(3, a.count);
+    ASSERT_DOUBLE_EQ(20, a.meanIntensity());
+    ASSERT_DOUBLE_EQ(2, a.meanZ());
+    ASSERT_DOUBLE_EQ(1, a.zMin);
+    ASSERT_DOUBLE_EQ(3, a.zMax);
+    ASSERT_DOUBLE_EQ(1400, a.intensitySumSquares);
+    ASSERT_DOUBLE_EQ(2.0 / 3.0, a.firstReturnFraction());
+    ASSERT_DOUBLE_EQ(2.0 / 3.0, a.lastReturnFraction());
+}
+
+TEST (VoxelAttributes, MergeMatchesSinglePass)
+{
+    VoxelAttributes all, left, right;
+    for (int n = 0; n < 100; n++)
+    {
+        double z = std::sin(n) * 5;
+        float intensity = static_cast<float>(n % 17);
+        uint8_t r = n % 3 + 1;
+        all.add(z, intensity, r, 3);
+        if (n < 40)
+            left.add(z, intensity, r, 3);
+        else
+            right.add(z, intensity, r, 3);
+    }
+
+    left.merge(right);
+    ASSERT_EQ(all.count, left.count);
+    ASSERT_DOUBLE_EQ(all.intensitySum, left.intensitySum);
+    ASSERT_DOUBLE_EQ(all.zSumSquares, left.zSumSquares);
+    ASSERT_DOUBLE_EQ(all.zMin, left.zMin);
+    ASSERT_DOUBLE_EQ(all.zMax, left.zMax);
+    ASSERT_DOUBLE_EQ(all.intensityMax, left.intensityMax);
+    ASSERT_EQ(all.firstReturns, left.firstReturns);
+    ASSERT_EQ(all.lastReturns, left.lastReturns);
+}
+
+TEST (VoxelAttributes, Coarsen)
+{
+    std::unordered_map<VoxelAddress, VoxelAttributes> fine;
+    accumulateVoxelAttributes(fine, VoxelAddress(0, 0, 0), 0.05, 10, 1, 1);
+    accumulateVoxelAttributes(fine, VoxelAddress(1, 1, 1), 0.15, 30, 1, 2);
+    accumulateVoxelAttributes(fine, VoxelAddress(-1, 0, 0), 0.05, 50, 2, 2);
+
+    auto coarse = coarsenVoxelAttributes(fine, 2);
+    ASSERT_EQ(2, coarse.size());
+    ASSERT_EQ(2, coarse[VoxelAddress(0, 0, 0)].count);
+    ASSERT_DOUBLE_EQ(20, coarse[VoxelAddress(0, 0, 0)].meanIntensity());
+    ASSERT_EQ(1, coarse[VoxelAddress(-1, 0, 0)].lastReturns);
+}
+
+TEST (VoxelAttributes, TextRoundTrip)
+{
+    VoxelAttributes a;
+    a.add(101.123456789, 12.25, 1, 3);
+    a.add(99.5, 7, 3, 3);
+
+    std::stringstream stream;
+    stream << "1,2,3," << a;
+
+    std::vector<std::string> tokens;
+    std::string token;
+    while (std::getline(stream, token, ','))
+        tokens.push_back(token);
+
+    VoxelAttributes b = ParseVoxelAttributes(tokens, 3);
+    ASSERT_EQ(a.count, b.count);
+    ASSERT_DOUBLE_EQ(a.zSum, b.zSum);
+    ASSERT_DOUBLE_EQ(a.zMax, b.zMax);
+    ASSERT_DOUBLE_EQ(a.intensityMin, b.intensityMin);
+    ASSERT_EQ(a.firstReturns, b.firstReturns);
+    ASSERT_EQ(a.lastReturns, b.lastReturns);
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,118 @@
+#include <cstdio>
+#include <vector>
+#include <gtest/gtest.h>
+#include "voxelsorter.h"
+#include "canopyprofile.h"
+
+std::vector<SparseVoxel> buildColumns()
+{
+    // Column (0,0) has ground at k=0..1 and canopy at k=10, column (2,1) only
+    // has ground, and column (1,0) is empty
+    std::vector<SparseVoxel> voxels;
+    voxels.push_back({VoxelAddress(0, 0, 10), 4});
+    voxels.push_back({VoxelAddress(0, 0, 0), 5});
+    voxels.push_back({VoxelAddress(0, 0, 1), 1});
+    voxels.push_back({VoxelAddress(2, 1, 3), 7});
+    return voxels;
+}
+
+TEST (CanopyProducts, RasterBands)
+{
+    auto products = ComputeCanopyProducts(buildColumns(), 0.5, 1.0, 0, 2);
+    const CanopyRaster& raster = products.raster;
+
+    ASSERT_EQ(3, raster.width);
+    ASSERT_EQ(2, raster.height);
+    ASSERT_EQ(0, raster.i0);
+    ASSERT_EQ(0, raster.j0);
+
+    ASSERT_FLOAT_EQ(5.5, raster.top[raster.cell(0, 0)]);
+    ASSERT_FLOAT_EQ(5.5, raster.chm[raster.cell(0, 0)]);
+    ASSERT_FLOAT_EQ(0.6, raster.gapFraction[raster.cell(0, 0)]);
+
+    ASSERT_FLOAT_EQ(2.0, raster.top[raster.cell(2, 1)]);
+    ASSERT_FLOAT_EQ(0.5, raster.chm[raster.cell(2, 1)]);
+    ASSERT_FLOAT_EQ(1.0, raster.gapFraction[raster.cell(2, 1)]);
+
+    ASSERT_FLOAT_EQ(CANOPY_NODATA, raster.top[raster.cell(1, 0)]);
+}
+
+TEST (CanopyProducts, Profiles)
+{
+    auto products = ComputeCanopyProducts(buildColumns(), 0.5, 1.0, 0, 4);
+    ASSERT_EQ(2, products.profiles.size());
+
+    const ColumnProfile& p = products.profiles[0];
+    ASSERT_EQ(0, p.i);
+    ASSERT_EQ(0, p.j);
+    ASSERT_EQ(0, p.kMin);
+    ASSERT_EQ(11, p.counts.size());
+    ASSERT_EQ(5, p.counts[0]);
+    ASSERT_EQ(1, p.counts[1]);
+    ASSERT_EQ(0, p.counts[5]);
+    ASSERT_EQ(4, p.counts[10]);
+}
+
+TEST (CanopyProducts, ThreadCountDoesNotChangeResult)
+{
+    std::vector<SparseVoxel> voxels;
+    for (int n = 0; n < 2000; n++)
+        voxels.push_back({VoxelAddress(n % 23 - 11, n % 19 - 4, n % 31), (uint32_t)(n % 5 + 1)});
+
+    auto single = ComputeCanopyProducts(voxels, 0.25, 0.5, 1.0, 1);
+    auto many = ComputeCanopyProducts(voxels, 0.25, 0.5, 1.0, 7);
+    ASSERT_EQ(single.raster.top, many.raster.top);
+    ASSERT_EQ(single.raster.chm, many.raster.chm);
+    ASSERT_EQ(single.raster.gapFraction, many.raster.gapFraction);
+}
+
+TEST (CanopyProducts, HiddenGroundComesFromNeighbours)
+{
+    // Column (0,0) reaches the ground at k=0, the dense crown of column (1,0)
+    // stopped every return above k=6, and column (4,0) is out of reach
+    std::vector<SparseVoxel> voxels;
+    for (int k = 0; k <= 10; k++)
+        voxels.push_back({VoxelAddress(0, 0, k), 1});
+    for (int k = 6; k <= 10; k++)
+        voxels.push_back({VoxelAddress(1, 0, k), 3});
+    voxels.push_back({VoxelAddress(4, 0, 8), 2});
+    voxels.push_back({VoxelAddress(4, 0, 9), 2});
+
+    auto products = ComputeCanopyProducts(voxels, 0.5, 1.0, 1.0, 2);
+    const CanopyRaster& raster = products.raster;
+
+    ASSERT_FLOAT_EQ(5.5, raster.chm[raster.cell(0, 0)]);
+    ASSERT_FLOAT_EQ(5.5, raster.top[raster.cell(1, 0)]);
+    ASSERT_FLOAT_EQ(5.5, raster.chm[raster.cell(1, 0)]);
+    ASSERT_FLOAT_EQ(0.0, raster.gapFraction[raster.cell(1, 0)]);
+    ASSERT_FLOAT_EQ(1.0, raster.chm[raster.cell(4, 0)]);
+    ASSERT_FLOAT_EQ(1.0, raster.gapFraction[raster.cell(4, 0)]);
+
+    // The profile still starts at the lowest voxel of its own column
+    ASSERT_EQ(6, products.profiles[1].kMin);
+
+    // Without a neighbourhood the hidden column is measured from its crown
+    auto own = ComputeCanopyProducts(voxels, 0.5, 1.0, 0, 1);
+    ASSERT_FLOAT_EQ(2.5, own.raster.chm[own.raster.cell(1, 0)]);
+    ASSERT_FLOAT_EQ(0.4, own.raster.gapFraction[own.raster.cell(1, 0)]);
+}
+
+TEST (CanopyProducts, RasterFileRoundTrip)
+{
+    auto products = ComputeCanopyProducts(buildColumns(), 0.5, 1.0, 0, 1);
+    WriteCanopyRaster("test_canopy_raster.chm", products.raster);
+    auto loaded = ReadCanopyRaster("test_canopy_raster.chm");
+    std::remove("test_canopy_raster.chm");
+
+    ASSERT_EQ(products.raster.width, loaded.width);
+    ASSERT_EQ(products.raster.height, loaded.height);
+    ASSERT_DOUBLE_EQ(0.5, loaded.spacing);
+    ASSERT_EQ(products.raster.top, loaded.top);
+    ASSERT_EQ(products.raster.gapFraction, loaded.gapFraction);
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
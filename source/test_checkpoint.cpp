@@ -0,0 +1,99 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <gtest/gtest.h>
+#include "utilities.h"
+#include "checkpoint.h"
+
+void writeScratchFile(std::string fileName, size_t bytes)
+{
+    std::ofstream out(fileName.c_str(), std::ios::binary);
+    out << std::string(bytes, 'x');
+}
+
+ParallelConfiguration buildConfig()
+{
+    ParallelConfiguration config;
+    config.thinningDistance = 0.01;
+    config.voxelResolutions.push_back(0.1);
+    return config;
+}
+
+TEST (Checkpoint, RoundTrip)
+{
+    writeScratchFile("./test_ckpt_worker0.binary", 48);
+    writeScratchFile("./test_ckpt_worker1.binary", 0);
+
+    std::string fingerprint = CheckpointFingerprint(buildConfig(), 5, 3);
+    auto written = MakeCheckpoint(1, 2, fingerprint, {"./test_ckpt_worker0.binary", "./test_ckpt_worker1.binary"});
+    WriteCheckpoint("./", written);
+
+    auto loaded = LoadCheckpoint("./", fingerprint);
+    ASSERT_EQ(1, loaded.stage);
+    ASSERT_EQ(2, loaded.workers);
+    ASSERT_EQ(written.files, loaded.files);
+    ASSERT_EQ(48, loaded.sizes[0]);
+
+    RemoveCheckpoint("./");
+    ASSERT_EQ(0, LoadCheckpoint("./", fingerprint).stage);
+
+    std::remove("./test_ckpt_worker0.binary");
+    std::remove("./test_ckpt_worker1.binary");
+}
+
+TEST (Checkpoint, RejectsChangedSettings)
+{
+    writeScratchFile("./test_ckpt_worker0.binary", 24);
+    std::string fingerprint = CheckpointFingerprint(buildConfig(), 5, 3);
+    WriteCheckpoint("./", MakeCheckpoint(1, 1, fingerprint, {"./test_ckpt_worker0.binary"}));
+
+    auto config = buildConfig();
+    config.thinningDistance = 0.02;
+    ASSERT_EQ(0, LoadCheckpoint("./", CheckpointFingerprint(config, 5, 3)).stage);
+    ASSERT_EQ(0, LoadCheckpoint("./", CheckpointFingerprint(buildConfig(), 5, 5)).stage);
+    ASSERT_EQ(1, LoadCheckpoint("./", fingerprint).stage);
+
+    RemoveCheckpoint("./");
+    std::remove("./test_ckpt_worker0.binary");
+}
+
+TEST (Checkpoint, RejectsChangedFiles)
+{
+    writeScratchFile("./test_ckpt_worker0.binary", 24);
+    std::string fingerprint = CheckpointFingerprint(buildConfig(), 5, 3);
+    WriteCheckpoint("./", MakeCheckpoint(1, 1, fingerprint, {"./test_ckpt_worker0.binary"}));
+
+    // A truncated scratch file invalidates the checkpoint
+    writeScratchFile("./test_ckpt_worker0.binary", 16);
+    ASSERT_EQ(0, LoadCheckpoint("./", fingerprint).stage);
+
+    // And so does a missing one
+    std::remove("./test_ckpt_worker0.binary");
+    ASSERT_EQ(0, LoadCheckpoint("./", fingerprint).stage);
+
+    RemoveCheckpoint("./");
+}
+
+TEST (Checkpoint, FailedWriteThrows)
+{
+    writeScratchFile("./test_ckpt_worker0.binary", 24);
+    std::string fingerprint = CheckpointFingerprint(buildConfig(), 5, 3);
+
+    // Neither a scratch directory which does not exist nor a listed file
+    // which cannot be synced leaves a manifest behind
+    ASSERT_THROW(WriteCheckpoint("./missing_ckpt_directory/", MakeCheckpoint(1, 1, fingerprint, {"./test_ckpt_worker0.binary"})),
+                 std::runtime_error);
+    ASSERT_THROW(WriteCheckpoint("./", MakeCheckpoint(1, 1, fingerprint, {"./missing_ckpt_worker1.binary"})),
+                 std::runtime_error);
+    ASSERT_EQ(0, LoadCheckpoint("./", fingerprint).stage);
+
+    std::remove("./test_ckpt_worker0.binary");
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,141 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "inputsplit.h"
+
+TEST (InputSplit, RangesCoverEveryByteOnce)
+{
+    std::vector<std::pair<std::string, uint64_t>> sizes = {{"a", 10}, {"b", 0}, {"c", 25}, {"d", 7}};
+    auto shares = SplitInputRanges(sizes, 4);
+    ASSERT_EQ(4, shares.size());
+
+    // Ranges are contiguous through the files in order, and the shares are
+    // within a byte of each other
+    std::vector<InputRange> all;
+    for (const auto& share : shares)
+    {
+        uint64_t bytes = 0;
+        for (const auto& r : share)
+        {
+            bytes += r.end - r.begin;
+            all.push_back(r);
+        }
+        ASSERT_TRUE(bytes == 10 || bytes == 11);
+    }
+
+    ASSERT_EQ("a", all.front().fileName);
+    ASSERT_EQ(0, all.front().begin);
+    for (size_t i = 1; i < all.size(); i++)
+    {
+        if (all[i].fileName == all[i - 1].fileName)
+            ASSERT_EQ(all[i - 1].end, all[i].begin);
+        else
+            ASSERT_EQ(0, all[i].begin);
+    }
+    ASSERT_EQ("d", all.back().fileName);
+    ASSERT_EQ(7, all.back().end);
+}
+
+TEST (InputSplit, MoreSharesThanBytes)
+{
+    auto shares = SplitInputRanges({{"a", 2}}, 5);
+    size_t nonEmpty = 0;
+    for (const auto& share : shares)
+        nonEmpty += share.empty() ? 0 : 1;
+    ASSERT_EQ(2, nonEmpty);
+}
+
+TEST (InputSplit, EveryLineReadOnce)
+{
+    std::string fileName = "./test_inputsplit.asc";
+    std::vector<std::string> lines;
+    {
+        std::ofstream out(fileName.c_str(), std::ios::binary);
+        for (int i = 0; i < 200; i++)
+        {
+            lines.push_back(std::to_string(i * 0.37) + " " + std::to_string(i) + " " + std::string(i % 13, '1'));
+            out << lines.back() << "\n";
+        }
+    }
+
+    for (size_t parts : {1, 2, 3, 7, 50})
+    {
+        std::vector<std::string> read;
+        for (const auto& share : SplitInputFiles({fileName}, parts))
+            for (const auto& r : share)
+                ForEachLineInRange(r, [&read](const std::string& line) { read.push_back(line); });
+        ASSERT_EQ(lines, read);
+    }
+
+    std::remove(fileName.c_str());
+}
+
+TEST (InputSplit, EveryRecordReadOnce)
+{
+    std::string fileName = "./test_inputsplit.bin";
+    const size_t stride = 5;
+    const size_t records = 1001;
+    {
+        std::ofstream out(fileName.c_str(), std::ios::binary);
+        for (size_t i = 0; i < records; i++)
+        {
+            double record[stride] = {(double)i, 1, 2, 3, 4};
+            out.write(reinterpret_cast<char*>(record), sizeof(record));
+        }
+        // A partial record at the end is ignored
+        out.write("xyz", 3);
+    }
+
+    ASSERT_TRUE(IsBinaryInput(fileName));
+    ASSERT_TRUE(IsBinaryInput("worker0.binary"));
+    ASSERT_FALSE(IsBinaryInput("points.asc"));
+
+    for (size_t parts : {1, 2, 3, 7, 64})
+    {
+        std::vector<double> read;
+        for (const auto& share : SplitInputFiles({fileName}, parts, stride * sizeof(double)))
+        {
+            for (const auto& r : share)
+            {
+                ASSERT_EQ(0, r.begin % (stride * sizeof(double)));
+                ForEachRecordInRange(r, stride, [&read](const double* record) { read.push_back(record[0]); });
+            }
+        }
+        ASSERT_EQ(records, read.size());
+        for (size_t i = 0; i < records; i++)
+            ASSERT_EQ((double)i, read[i]);
+    }
+
+    std::remove(fileName.c_str());
+}
+
+TEST (InputSplit, ReaderCount)
+{
+    uint64_t large = (uint64_t)MIN_READER_BYTES * 1000;
+
+    ASSERT_EQ(2, ReaderCount(9, 0.25, large));
+    ASSERT_EQ(4, ReaderCount(9, 0.5, large));
+
+    // Always one Reader and one Worker
+    ASSERT_EQ(1, ReaderCount(3, 0.1, large));
+    ASSERT_EQ(7, ReaderCount(9, 0.95, large));
+
+    // Small inputs don't keep many Readers busy
+    ASSERT_EQ(1, ReaderCount(17, 0.5, 100));
+    ASSERT_EQ(3, ReaderCount(17, 0.5, (uint64_t)MIN_READER_BYTES * 3));
+}
+
+TEST (InputSplit, OptimalReaderShare)
+{
+    ASSERT_NEAR(0.5, OptimalReaderShare(1e-6, 1e-6), 1e-9);
+    ASSERT_NEAR(1.0 / 3.0, OptimalReaderShare(1e-6, 4e-6), 1e-9);
+    ASSERT_NEAR(0.25, OptimalReaderShare(0, 1e-6), 1e-9);
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
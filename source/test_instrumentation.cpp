@@ -0,0 +1,131 @@
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <gtest/gtest.h>
+#include "instrumentation.h"
+
+TEST (Instrumentation, PackRoundTrip)
+{
+    Instrumentation a;
+    a.addTime(Phase::parse, 1.5);
+    a.addPoints(Phase::parse, 1000);
+    a.addBytes(Phase::send, 4096);
+    a.recordHeld(1 << 20);
+    a.recordHeld(1 << 10);
+    a.memory.spilledRegions = 7;
+    a.readAhead.queueDepth = 4;
+    a.readAhead.uringBlocks = 12;
+    a.readAhead.stallSeconds = 0.25;
+
+    auto packed = a.pack();
+    ASSERT_EQ(3 * PHASE_COUNT + MEMORY_COUNTER_COUNT + READAHEAD_COUNTER_COUNT, packed.size());
+
+    auto b = Instrumentation::unpack(packed.data());
+    ASSERT_DOUBLE_EQ(1.5, b[Phase::parse].seconds);
+    ASSERT_EQ(1000, b[Phase::parse].points);
+    ASSERT_EQ(4096, b[Phase::send].bytes);
+    ASSERT_FALSE(b[Phase::write].active());
+    ASSERT_DOUBLE_EQ(1.5, b.timedSeconds());
+    ASSERT_EQ(1 << 20, b.memory.peakHeld);
+    ASSERT_EQ(7, b.memory.spilledRegions);
+    ASSERT_EQ(4, b.readAhead.queueDepth);
+    ASSERT_EQ(12, b.readAhead.blocks());
+    ASSERT_DOUBLE_EQ(0.25, b.readAhead.stallSeconds);
+}
+
+TEST (Instrumentation, NestedTimersDoNotOverlap)
+{
+    Instrumentation a;
+    {
+        ScopedTimer outer(a, Phase::parse);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        {
+            ScopedTimer inner(a, Phase::send);
+            std::this_thread::sleep_for(std::chrono::milliseconds(40));
+        }
+    }
+
+    ASSERT_GE(a[Phase::send].seconds, 0.04);
+    ASSERT_GE(a[Phase::parse].seconds, 0.02);
+    ASSERT_LT(a[Phase::parse].seconds, a[Phase::send].seconds);
+}
+
+TEST (Instrumentation, Summarize)
+{
+    auto odd = Summarize({3, 1, 2});
+    ASSERT_DOUBLE_EQ(1, odd.min);
+    ASSERT_DOUBLE_EQ(2, odd.median);
+    ASSERT_DOUBLE_EQ(3, odd.max);
+    ASSERT_DOUBLE_EQ(6, odd.total);
+
+    auto even = Summarize({4, 1, 2, 10});
+    ASSERT_DOUBLE_EQ(3, even.median);
+
+    auto empty = Summarize({});
+    ASSERT_DOUBLE_EQ(0, empty.max);
+}
+
+TEST (Instrumentation, ReportSkipsInactiveRanks)
+{
+    std::vector<Instrumentation> ranks(3);
+    ranks[1].addTime(Phase::thinning, 2.0);
+    ranks[1].addPoints(Phase::thinning, 100);
+    ranks[2].addTime(Phase::thinning, 4.0);
+    ranks[2].addPoints(Phase::thinning, 100);
+
+    auto report = RunReport(ranks, {"Director", "Worker 0", "Worker 1"});
+    ASSERT_EQ(3, report["processes"].asInt());
+
+    const Json::Value& thinning = report["phases"]["thinning"];
+    ASSERT_EQ(2, thinning["ranks"].asInt());
+    ASSERT_DOUBLE_EQ(2.0, thinning["seconds"]["min"].asDouble());
+    ASSERT_DOUBLE_EQ(3.0, thinning["seconds"]["median"].asDouble());
+    ASSERT_DOUBLE_EQ(4.0, thinning["seconds"]["max"].asDouble());
+    ASSERT_DOUBLE_EQ(25.0, thinning["points_per_second"]["min"].asDouble());
+    ASSERT_FALSE(report["phases"].isMember("parse"));
+
+    ranks[1].recordHeld(100);
+    ranks[2].recordHeld(300);
+    ranks[2].memory.spilledBytes = 50;
+    report = RunReport(ranks, {"Director", "Worker 0", "Worker 1"});
+    ASSERT_DOUBLE_EQ(100, report["memory"]["peak_held_bytes"]["min"].asDouble());
+    ASSERT_DOUBLE_EQ(50, report["memory"]["spilled_bytes"]["total"].asDouble());
+    ASSERT_EQ(300, report["ranks"][2]["memory"]["peak_held_bytes"].asUInt64());
+
+    ASSERT_EQ("Worker 1", report["ranks"][2]["role"].asString());
+    ASSERT_TRUE(report["ranks"][0]["phases"].empty());
+}
+
+TEST (Instrumentation, ReportNamesTheReadAheadBackend)
+{
+    std::vector<Instrumentation> ranks(3);
+    auto report = RunReport(ranks, {"Director", "Reader 0", "Reader 1"});
+    ASSERT_EQ("none", report["read_ahead"]["backend"].asString());
+
+    for (size_t r = 1; r < 3; r++)
+    {
+        ranks[r].readAhead.queueDepth = 4;
+        ranks[r].readAhead.bufferBytes = 1 << 22;
+        ranks[r].readAhead.uringBlocks = 10;
+        ranks[r].readAhead.stallSeconds = r;
+    }
+    report = RunReport(ranks, {"Director", "Reader 0", "Reader 1"});
+    ASSERT_EQ("io_uring", report["read_ahead"]["backend"].asString());
+    ASSERT_EQ(4, report["read_ahead"]["queue_depth"].asUInt64());
+    ASSERT_EQ(1 << 22, report["read_ahead"]["buffer_bytes"].asUInt64());
+    ASSERT_EQ(20, report["read_ahead"]["blocks"].asUInt64());
+    ASSERT_DOUBLE_EQ(1.5, report["read_ahead"]["stall_seconds"]["median"].asDouble());
+    ASSERT_FALSE(report["ranks"][0].isMember("read_ahead"));
+
+    // A Reader which io_uring was refused to read with the thread
+    ranks[2].readAhead.threadBlocks = ranks[2].readAhead.uringBlocks;
+    ranks[2].readAhead.uringBlocks = 0;
+    report = RunReport(ranks, {"Director", "Reader 0", "Reader 1"});
+    ASSERT_EQ("mixed", report["read_ahead"]["backend"].asString());
+    ASSERT_EQ(10, report["ranks"][2]["read_ahead"]["thread_blocks"].asUInt64());
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <gtest/gtest.h>
+#include "morton.h"
+
+TEST (Morton, InterleavesBits)
+{
+    ASSERT_EQ(0, MortonInterleave(0, 0, 0));
+    ASSERT_EQ(1, MortonInterleave(1, 0, 0));
+    ASSERT_EQ(2, MortonInterleave(0, 1, 0));
+    ASSERT_EQ(4, MortonInterleave(0, 0, 1));
+    ASSERT_EQ(0x38, MortonInterleave(2, 2, 2));
+    ASSERT_EQ(0x7fffffffffffffffULL, MortonInterleave(0x1fffff, 0x1fffff, 0x1fffff));
+
+    uint64_t i, j, k;
+    MortonDeinterleave(MortonInterleave(123456, 7, 2097151), i, j, k);
+    ASSERT_EQ(123456, i);
+    ASSERT_EQ(7, j);
+    ASSERT_EQ(2097151, k);
+}
+
+TEST (Morton, RadixSortIsStable)
+{
+    // Enough keys for several threads, with many duplicates so that the
+    // stability of the sort shows in the values
+    std::mt19937_64 rng(9);
+    for (size_t threads : {1, 4})
+    {
+        std::vector<uint64_t> keys(200000);
+        std::vector<uint32_t> values(keys.size());
+        for (size_t n = 0; n < keys.size(); n++)
+        {
+            keys[n] = rng() % 5000 << (n % 2 ? 40 : 3);
+            values[n] = (uint32_t)n;
+        }
+
+        std::vector<std::pair<uint64_t, uint32_t>> expected;
+        for (size_t n = 0; n < keys.size(); n++)
+            expected.push_back(std::make_pair(keys[n], values[n]));
+        std::stable_sort(expected.begin(), expected.end(),
+                         [](const std::pair<uint64_t, uint32_t>& a, const std::pair<uint64_t, uint32_t>& b) { return a.first < b.first; });
+
+        RadixSortByKey(keys, values, threads);
+        for (size_t n = 0; n < keys.size(); n++)
+        {
+            ASSERT_EQ(expected[n].first, keys[n]);
+            ASSERT_EQ(expected[n].second, values[n]);
+        }
+    }
+}
+
+TEST (Morton, OrdersPointsAlongTheCurve)
+{
+    // Corners of a cube listed backwards come out in Z order
+    std::vector<Vector3d> points;
+    for (int n = 7; n >= 0; n--)
+        points.push_back(Vector3d(n & 1, n >> 1 & 1, n >> 2 & 1));
+
+    MortonOrder morton;
+    auto order = morton.sort(points, 1);
+    ASSERT_EQ(8, order.size());
+    for (size_t n = 0; n < 8; n++)
+        ASSERT_EQ(7 - n, order[n]);
+
+    ASSERT_TRUE(morton.sort(std::vector<Vector3d>(), 1).empty());
+    ASSERT_EQ(3, morton.sort(std::vector<Vector3d>(3, Vector3d(1, 2, 3)), 1).size());
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,71 @@
+#include <vector>
+#include <gtest/gtest.h>
+#include "parallelkdtree.h"
+#include "pointcloud.h"
+#include "synthetic.h"
+
+// Exposes the index permutation, which fixes the splits of the tree
+class InspectedKDTree : public ParallelKDTree<PointCloud>
+{
+public:
+    InspectedKDTree(const PointCloud& cloud) : ParallelKDTree<PointCloud>(cloud, 10) {}
+    const std::vector<size_t>& permutation() const { return vind; }
+};
+
+TEST (ParallelKDTree, SameTreeAsSerialBuild)
+{
+    // Enough points for the top levels to be split over threads, with a
+    // stack of duplicates so that some splits fall on equal coordinates
+    auto points = GenerateUniformCloud(300000, 10000, 21);
+    for (size_t i = 0; i < 1000; i++)
+        points.push_back(Vector3d(1, 1, 1));
+    PointCloud cloud{std::move(points)};
+
+    InspectedKDTree serial(cloud);
+    serial.buildIndex();
+
+    for (size_t threads : {1, 3, 8})
+    {
+        InspectedKDTree parallel(cloud);
+        parallel.buildIndex(threads);
+        ASSERT_TRUE(serial.permutation() == parallel.permutation());
+
+        for (size_t i = 0; i < cloud.pts.size(); i += 997)
+        {
+            double query[3] = {cloud.pts[i].x, cloud.pts[i].y, cloud.pts[i].z};
+            size_t a[4], b[4];
+            double da[4], db[4];
+            serial.knnSearch(query, 4, a, da);
+            parallel.knnSearch(query, 4, b, db);
+            for (int k = 0; k < 4; k++)
+            {
+                ASSERT_EQ(a[k], b[k]);
+                ASSERT_EQ(da[k], db[k]);
+            }
+        }
+    }
+}
+
+TEST (ParallelKDTree, RebuildsAndHandlesEmptyClouds)
+{
+    PointCloud cloud;
+    InspectedKDTree index(cloud);
+    index.buildIndex(4);
+    ASSERT_EQ(0, index.size());
+
+    cloud.pts = GenerateUniformCloud(100, 1000, 2);
+    index.buildIndex(4);
+    ASSERT_EQ(100, index.size());
+
+    double query[3] = {cloud.pts[5].x, cloud.pts[5].y, cloud.pts[5].z};
+    size_t nearest;
+    double distance;
+    index.knnSearch(query, 1, &nearest, &distance);
+    ASSERT_EQ(5, nearest);
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
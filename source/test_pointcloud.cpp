@@ -164,6 +164,39 @@ TEST (PointCloud, Thinning)
 
 }
 
+TEST (PointCloud, RemoveKeepsAttributesAligned)
+{
+    auto cloud = buildCloud();
+    for (size_t i = 0; i < cloud.size(); i++)
+        cloud.attributes.push_back(cloud.pts[i].x + 2 * cloud.pts[i].y + 3 * cloud.pts[i].z, 1, 1);
+
+    std::set<size_t> remove = {1, 2, 9};
+    cloud.RemoveAtIndicies(remove);
+
+    ASSERT_EQ(7, cloud.size());
+    ASSERT_EQ(7, cloud.attributes.size());
+    for (size_t i = 0; i < cloud.size(); i++)
+        ASSERT_FLOAT_EQ(cloud.pts[i].x + 2 * cloud.pts[i].y + 3 * cloud.pts[i].z, cloud.attributes.intensity[i]);
+}
+
+TEST (PointCloud, RemoveMarkedKeepsOrder)
+{
+    PointAttributes attributes;
+    for (int i = 0; i < 5; i++)
+        attributes.push_back(i, 1, 1);
+    PointCloud cloud({Vector3d(0, 0, 0), Vector3d(1, 0, 0), Vector3d(2, 0, 0), Vector3d(3, 0, 0), Vector3d(4, 0, 0)},
+                     std::move(attributes));
+
+    cloud.RemoveMarked({1, 0, 1, 0, 0});
+    ASSERT_EQ(3, cloud.size());
+    ASSERT_EQ(3, cloud.attributes.size());
+    ASSERT_DOUBLE_EQ(1, cloud.pts[0].x);
+    ASSERT_DOUBLE_EQ(3, cloud.pts[1].x);
+    ASSERT_DOUBLE_EQ(4, cloud.pts[2].x);
+    ASSERT_FLOAT_EQ(1, cloud.attributes.intensity[0]);
+    ASSERT_FLOAT_EQ(4, cloud.attributes.intensity[2]);
+}
+
 int main(int argc, char **argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
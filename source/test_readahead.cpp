@@ -0,0 +1,185 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "readahead.h"
+#include "inputsplit.h"
+
+static ReadAheadSettings smallBlocks(size_t blockBytes, size_t depth, bool useUring)
+{
+    ReadAheadSettings settings;
+    settings.blockBytes = blockBytes;
+    settings.depth = depth;
+    settings.useUring = useUring;
+    return settings;
+}
+
+TEST (ReadAhead, BlocksAreHandedOverInOrder)
+{
+    std::string fileName = "./test_readahead.dat";
+    std::string contents;
+    for (int i = 0; i < 5000; i++)
+        contents += (char)('a' + i % 26);
+    std::ofstream(fileName.c_str(), std::ios::binary) << contents;
+
+    for (bool useUring : {true, false})
+    {
+        for (size_t depth : {1, 3, 8})
+        {
+            ReadAhead input(fileName, 100, 4321, smallBlocks(256, depth, useUring));
+            ASSERT_TRUE(input.isOpen());
+            if (!useUring)
+            {
+                ASSERT_STREQ("thread", input.backend());
+            }
+
+            std::string read;
+            const char* data;
+            size_t size;
+            while (input.next(data, size))
+            {
+                ASSERT_LE(size, 256);
+                read.append(data, size);
+            }
+            ASSERT_EQ(contents.substr(100, 4221), read);
+            ASSERT_FALSE(input.next(data, size));
+
+            ReadAheadTotals totals;
+            input.addTo(totals);
+            ASSERT_EQ((4221 + 255) / 256, totals.uringBlocks + totals.threadBlocks);
+        }
+    }
+
+    // A range running past the end of the file stops at the end
+    ReadAhead past(fileName, 4900, 9000, smallBlocks(64, 4, true));
+    std::string tail;
+    const char* data;
+    size_t size;
+    while (past.next(data, size))
+        tail.append(data, size);
+    ASSERT_EQ(contents.substr(4900), tail);
+
+    ASSERT_FALSE(ReadAhead("./missing_readahead.dat", 0, 10).isOpen());
+    std::remove(fileName.c_str());
+}
+
+TEST (ReadAhead, RefusedSubmissionFallsBackToSynchronousReads)
+{
+    std::string fileName = "./test_readahead_refused.dat";
+    std::string contents;
+    for (int i = 0; i < 7000; i++)
+        contents += (char)('a' + i * 7 % 26);
+    std::ofstream(fileName.c_str(), std::ios::binary) << contents;
+
+    // The first submission refused gives the range to the thread, one refused
+    // while the ring is being filled or in the middle of the range leaves the
+    // reads already queued to complete and the rest to be read synchronously
+    for (size_t failSubmission : {0, 1, 2, 4, 11})
+    {
+        ReadAheadSettings settings = smallBlocks(256, 3, true);
+        settings.failSubmission = failSubmission;
+        ReadAhead input(fileName, 50, 7000, settings);
+        ASSERT_TRUE(input.isOpen());
+
+        std::string read;
+        const char* data;
+        size_t size;
+        while (input.next(data, size))
+            read.append(data, size);
+        ASSERT_EQ(contents.substr(50), read);
+    }
+
+    std::remove(fileName.c_str());
+}
+
+TEST (ReadAhead, LinesMatchTheStreamingReader)
+{
+    std::string fileName = "./test_readahead.asc";
+    {
+        std::ofstream out(fileName.c_str(), std::ios::binary);
+        for (int i = 0; i < 300; i++)
+            out << i * 0.37 << " " << i << " " << std::string(i % 17, '1') << (i % 41 == 0 ? "\n\n" : "\n");
+        // The last line has no newline
+        out << "1 2 3";
+    }
+
+    for (bool useUring : {true, false})
+    {
+        for (size_t blockBytes : {1, 7, 64, 1 << 20})
+        {
+            for (size_t parts : {1, 2, 3, 7, 50})
+            {
+                std::vector<std::string> expected, read;
+                ReadAheadTotals totals;
+                for (const auto& share : SplitInputFiles({fileName}, parts))
+                {
+                    for (const auto& r : share)
+                    {
+                        ForEachLineInRange(r, [&expected](const std::string& line) { expected.push_back(line); });
+                        ForEachLineReadAhead(r, smallBlocks(blockBytes, 4, useUring), totals,
+                                             [&read](const std::string& line) { read.push_back(line); });
+                    }
+                }
+                ASSERT_EQ(expected, read);
+                ASSERT_EQ("1 2 3", read.back());
+            }
+        }
+    }
+
+    std::remove(fileName.c_str());
+}
+
+TEST (ReadAhead, RecordsMatchTheStreamingReader)
+{
+    std::string fileName = "./test_readahead.bin";
+    const size_t stride = 5;
+    const size_t records = 1001;
+    {
+        std::ofstream out(fileName.c_str(), std::ios::binary);
+        for (size_t i = 0; i < records; i++)
+        {
+            double record[stride] = {(double)i, 1, 2, 3, (double)(i * 7)};
+            out.write(reinterpret_cast<char*>(record), sizeof(record));
+        }
+        out.write("xyz", 3);
+    }
+
+    // Blocks smaller than a record and blocks which are not a multiple of
+    // one are both rounded to whole records
+    for (bool useUring : {true, false})
+    {
+        for (size_t blockBytes : {8, 100, 4096})
+        {
+            for (size_t parts : {1, 3, 64})
+            {
+                std::vector<double> read;
+                ReadAheadTotals totals;
+                for (const auto& share : SplitInputFiles({fileName}, parts, stride * sizeof(double)))
+                    for (const auto& r : share)
+                        ForEachRecordReadAhead(r, stride, smallBlocks(blockBytes, 3, useUring), totals,
+                                               [&read](const double* record)
+                        {
+                            ASSERT_EQ(record[0] * 7, record[4]);
+                            read.push_back(record[0]);
+                        });
+                ASSERT_EQ(records, read.size());
+                for (size_t i = 0; i < records; i++)
+                    ASSERT_EQ((double)i, read[i]);
+                if (!useUring)
+                {
+                    ASSERT_EQ(0, totals.uringBlocks);
+                }
+            }
+        }
+    }
+
+    std::remove(fileName.c_str());
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
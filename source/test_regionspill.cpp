@@ -0,0 +1,79 @@
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include <gtest/gtest.h>
+#include "regionspill.h"
+
+PointCloud buildRegion(size_t first, size_t count, bool withAttributes)
+{
+    PointCloud cloud;
+    for (size_t n = first; n < first + count; n++)
+    {
+        cloud.pts.push_back(Vector3d(n, n * 2.0, n * 3.0));
+        if (withAttributes)
+            cloud.attributes.push_back(n * 0.5f, n % 3 + 1, 3);
+    }
+    return cloud;
+}
+
+TEST (RegionSpill, ReloadKeepsReceiveOrder)
+{
+    VoxelAddress a(1, 2, 3);
+    VoxelAddress b(4, 5, 6);
+    RegionSpill spill("./test_regionspill.spill", 5);
+
+    // Region a is spilled twice as points arrive, with points still held
+    // after the last spill
+    PointCloud cloudA = buildRegion(0, 10, true);
+    PointCloud cloudB = buildRegion(100, 4, true);
+    spill.spill(a, cloudA);
+    spill.spill(b, cloudB);
+    ASSERT_EQ(0, cloudA.size());
+    ASSERT_EQ(0, cloudA.memoryFootprint());
+
+    PointCloud more = buildRegion(10, 5, true);
+    cloudA.pts = more.pts;
+    cloudA.attributes = more.attributes;
+    spill.spill(a, cloudA);
+    cloudA = buildRegion(15, 3, true);
+
+    ASSERT_TRUE(spill.holds(a));
+    ASSERT_EQ(15, spill.points(a));
+    ASSERT_EQ((10 + 4 + 5) * 5 * sizeof(double), spill.bytesWritten());
+
+    spill.reload(a, cloudA);
+    ASSERT_FALSE(spill.holds(a));
+    ASSERT_EQ(0, spill.points(a));
+
+    PointCloud expected = buildRegion(0, 18, true);
+    ASSERT_EQ(expected.size(), cloudA.size());
+    for (size_t n = 0; n < expected.size(); n++)
+    {
+        ASSERT_EQ(expected.pts[n], cloudA.pts[n]);
+        ASSERT_FLOAT_EQ(expected.attributes.intensity[n], cloudA.attributes.intensity[n]);
+        ASSERT_EQ(expected.attributes.returnNumber[n], cloudA.attributes.returnNumber[n]);
+        ASSERT_EQ(expected.attributes.numberOfReturns[n], cloudA.attributes.numberOfReturns[n]);
+    }
+
+    // The other region is untouched
+    ASSERT_EQ(4, spill.points(b));
+    spill.reload(b, cloudB);
+    ASSERT_EQ(Vector3d(103, 206, 309), cloudB.pts.back());
+}
+
+TEST (RegionSpill, RemovesFile)
+{
+    {
+        RegionSpill spill("./test_regionspill.spill", 3);
+        PointCloud cloud = buildRegion(0, 3, false);
+        spill.spill(VoxelAddress(0, 0, 0), cloud);
+        ASSERT_TRUE(std::ifstream("./test_regionspill.spill").good());
+    }
+    ASSERT_FALSE(std::ifstream("./test_regionspill.spill").good());
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,99 @@
+#include <vector>
+#include <gtest/gtest.h>
+#include "spacing.h"
+#include "pointcloud.h"
+#include "synthetic.h"
+
+// A grid of points one unit apart, with the first point repeated
+static PointCloud gridWithDuplicate(int edge)
+{
+    std::vector<Vector3d> points;
+    for (int i = 0; i < edge; i++)
+        for (int j = 0; j < edge; j++)
+            for (int k = 0; k < edge; k++)
+                points.push_back(Vector3d(i, j, k));
+    points.push_back(points.front());
+    return PointCloud(std::move(points));
+}
+
+TEST (Spacing, GridSpacingIgnoresDuplicates)
+{
+    PointCloud cloud = gridWithDuplicate(10);
+    SpacingKDTree index(cloud, 10);
+    index.buildIndex(1);
+
+    SpacingOptions options;
+    options.threads = 1;
+    auto stats = MeasureSpacing(cloud, index, options);
+
+    // Both copies of the repeated point are duplicates, and every point
+    // still finds its grid neighbour one unit away
+    ASSERT_EQ(cloud.pts.size(), stats.queries);
+    ASSERT_EQ(2, stats.duplicates);
+    ASSERT_EQ(cloud.pts.size(), stats.measured);
+    ASSERT_DOUBLE_EQ(1.0, stats.minimum);
+    ASSERT_DOUBLE_EQ(1.0, stats.p1);
+    ASSERT_DOUBLE_EQ(1.0, stats.median);
+
+    size_t counted = stats.overflow;
+    for (size_t c : stats.histogram)
+        counted += c;
+    ASSERT_EQ(stats.measured, counted);
+    ASSERT_EQ(stats.measured, stats.histogram.back());
+}
+
+TEST (Spacing, ThreadsGiveTheSameStatistics)
+{
+    PointCloud cloud(GenerateUniformCloud(20000, 20000, 5));
+    SpacingKDTree index(cloud, 10);
+    index.buildIndex(1);
+
+    SpacingOptions options;
+    options.threads = 1;
+    auto serial = MeasureSpacing(cloud, index, options);
+    options.threads = 4;
+    auto threaded = MeasureSpacing(cloud, index, options);
+
+    ASSERT_EQ(serial.measured, threaded.measured);
+    ASSERT_EQ(serial.minimum, threaded.minimum);
+    ASSERT_EQ(serial.p5, threaded.p5);
+    ASSERT_EQ(serial.median, threaded.median);
+    ASSERT_EQ(serial.histogram, threaded.histogram);
+    ASSERT_LE(serial.minimum, serial.p1);
+    ASSERT_LE(serial.p1, serial.p5);
+    ASSERT_LE(serial.p5, serial.median);
+}
+
+TEST (Spacing, SamplesQueryEvenlySpacedPoints)
+{
+    auto indices = SpacingSampleIndices(10, 4);
+    ASSERT_EQ(std::vector<size_t>({0, 2, 5, 7}), indices);
+    ASSERT_EQ(10, SpacingSampleIndices(10, 0).size());
+    ASSERT_EQ(10, SpacingSampleIndices(10, 50).size());
+
+    // A sampled estimate queries only the sample, against the whole cloud
+    PointCloud cloud = gridWithDuplicate(8);
+    SpacingKDTree index(cloud, 10);
+    index.buildIndex(2);
+    SpacingOptions options;
+    options.samples = 100;
+    auto stats = MeasureSpacing(cloud, index, options);
+    ASSERT_EQ(100, stats.queries);
+    ASSERT_DOUBLE_EQ(1.0, stats.median);
+}
+
+TEST (Spacing, PercentilesOfSortedDistances)
+{
+    std::vector<double> sorted;
+    for (int i = 1; i <= 101; i++)
+        sorted.push_back(i);
+    ASSERT_DOUBLE_EQ(2.0, SpacingPercentile(sorted, 0.01));
+    ASSERT_DOUBLE_EQ(51.0, SpacingPercentile(sorted, 0.5));
+    ASSERT_DOUBLE_EQ(0.0, SpacingPercentile(std::vector<double>(), 0.5));
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
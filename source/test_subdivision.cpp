@@ -0,0 +1,81 @@
+#include <vector>
+#include <gtest/gtest.h>
+#include "subdivision.h"
+#include "thinning.h"
+#include "pointcloud.h"
+#include "synthetic.h"
+
+// Returns true if no two points of the cloud are within the distance
+static bool noClosePairs(const PointCloud& cloud, double distance)
+{
+    for (size_t a = 0; a < cloud.pts.size(); a++)
+        for (size_t b = a + 1; b < cloud.pts.size(); b++)
+            if (cloud.pts[a].DistanceTo(cloud.pts[b]) < distance)
+                return false;
+    return true;
+}
+
+TEST (Subdivision, WithinBudgetMatchesThinPointCloud)
+{
+    auto points = GenerateUniformCloud(3000, 20000, 21);
+    PointCloud expected{std::vector<Vector3d>(points)};
+    PointCloud cloud{std::vector<Vector3d>(points)};
+    ThinPointCloud(expected, 0.05);
+
+    ThinningContext context;
+    ASSERT_EQ(1, ThinSubdivided(context, cloud, 0.05, 3000));
+    ASSERT_EQ(expected.pts.size(), cloud.pts.size());
+    for (size_t i = 0; i < cloud.pts.size(); i++)
+        ASSERT_TRUE(expected.pts[i] == cloud.pts[i]);
+}
+
+TEST (Subdivision, OverfullRegionLeavesNoClosePairs)
+{
+    auto points = GenerateUniformCloud(4000, 20000, 22);
+    PointCloud whole{std::vector<Vector3d>(points)};
+    PointCloud cloud{std::vector<Vector3d>(points)};
+    ThinPointCloud(whole, 0.05);
+    ASSERT_LT(whole.pts.size(), points.size());
+
+    ThinningContext context;
+    size_t parts = ThinSubdivided(context, cloud, 0.05, 500);
+    ASSERT_GT(parts, 8);
+    ASSERT_TRUE(noClosePairs(cloud, 0.05));
+
+    // Only the choice within close pairs across the parts can differ, so
+    // about as many points are kept as when thinning the region whole
+    ASSERT_NEAR((double)whole.pts.size(), (double)cloud.pts.size(), whole.pts.size() * 0.05);
+
+    // The kept points are still in their original order
+    size_t next = 0;
+    for (const auto& p : cloud.pts)
+    {
+        while (next < points.size() && !(points[next] == p))
+            next++;
+        ASSERT_LT(next, points.size());
+    }
+}
+
+TEST (Subdivision, CoalescedRegionsAreEachThinned)
+{
+    // Two copies of the same small region thinned together leave only the
+    // points of the first
+    auto points = GenerateUniformCloud(300, 20000, 23);
+    PointCloud first{std::vector<Vector3d>(points)};
+    PointCloud second{std::vector<Vector3d>(points)};
+    PointCloud alone{std::vector<Vector3d>(points)};
+    ThinPointCloud(alone, 0.05);
+
+    ThinningContext context;
+    ThinCoalesced(context, {&first, &second}, 0.05);
+    ASSERT_EQ(alone.pts.size(), first.pts.size());
+    for (size_t i = 0; i < first.pts.size(); i++)
+        ASSERT_TRUE(alone.pts[i] == first.pts[i]);
+    ASSERT_EQ(0, second.pts.size());
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,105 @@
+#include <vector>
+#include <cmath>
+#include <gtest/gtest.h>
+#include "synthetic.h"
+
+TEST (Synthetic, Reproducible)
+{
+    auto a = GenerateUniformCloud(1000, 500, 42);
+    auto b = GenerateUniformCloud(1000, 500, 42);
+    auto c = GenerateUniformCloud(1000, 500, 43);
+
+    ASSERT_EQ(1000, a.size());
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        ASSERT_EQ(a[i].x, b[i].x);
+        ASSERT_EQ(a[i].y, b[i].y);
+        ASSERT_EQ(a[i].z, b[i].z);
+    }
+    ASSERT_NE(a[0].x, c[0].x);
+}
+
+TEST (Synthetic, FillsCubeOfDensity)
+{
+    auto points = GenerateUniformCloud(8000, 1000, 7);
+    double side = std::cbrt(8.0);
+    for (const auto& p : points)
+    {
+        ASSERT_GE(p.x, 0);
+        ASSERT_LT(p.x, side);
+        ASSERT_GE(p.z, 0);
+        ASSERT_LT(p.z, side);
+    }
+}
+
+TEST (Synthetic, UniformRange)
+{
+    SyntheticRandom random(1);
+    double sum = 0;
+    for (int i = 0; i < 10000; i++)
+    {
+        double u = random.uniform();
+        ASSERT_GE(u, 0);
+        ASSERT_LT(u, 1);
+        sum += u;
+    }
+    ASSERT_NEAR(0.5, sum / 10000, 0.02);
+}
+
+TEST (Synthetic, CanopyChunksAreIndependent)
+{
+    SyntheticCanopySettings settings;
+    settings.points = 2500;
+    settings.chunkSize = 1000;
+    settings.stations = 3;
+    settings.duplicateFraction = 0.5;
+
+    SyntheticCanopy a(settings);
+    SyntheticCanopy b(settings);
+    ASSERT_EQ(3, a.numberOfChunks());
+    ASSERT_EQ(2, a.stationOfChunk(2));
+
+    std::vector<SyntheticPoint> first, again, last;
+    a.generateChunk(1, first);
+    b.generateChunk(1, again);
+    a.generateChunk(2, last);
+
+    ASSERT_EQ(1000, first.size());
+    ASSERT_EQ(500, last.size());
+    for (size_t i = 0; i < first.size(); i++)
+        ASSERT_TRUE(first[i].position == again[i].position);
+}
+
+TEST (Synthetic, CanopyHasDuplicatesAndStructure)
+{
+    SyntheticCanopySettings settings;
+    settings.points = 20000;
+    settings.duplicateFraction = 0.25;
+    SyntheticCanopy canopy(settings);
+
+    std::vector<SyntheticPoint> points;
+    canopy.generateChunk(0, points);
+
+    size_t duplicates = 0;
+    size_t aboveGround = 0;
+    for (size_t i = 1; i < points.size(); i++)
+    {
+        const Vector3d& p = points[i].position;
+        if (p.DistanceTo(points[i - 1].position) < settings.duplicateJitter * 2)
+            duplicates++;
+        if (p.z > canopy.ground(p.x, p.y) + 2)
+            aboveGround++;
+        ASSERT_TRUE(points[i].returnNumber >= 1 && points[i].returnNumber <= points[i].numberOfReturns);
+    }
+
+    // Roughly a fifth of the points follow a duplicate source point
+    ASSERT_GT(duplicates, points.size() / 8);
+    ASSERT_LT(duplicates, points.size() / 4);
+    ASSERT_GT(aboveGround, points.size() / 3);
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,226 @@
+#include <vector>
+#include <algorithm>
+#include <gtest/gtest.h>
+#include "thinning.h"
+#include "synthetic.h"
+
+TEST (Thinning, MatchesNaiveThinning)
+{
+    auto points = GenerateUniformCloud(2000, 20000, 11);
+
+    std::vector<Vector3d> naive(points);
+    naiveThinning(naive, 0.05);
+
+    PointCloud cloud{std::vector<Vector3d>(points)};
+    ThinPointCloud(cloud, 0.05);
+
+    // RemoveAtIndicies doesn't preserve the order of the points
+    auto byPosition = [](const Vector3d& a, const Vector3d& b)
+    {
+        if (a.x != b.x) return a.x < b.x;
+        if (a.y != b.y) return a.y < b.y;
+        return a.z < b.z;
+    };
+    std::sort(naive.begin(), naive.end(), byPosition);
+    std::sort(cloud.pts.begin(), cloud.pts.end(), byPosition);
+
+    ASSERT_LT(naive.size(), points.size());
+    ASSERT_EQ(naive.size(), cloud.pts.size());
+    for (size_t i = 0; i < naive.size(); i++)
+        ASSERT_TRUE(naive[i] == cloud.pts[i]);
+}
+
+TEST (Thinning, KeepsAttributesAligned)
+{
+    std::vector<Vector3d> points = {Vector3d(0, 0, 0), Vector3d(0.01, 0, 0), Vector3d(1, 0, 0)};
+    PointAttributes attributes;
+    attributes.push_back(1, 1, 1);
+    attributes.push_back(2, 1, 1);
+    attributes.push_back(3, 1, 1);
+
+    PointCloud cloud(std::move(points), std::move(attributes));
+    ThinPointCloud(cloud, 0.1);
+
+    ASSERT_EQ(2, cloud.pts.size());
+    ASSERT_FLOAT_EQ(1, cloud.attributes.intensity[0]);
+    ASSERT_FLOAT_EQ(3, cloud.attributes.intensity[1]);
+}
+
+TEST (Thinning, KeepsInputOrder)
+{
+    // The mask marks the same points as the removal set, and the kept points
+    // come out in their input order
+    auto points = GenerateUniformCloud(4000, 50000, 5);
+    PointCloud cloud{std::vector<Vector3d>(points)};
+    PointCloudKDTree index(3, cloud, nanoflann::KDTreeSingleIndexAdaptorParams(THINNING_LEAF_SIZE));
+    index.buildIndex();
+
+    std::vector<char> removed;
+    MarkRedundantPoints(cloud, index, 0.05, removed);
+    auto removeIndicies = FindRedundantPoints(cloud, index, 0.05);
+    ASSERT_FALSE(removeIndicies.empty());
+    for (size_t i = 0; i < points.size(); i++)
+        ASSERT_EQ(removeIndicies.count(i) == 1, removed[i] != 0);
+
+    ThinPointCloud(cloud, 0.05);
+    std::vector<Vector3d> expected;
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        if (!removed[i])
+            expected.push_back(points[i]);
+    }
+    ASSERT_EQ(expected.size(), cloud.pts.size());
+    for (size_t i = 0; i < expected.size(); i++)
+        ASSERT_TRUE(expected[i] == cloud.pts[i]);
+}
+
+TEST (Thinning, ContextReusedAcrossRegions)
+{
+    // A context thinning regions of different sizes in turn, including an
+    // empty one, removes the same points as a fresh index for each region
+    ThinningContext context;
+    for (size_t n : {3000, 200, 0, 5000, 17})
+    {
+        auto points = GenerateUniformCloud(n, 20000, n + 1);
+        PointCloud reused{std::vector<Vector3d>(points)};
+        PointCloud fresh{std::vector<Vector3d>(points)};
+
+        context.thin(reused, 0.05);
+        PointCloudKDTree index(3, fresh, nanoflann::KDTreeSingleIndexAdaptorParams(THINNING_LEAF_SIZE));
+        index.buildIndex();
+        std::vector<char> removed;
+        MarkRedundantPoints(fresh, index, 0.05, removed);
+        fresh.RemoveMarked(removed);
+
+        ASSERT_EQ(fresh.pts.size(), reused.pts.size());
+        for (size_t i = 0; i < fresh.pts.size(); i++)
+            ASSERT_TRUE(fresh.pts[i] == reused.pts[i]);
+    }
+}
+
+TEST (Thinning, MortonOrderKeepsTheSamePoints)
+{
+    // The tree is built over the sorted points but the result is in the
+    // original order, exactly as without sorting
+    ThinningContext plain;
+    ThinningContext sorted(true);
+    for (size_t n : {6000, 1, 0, 2500})
+    {
+        auto points = GenerateUniformCloud(n, 50000, n + 7);
+        PointCloud a{std::vector<Vector3d>(points)};
+        PointCloud b{std::vector<Vector3d>(points)};
+        plain.thin(a, 0.05);
+        sorted.thin(b, 0.05);
+
+        ASSERT_EQ(a.pts.size(), b.pts.size());
+        for (size_t i = 0; i < a.pts.size(); i++)
+            ASSERT_TRUE(a.pts[i] == b.pts[i]);
+    }
+}
+
+TEST (Thinning, LeafSizeKeepsTheSamePoints)
+{
+    // Every candidate leaf size gives a different tree but the same result
+    auto points = GenerateUniformCloud(4000, 20000, 11);
+    PointCloud expected{std::vector<Vector3d>(points)};
+    ThinPointCloud(expected, 0.05);
+
+    ThinningContext context;
+    for (size_t leafSize : LEAF_SIZE_CANDIDATES)
+    {
+        PointCloud cloud{std::vector<Vector3d>(points)};
+        context.setLeafSize(leafSize);
+        context.thin(cloud, 0.05);
+
+        ASSERT_EQ(expected.pts.size(), cloud.pts.size());
+        for (size_t i = 0; i < cloud.pts.size(); i++)
+            ASSERT_TRUE(expected.pts[i] == cloud.pts[i]);
+    }
+}
+
+TEST (Thinning, CalibrateLeafSizeTimesEveryCandidate)
+{
+    std::vector<PointCloud> regions;
+    for (size_t n : {2000, 0, 300})
+        regions.push_back(PointCloud(GenerateUniformCloud(n, 20000, n + 3)));
+    size_t before = regions[0].pts.size();
+
+    std::vector<LeafSizeTiming> timings;
+    size_t leafSize = CalibrateLeafSize(regions, 0.05, false, timings);
+
+    ASSERT_EQ(sizeof(LEAF_SIZE_CANDIDATES) / sizeof(LEAF_SIZE_CANDIDATES[0]), timings.size());
+    bool found = false;
+    for (const auto& t : timings)
+    {
+        found = found || t.leafSize == leafSize;
+        ASSERT_GE(t.seconds, 0);
+    }
+    ASSERT_TRUE(found);
+
+    // The regions are only measured, not thinned
+    ASSERT_EQ(before, regions[0].pts.size());
+}
+
+TEST (Thinning, StreamingMatchesThinPointCloud)
+{
+    // Points on a fine lattice make many pairs sit right at the distance
+    auto points = GenerateUniformCloud(5000, 50000, 3);
+    for (size_t i = 0; i < 500; i++)
+        points.push_back(Vector3d(0.01 * (i % 10), 0.01 * (i / 10 % 10), 0.01 * (i / 100)));
+
+    PointCloud cloud{std::vector<Vector3d>(points)};
+    ThinPointCloud(cloud, 0.02);
+
+    StreamingThinner thinner(0.02);
+    std::vector<Vector3d> streamed;
+    for (const auto& p : points)
+    {
+        if (thinner.offer(p))
+            streamed.push_back(p);
+    }
+    ASSERT_EQ(streamed.size(), thinner.size());
+
+    auto byPosition = [](const Vector3d& a, const Vector3d& b)
+    {
+        if (a.x != b.x) return a.x < b.x;
+        if (a.y != b.y) return a.y < b.y;
+        return a.z < b.z;
+    };
+    std::sort(streamed.begin(), streamed.end(), byPosition);
+    std::sort(cloud.pts.begin(), cloud.pts.end(), byPosition);
+
+    ASSERT_EQ(cloud.pts.size(), streamed.size());
+    for (size_t i = 0; i < streamed.size(); i++)
+        ASSERT_TRUE(streamed[i] == cloud.pts[i]);
+}
+
+TEST (StreamingThinner, RebuiltFromKeptPointsContinuesTheSame)
+{
+    // A Worker drops the thinner of a spilled region and offers the region's
+    // kept points to a new one when more points arrive for it
+    auto points = GenerateUniformCloud(4000, 40000, 5);
+    size_t half = points.size() / 2;
+
+    StreamingThinner whole(0.03);
+    std::vector<Vector3d> kept;
+    for (size_t i = 0; i < half; i++)
+    {
+        if (whole.offer(points[i]))
+            kept.push_back(points[i]);
+    }
+    ASSERT_GE(whole.memoryFootprint(), kept.size() * sizeof(Vector3d));
+
+    StreamingThinner rebuilt(0.03);
+    for (const auto& p : kept)
+        ASSERT_TRUE(rebuilt.offer(p));
+    ASSERT_EQ(whole.size(), rebuilt.size());
+
+    for (size_t i = half; i < points.size(); i++)
+        ASSERT_EQ(whole.offer(points[i]), rebuilt.offer(points[i]));
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
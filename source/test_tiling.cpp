@@ -0,0 +1,159 @@
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "tiling.h"
+
+TEST (Tiling, MortonCodeInterleavesBits)
+{
+    // The bias puts tile 0 at the middle of the range, so compare relative
+    // to the code of the origin tile
+    uint64_t origin = MortonCode(0, 0, 0);
+    ASSERT_EQ(origin | 1, MortonCode(1, 0, 0));
+    ASSERT_EQ(origin | 2, MortonCode(0, 1, 0));
+    ASSERT_EQ(origin | 4, MortonCode(0, 0, 1));
+    ASSERT_EQ(origin | 7, MortonCode(1, 1, 1));
+    ASSERT_EQ(origin | 8, MortonCode(2, 0, 0));
+
+    int64_t i, j, k;
+    MortonDecode(MortonCode(-3, 17, -250000), i, j, k);
+    ASSERT_EQ(-3, i);
+    ASSERT_EQ(17, j);
+    ASSERT_EQ(-250000, k);
+}
+
+TEST (Tiling, SortsPointsIntoTiles)
+{
+    std::string inputName = "./test_tiling.asc";
+    std::vector<double> values;
+    {
+        std::mt19937 rng(3);
+        std::uniform_real_distribution<double> coordinate(-12, 12);
+        std::ofstream out(inputName.c_str());
+        for (int n = 0; n < 3000; n++)
+        {
+            // The z value numbers the points so the input order can be checked
+            double x = coordinate(rng), y = coordinate(rng), z = n * 0.001;
+            out << x << " " << y << " " << z << "\n";
+        }
+    }
+
+    TilingConfiguration config;
+    config.inputFiles = {inputName};
+    config.outputPrefix = "./test_tiling_out";
+    config.scratchDirectory = "./";
+    config.tileSize = 2;
+    config.runPoints = 500;
+    config.mergeRuns = 3;
+    config.threads = 2;
+    TileIndex index = TilePoints(config);
+    ASSERT_DOUBLE_EQ(1, index.origin);
+
+    // The twelve runs went through intermediate passes, which left nothing
+    // behind in the scratch directory
+    ASSERT_FALSE(std::ifstream("./tile_merge_0_0.run").is_open());
+    ASSERT_FALSE(std::ifstream("./tile_run_0_0.run").is_open());
+
+    ASSERT_EQ(3000, index.points);
+    ASSERT_EQ(3, index.stride);
+    ASSERT_EQ("./test_tiling_out.bin", index.dataFile);
+
+    std::vector<double> records(3 * 3000);
+    {
+        std::ifstream in(index.dataFile.c_str(), std::ios::binary);
+        in.read(reinterpret_cast<char*>(records.data()), records.size() * sizeof(double));
+        ASSERT_EQ(records.size() * sizeof(double), (size_t)in.gcount());
+    }
+
+    // Tiles are contiguous and in Morton order, every point lies in its tile,
+    // and the points of a tile keep their input order.  The tiles start half
+    // a tile from the origin, as the first stage bins do.
+    uint64_t next = 0;
+    std::vector<bool> seen(3000, false);
+    for (size_t t = 0; t < index.tiles.size(); t++)
+    {
+        const Tile& tile = index.tiles[t];
+        ASSERT_EQ(next, tile.first);
+        ASSERT_GT(tile.count, 0);
+        if (t > 0)
+        {
+            const Tile& previous = index.tiles[t - 1];
+            ASSERT_LT(MortonCode(previous.i, previous.j, previous.k), MortonCode(tile.i, tile.j, tile.k));
+        }
+
+        double lastZ = -1;
+        for (uint64_t p = tile.first; p < tile.first + tile.count; p++)
+        {
+            ASSERT_EQ(tile.i, (int64_t)std::floor((records[p * 3] - 1) / 2));
+            ASSERT_EQ(tile.j, (int64_t)std::floor((records[p * 3 + 1] - 1) / 2));
+            ASSERT_EQ(tile.k, (int64_t)std::floor((records[p * 3 + 2] - 1) / 2));
+            ASSERT_GT(records[p * 3 + 2], lastZ);
+            lastZ = records[p * 3 + 2];
+
+            size_t n = (size_t)std::round(lastZ * 1000);
+            ASSERT_FALSE(seen[n]);
+            seen[n] = true;
+        }
+        next += tile.count;
+    }
+    ASSERT_EQ(3000, next);
+
+    // The index written beside the data reads back the same
+    TileIndex loaded = LoadTileIndex("./test_tiling_out.tiles");
+    ASSERT_EQ(index.dataFile, loaded.dataFile);
+    ASSERT_EQ(index.points, loaded.points);
+    ASSERT_DOUBLE_EQ(index.origin, loaded.origin);
+    ASSERT_EQ(index.tiles.size(), loaded.tiles.size());
+    ASSERT_EQ(index.tiles.back().first, loaded.tiles.back().first);
+    ASSERT_EQ(index.tiles.back().k, loaded.tiles.back().k);
+
+    auto expanded = ExpandTileIndices({"a.asc", "./test_tiling_out.tiles"}, 3);
+    ASSERT_EQ("a.asc", expanded[0]);
+    ASSERT_EQ(index.dataFile, expanded[1]);
+    ASSERT_THROW(ExpandTileIndices({"./test_tiling_out.tiles"}, 5), std::invalid_argument);
+
+    std::remove(inputName.c_str());
+    std::remove("./test_tiling_out.bin");
+    std::remove("./test_tiling_out.tiles");
+}
+
+TEST (Tiling, SnapsReaderRangesToTiles)
+{
+    TileIndex index;
+    index.dataFile = "./test_snap.bin";
+    index.tileSize = 1;
+    index.origin = 0.5;
+    index.stride = 3;
+    index.points = 100;
+    index.tiles = {Tile{0, 0, 0, 0, 40}, Tile{1, 0, 0, 40, 50}, Tile{0, 1, 0, 90, 10}};
+    WriteTileIndex("./test_snap.tiles", index);
+
+    const uint64_t record = 3 * sizeof(double);
+    std::vector<std::vector<InputRange>> shares = {
+        {InputRange{"./test_snap.bin", 0, 30 * record}},
+        {InputRange{"./test_snap.bin", 30 * record, 60 * record}},
+        {InputRange{"./test_snap.bin", 60 * record, 100 * record}, InputRange{"other.asc", 0, 10}}};
+    SnapToTiles(shares, {"./test_snap.tiles", "other.asc"});
+
+    // The first cut falls back to the start of the file, emptying the first
+    // share, and the second to the start of the tile it was inside
+    ASSERT_TRUE(shares[0].empty());
+    ASSERT_EQ(1, shares[1].size());
+    ASSERT_EQ(0, shares[1][0].begin);
+    ASSERT_EQ(40 * record, shares[1][0].end);
+    ASSERT_EQ(2, shares[2].size());
+    ASSERT_EQ(40 * record, shares[2][0].begin);
+    ASSERT_EQ(100 * record, shares[2][0].end);
+    ASSERT_EQ(10, shares[2][1].end);
+
+    std::remove("./test_snap.tiles");
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
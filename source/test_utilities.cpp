@@ -0,0 +1,70 @@
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <gtest/gtest.h>
+#include "utilities.h"
+
+// Loads a parallel configuration with the given settings added to the input
+// file list
+static ParallelConfiguration loadWith(const std::string& settings)
+{
+    std::string fileName = "./test_utilities.json";
+    {
+        std::ofstream out(fileName.c_str());
+        out << "{ \"input_files\": [\"points.asc\"], " << settings << " }";
+    }
+    try
+    {
+        ParallelConfiguration config = LoadParallelConfiguration(fileName);
+        std::remove(fileName.c_str());
+        return config;
+    }
+    catch (...)
+    {
+        std::remove(fileName.c_str());
+        throw;
+    }
+}
+
+TEST (Utilities, NestedResolutionsFormAPyramid)
+{
+    auto config = loadWith("\"voxel_distance\": [0.2, 0.05, 0.1]");
+    ASSERT_EQ(3, config.voxelResolutions.size());
+    ASSERT_DOUBLE_EQ(0.05, config.voxelDistance);
+    ASSERT_EQ(4, ResolutionFactor(config, 2));
+    ASSERT_EQ(1, PyramidSourceLevel(config, 2));
+}
+
+TEST (Utilities, NonNestedResolutionsAreRejected)
+{
+    // 0.1 is a multiple of the finest resolution but does not divide the
+    // coarsest, so its voxels would straddle the thinning bins
+    ASSERT_THROW(loadWith("\"voxel_distance\": [0.05, 0.1, 0.15]"), std::invalid_argument);
+    ASSERT_THROW(loadWith("\"voxel_distance\": [0.1, 0.25]"), std::invalid_argument);
+}
+
+TEST (Utilities, StreamingThinningWithinAMemoryBudget)
+{
+    // The streaming thinners count towards the budget and are dropped with
+    // the regions they belong to when those are spilled
+    auto config = loadWith("\"streaming_thinning\": true, \"worker_memory_mb\": 64");
+    ASSERT_TRUE(config.streamingThinning);
+    ASSERT_EQ(64u << 20, config.workerMemoryBudget);
+}
+
+TEST (Utilities, BinSpacingIsAMultipleOfTheCoarsestResolution)
+{
+    auto config = loadWith("\"voxel_distance\": [0.25, 0.5], \"binning_distance\": 1.1");
+    ASSERT_DOUBLE_EQ(1.5, BinSpacing(config));
+    config.binningDistance = 2;
+    ASSERT_DOUBLE_EQ(2, BinSpacing(config));
+    config.binningDistance = 0.1;
+    ASSERT_DOUBLE_EQ(0.5, BinSpacing(config));
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
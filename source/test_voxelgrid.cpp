@@ -0,0 +1,92 @@
+#include <unordered_map>
+#include <vector>
+#include <gtest/gtest.h>
+#include "voxelsorter.h"
+#include "voxelgrid.h"
+
+TEST (BrickVoxelGrid, IncrementIntensity)
+{
+    BrickVoxelGrid voxels;
+    incrementVoxelIntensity(voxels, VoxelAddress(0, 0, 0));
+    incrementVoxelIntensity(voxels, VoxelAddress(1, 0, 0));
+    incrementVoxelIntensity(voxels, VoxelAddress(1, 0, 0));
+    incrementVoxelIntensity(voxels, VoxelAddress(0, 1, 0));
+    incrementVoxelIntensity(voxels, VoxelAddress(0, 1, 0));
+    incrementVoxelIntensity(voxels, VoxelAddress(0, 1, 0));
+
+    ASSERT_EQ(1, voxels.intensity(VoxelAddress(0,0,0)));
+    ASSERT_EQ(2, voxels.intensity(VoxelAddress(1,0,0)));
+    ASSERT_EQ(3, voxels.intensity(VoxelAddress(0,1,0)));
+    ASSERT_EQ(0, voxels.intensity(VoxelAddress(0,0,1)));
+    ASSERT_EQ(3, voxels.occupiedVoxels());
+    ASSERT_EQ(1, voxels.numberOfBricks());
+}
+
+TEST (BrickVoxelGrid, NegativeAddresses)
+{
+    BrickVoxelGrid voxels(32);
+    incrementVoxelIntensity(voxels, VoxelAddress(-1, -1, -1));
+    incrementVoxelIntensity(voxels, VoxelAddress(-33, 0, 31));
+    incrementVoxelIntensity(voxels, VoxelAddress(0, 0, 0));
+
+    ASSERT_EQ(1, voxels.intensity(VoxelAddress(-1, -1, -1)));
+    ASSERT_EQ(1, voxels.intensity(VoxelAddress(-33, 0, 31)));
+    ASSERT_EQ(1, voxels.intensity(VoxelAddress(0, 0, 0)));
+    ASSERT_EQ(3, voxels.numberOfBricks());
+}
+
+TEST (BrickVoxelGrid, WidensOnOverflow)
+{
+    BrickVoxelGrid voxels;
+    for (int n = 0; n < 70000; n++)
+        incrementVoxelIntensity(voxels, VoxelAddress(3, 4, 5));
+    incrementVoxelIntensity(voxels, VoxelAddress(4, 4, 5));
+
+    ASSERT_EQ(70000, voxels.intensity(VoxelAddress(3, 4, 5)));
+    ASSERT_EQ(1, voxels.intensity(VoxelAddress(4, 4, 5)));
+
+    auto stats = voxels.statistics();
+    ASSERT_EQ(1, stats.wideBricks);
+    ASSERT_EQ(2, stats.occupiedVoxels);
+    ASSERT_EQ(70001, stats.totalIntensity);
+}
+
+TEST (BrickVoxelGrid, MatchesSparseMap)
+{
+    std::unordered_map<VoxelAddress, int> expected;
+    BrickVoxelGrid voxels;
+    for (int n = 0; n < 5000; n++)
+    {
+        VoxelAddress a((n * 7) % 41 - 20, (n * 13) % 37 - 18, (n * 3) % 50 - 10);
+        incrementVoxelIntensity(expected, a);
+        incrementVoxelIntensity(voxels, a);
+    }
+
+    auto produced = voxels.toSparse();
+    ASSERT_EQ(expected.size(), produced.size());
+    for (auto pair : expected)
+        ASSERT_EQ(pair.second, produced[pair.first]);
+}
+
+TEST (BrickVoxelGrid, ChooseBrickEdge)
+{
+    // A completely filled 32^3 block fits large bricks perfectly
+    std::vector<VoxelAddress> dense;
+    for (int i = 0; i < 32; i++)
+        for (int j = 0; j < 32; j++)
+            for (int k = 0; k < 32; k++)
+                dense.push_back(VoxelAddress(i, j, k));
+    ASSERT_EQ(32, BrickVoxelGrid::chooseBrickEdge(dense));
+
+    // Scattered voxels waste most of a large brick
+    std::vector<VoxelAddress> sparse;
+    for (int n = 0; n < 100; n++)
+        sparse.push_back(VoxelAddress(n * 16, 0, 0));
+    ASSERT_EQ(16, BrickVoxelGrid::chooseBrickEdge(sparse));
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -100,6 +100,35 @@ TEST (VoxelBinning, IncrementIntensity)
     ASSERT_EQ(3, voxels[VoxelAddress(0,1,0)]);
 }
 
+TEST (VoxelBinning, CoarsenAddress)
+{
+    ASSERT_EQ(VoxelAddress(0, 0, 0), coarsenAddress(VoxelAddress(0, 1, 4), 5));
+    ASSERT_EQ(VoxelAddress(1, 2, -1), coarsenAddress(VoxelAddress(5, 10, -1), 5));
+    ASSERT_EQ(VoxelAddress(-1, -2, -1), coarsenAddress(VoxelAddress(-5, -6, -2), 5));
+}
+
+TEST (VoxelBinning, CoarsenMatchesDirectBinning)
+{
+    // Points binned at 0.1 and then coarsened by 5 land in the same voxels as
+    // points binned at 0.5 directly
+    VoxelSorter fine(0.1, 0.1, 0.1, 0, 0, 0);
+    VoxelSorter coarse(0.5, 0.5, 0.5, 0, 0, 0);
+
+    std::unordered_map<VoxelAddress, int> fineVoxels;
+    std::unordered_map<VoxelAddress, int> expected;
+    for (int n = 0; n < 1000; n++)
+    {
+        Vector3d p(std::sin(n) * 3.03, std::cos(n * 0.7) * 2.07, (n % 37) * 0.113 - 2.01);
+        incrementVoxelIntensity(fineVoxels, fine.identifyPoint(p).address);
+        incrementVoxelIntensity(expected, coarse.identifyPoint(p).address);
+    }
+
+    auto produced = coarsenVoxels(fineVoxels, 5);
+    ASSERT_EQ(expected.size(), produced.size());
+    for (auto pair : expected)
+        ASSERT_EQ(pair.second, produced[pair.first]);
+}
+
 int main(int argc, char **argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,225 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    k-d tree thinning of a point cloud.
+
+*/
+
+#include "thinning.h"
+#include <vector>
+#include <utility>
+#include <cmath>
+
+// The search is shared by the standalone index and the ThinningContext.  Only
+// points which are still kept are queried, as before, so the same points are
+// removed as when the matches were collected into a set.
+template <class Tree>
+static void markRedundant(const PointCloud& cloud, Tree& index, double thinningDistance, std::vector<char>& removed)
+{
+    removed.assign(cloud.pts.size(), 0);
+    const double searchRadius = thinningDistance * thinningDistance;
+    for (size_t i = 0; i < cloud.pts.size(); i++)
+    {
+        if (!removed[i])
+        {
+            double query_pt[3] = { cloud.pts[i].x, cloud.pts[i].y, cloud.pts[i].z};
+
+            RemovalMarker marker(removed, searchRadius, i);
+            index.radiusSearchCustomCallback(query_pt, marker);
+        }
+    }
+}
+
+void MarkRedundantPoints(const PointCloud& cloud, PointCloudKDTree& index, double thinningDistance, std::vector<char>& removed)
+{
+    markRedundant(cloud, index, thinningDistance, removed);
+}
+
+std::set<size_t> FindRedundantPoints(const PointCloud& cloud, PointCloudKDTree& index, double thinningDistance)
+{
+    std::vector<char> removed;
+    markRedundant(cloud, index, thinningDistance, removed);
+
+    std::set<size_t> removeIndicies;
+    for (size_t i = 0; i < removed.size(); i++)
+    {
+        if (removed[i])
+            removeIndicies.insert(removeIndicies.end(), i);
+    }
+    return removeIndicies;
+}
+
+void ThinPointCloud(PointCloud& cloud, double thinningDistance)
+{
+    ThinningContext context;
+    context.thin(cloud, thinningDistance);
+}
+
+ThinningContext::ThinningContext(bool mortonOrder, size_t sortThreads)
+: mortonOrder(mortonOrder), sortThreads(sortThreads), source(nullptr), view{nullptr},
+  index(3, view, nanoflann::KDTreeSingleIndexAdaptorParams(THINNING_LEAF_SIZE))
+{
+}
+
+void ThinningContext::build(const PointCloud& cloud)
+{
+    source = &cloud;
+    view.cloud = &cloud;
+
+    // The sorted positions are held in 32 bits, larger regions are left as
+    // they are
+    const size_t n = cloud.pts.size();
+    if (mortonOrder && n <= UINT32_MAX)
+    {
+        const auto& order = morton.sort(cloud.pts, sortThreads);
+        sorted.pts.resize(n);
+        rank.resize(n);
+        for (size_t s = 0; s < n; s++)
+        {
+            sorted.pts[s] = cloud.pts[order[s]];
+            rank[order[s]] = (uint32_t)s;
+        }
+        view.cloud = &sorted;
+    }
+
+    // buildIndex resizes the index array to the new cloud, which keeps its
+    // capacity, and releases the nodes of the previous tree
+    index.buildIndex();
+}
+
+const std::vector<char>& ThinningContext::markRedundant(double thinningDistance)
+{
+    if (view.cloud == source)
+    {
+        ::markRedundant(*source, index, thinningDistance, removed);
+        return removed;
+    }
+
+    // Query in the original order, so the first point of every close group
+    // is kept as without sorting, and map the mask back to that order
+    const size_t n = source->pts.size();
+    const double searchRadius = thinningDistance * thinningDistance;
+    sortedRemoved.assign(n, 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        const uint32_t s = rank[i];
+        if (!sortedRemoved[s])
+        {
+            double query_pt[3] = { sorted.pts[s].x, sorted.pts[s].y, sorted.pts[s].z};
+
+            RemovalMarker marker(sortedRemoved, searchRadius, s);
+            index.radiusSearchCustomCallback(query_pt, marker);
+        }
+    }
+
+    removed.resize(n);
+    for (size_t i = 0; i < n; i++)
+        removed[i] = sortedRemoved[rank[i]];
+    return removed;
+}
+
+void ThinningContext::thin(PointCloud& cloud, double thinningDistance)
+{
+    build(cloud);
+    cloud.RemoveMarked(markRedundant(thinningDistance));
+}
+
+void ThinningContext::setLeafSize(size_t leafSize)
+{
+    index.setLeafSize(leafSize);
+}
+
+size_t CalibrateLeafSize(const std::vector<PointCloud>& regions, double thinningDistance, bool mortonOrder,
+                         std::vector<LeafSizeTiming>& timings)
+{
+    // Only the mask is computed, so the regions are left as they are for the
+    // next candidate
+    ThinningContext context(mortonOrder);
+    return FastestLeafSize([&](size_t leafSize)
+    {
+        context.setLeafSize(leafSize);
+        for (const auto& region : regions)
+        {
+            context.build(region);
+            context.markRedundant(thinningDistance);
+        }
+    }, timings);
+}
+
+StreamingThinner::StreamingThinner(double thinningDistance)
+{
+    distance = thinningDistance;
+    kept = 0;
+    cellBytes = 0;
+    cellSize = 2 * thinningDistance;
+}
+
+size_t StreamingThinner::memoryFootprint() const
+{
+    return cellBytes + cells.bucket_count() * sizeof(void*);
+}
+
+bool StreamingThinner::offer(const Vector3d& p)
+{
+    kept++;
+    if (distance <= 0)
+        return true;
+
+    // The box is widened a little so that rounding in the division can't
+    // leave out a cell holding a point just inside the distance
+    const double reach = distance * (1 + 1e-6);
+    auto lowCell = [this, reach](double x) { return (int)std::floor((x - reach) / cellSize); };
+    auto highCell = [this, reach](double x) { return (int)std::floor((x + reach) / cellSize); };
+
+    // The squared distance is computed the same way as PointCloud::kdtree_distance
+    // and compared the same way as the radius search, so the two agree exactly
+    const double radius = distance * distance;
+    for (int i = lowCell(p.x); i <= highCell(p.x); i++)
+    {
+        for (int j = lowCell(p.y); j <= highCell(p.y); j++)
+        {
+            for (int k = lowCell(p.z); k <= highCell(p.z); k++)
+            {
+                auto found = cells.find(VoxelAddress(i, j, k));
+                if (found == cells.end())
+                    continue;
+                for (const auto& q : found->second)
+                {
+                    const double d0 = q.x - p.x;
+                    const double d1 = q.y - p.y;
+                    const double d2 = q.z - p.z;
+                    if (d0 * d0 + d1 * d1 + d2 * d2 < radius)
+                    {
+                        kept--;
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    VoxelAddress cell((int)std::floor(p.x / cellSize), (int)std::floor(p.y / cellSize), (int)std::floor(p.z / cellSize));
+    auto inserted = cells.emplace(cell, std::vector<Vector3d>());
+    std::vector<Vector3d>& points = inserted.first->second;
+    if (inserted.second)
+        cellBytes += sizeof(*inserted.first) + 2 * sizeof(void*);
+    size_t capacity = points.capacity();
+    points.push_back(p);
+    cellBytes += (points.capacity() - capacity) * sizeof(Vector3d);
+    return true;
+}
@@ -0,0 +1,202 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    k-d tree thinning of a point cloud.  The points are visited in order and
+    every later point within the thinning distance of a point which is kept
+    is removed, giving the same result as naiveThinning in O(n log n) time.
+
+    Workers thin thousands of regions, so ThinningContext keeps the k-d tree
+    and the removal mask between regions and rebuilds the tree in place
+    rather than allocating a new index for every region.  The radius
+    searches report their hits to a RemovalMarker, which sets the removal
+    mask directly, so a query allocates nothing.  The context can also build
+    the tree over a copy of the region sorted into Morton order, so that the
+    points of each subtree are adjacent in memory, while still visiting the
+    points in their original order so the same points are kept.
+
+    A point is kept exactly when no point kept before it lies within the
+    thinning distance, so the points can also be thinned one at a time as
+    they arrive.  StreamingThinner does this with a hash grid of the kept
+    points, which lets the Workers thin while the Readers are still sending.
+
+*/
+#ifndef THINNING_H
+#define THINNING_H
+
+#include <set>
+#include <vector>
+#include <unordered_map>
+#include "nanoflann.hpp"
+#include "pointcloud.h"
+#include "voxelsorter.h"
+#include "morton.h"
+#include "leafsize.h"
+
+typedef nanoflann::KDTreeSingleIndexAdaptor<nanoflann::L2_Simple_Adaptor<double, PointCloud>, PointCloud, 3> PointCloudKDTree;
+
+// The maximum number of points in a leaf of the thinning k-d tree
+#define THINNING_LEAF_SIZE 10
+
+// A radius search result set for findNeighbors or radiusSearchCustomCallback
+// which marks every point found within the radius, other than the query
+// point, in a removal mask instead of collecting the matches
+class RemovalMarker
+{
+public:
+    RemovalMarker(std::vector<char>& removed, double squaredRadius, size_t query)
+    : removed(removed), radius(squaredRadius), query(query), marked(0) {}
+
+    inline void init() {}
+    inline size_t size() const { return marked; }
+    inline bool full() const { return true; }
+    inline double worstDist() const { return radius; }
+
+    inline void addPoint(double dist, size_t index)
+    {
+        if (dist < radius && index != query && !removed[index])
+        {
+            removed[index] = 1;
+            marked++;
+        }
+    }
+
+private:
+    std::vector<char>& removed;
+    const double radius;
+    const size_t query;
+    size_t marked;
+};
+
+// Sets the entries of the mask, which is resized to the cloud, of the points
+// which are redundant, using an index that has already been built over it
+void MarkRedundantPoints(const PointCloud& cloud, PointCloudKDTree& index, double thinningDistance, std::vector<char>& removed);
+
+// Returns the indices of the points which are redundant, using an index that
+// has already been built over the cloud
+std::set<size_t> FindRedundantPoints(const PointCloud& cloud, PointCloudKDTree& index, double thinningDistance);
+
+// Builds the index and removes the redundant points, along with their
+// attributes, from the cloud
+void ThinPointCloud(PointCloud& cloud, double thinningDistance);
+
+// A k-d tree and removal mask reused across the regions thinned by one
+// process.  The tree is built over a view which is pointed at each cloud
+// in turn, so the index array keeps its capacity between builds.
+class ThinningContext
+{
+public:
+    // With mortonOrder set the tree is built over the points sorted into
+    // Morton order, using sortThreads threads for large regions
+    explicit ThinningContext(bool mortonOrder = false, size_t sortThreads = 1);
+    ThinningContext(const ThinningContext&) = delete;
+    ThinningContext& operator=(const ThinningContext&) = delete;
+
+    // Builds the index over the cloud, which must not change until the
+    // redundant points have been found
+    void build(const PointCloud& cloud);
+
+    // Returns the removal mask of the redundant points of the last cloud built
+    const std::vector<char>& markRedundant(double thinningDistance);
+
+    // Builds the index and removes the redundant points from the cloud,
+    // keeping the order of the remaining points
+    void thin(PointCloud& cloud, double thinningDistance);
+
+    // Sets the maximum number of points in a leaf for the following builds
+    void setLeafSize(size_t leafSize);
+
+private:
+    struct CloudView
+    {
+        const PointCloud* cloud;
+
+        inline size_t kdtree_get_point_count() const { return cloud ? cloud->kdtree_get_point_count() : 0; }
+        inline double kdtree_distance(const double* p1, const size_t idx_p2, size_t size) const { return cloud->kdtree_distance(p1, idx_p2, size); }
+        inline double kdtree_get_pt(const size_t idx, int dim) const { return cloud->kdtree_get_pt(idx, dim); }
+        template <class BBOX>
+        bool kdtree_get_bbox(BBOX& /* bb */) const { return false; }
+    };
+
+    typedef nanoflann::KDTreeSingleIndexAdaptor<nanoflann::L2_Simple_Adaptor<double, CloudView>, CloudView, 3> ViewKDTreeBase;
+
+    // nanoflann only takes the leaf size in its constructor, so the tree
+    // exposes it to be changed between builds
+    class ViewKDTree : public ViewKDTreeBase
+    {
+    public:
+        using ViewKDTreeBase::ViewKDTreeBase;
+        inline void setLeafSize(size_t leafSize) { this->m_leaf_max_size = leafSize; }
+    };
+
+    bool mortonOrder;
+    size_t sortThreads;
+    const PointCloud* source;
+
+    CloudView view;
+    ViewKDTree index;
+    std::vector<char> removed;
+
+    // The Morton ordered copy of the points, the position of every point of
+    // the source in it, and the removal mask in its order
+    MortonOrder morton;
+    PointCloud sorted;
+    std::vector<uint32_t> rank;
+    std::vector<char> sortedRemoved;
+};
+
+// Thins every region with a context at each candidate leaf size, appending
+// the time taken at each to timings, and returns the fastest leaf size
+size_t CalibrateLeafSize(const std::vector<PointCloud>& regions, double thinningDistance, bool mortonOrder,
+                         std::vector<LeafSizeTiming>& timings);
+
+// Thins points offered in order, keeping the same points as ThinPointCloud
+// on the whole sequence.  The kept points are held in cells of twice the
+// thinning distance, so the points within the distance of a point lie in the
+// one to eight cells overlapped by the box of that half width around it.
+class StreamingThinner
+{
+public:
+    explicit StreamingThinner(double thinningDistance);
+
+    // Returns true and remembers the point if no kept point is within the
+    // thinning distance of it
+    bool offer(const Vector3d& p);
+
+    inline size_t size() const { return kept; }
+
+    // The bytes allocated for the cells and the kept points they hold, an
+    // estimate of the hash map's own overhead included
+    size_t memoryFootprint() const;
+
+private:
+    struct CellHash
+    {
+        inline size_t operator()(const VoxelAddress& a) const
+        {
+            return static_cast<size_t>(a.i) * 73856093u ^ static_cast<size_t>(a.j) * 19349663u ^ static_cast<size_t>(a.k) * 83492791u;
+        }
+    };
+
+    double distance;
+    double cellSize;
+    size_t kept;
+    size_t cellBytes;
+    std::unordered_map<VoxelAddress, std::vector<Vector3d>, CellHash> cells;
+};
+
+#endif
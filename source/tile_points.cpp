@@ -0,0 +1,66 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Tiling preprocessor, sorts point cloud files into Morton ordered tiles.
+
+*/
+
+#include <iostream>
+#include <stdexcept>
+#include <chrono>
+#include "tiling.h"
+#include "utilities.h"
+
+void printUsageInstructions()
+{
+    std::cout << "tile_points: make sure to specify the config argument as a command line parameter" << std::endl;
+    std::cout << "             usage: tile_points config.json" << std::endl;
+    std::cout << "             This tool sorts point files into tiles for mpi_voxels and kdtree_voxels." << std::endl;
+    std::cout << "             See sample_data/tile_points.json for the settings." << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        printUsageInstructions();
+        return -1;
+    }
+
+    try
+    {
+        TilingConfiguration config = LoadTilingConfiguration(argv[1]);
+        std::cout << "tile_points: configuration" << std::endl;
+        PrintConfigDetails(config, 4);
+
+        auto start = std::chrono::steady_clock::now();
+        TileIndex index = TilePoints(config);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "tile_points: sorted " << index.points << " points into " << index.tiles.size() << " tiles in "
+                  << seconds << " s" << std::endl;
+        std::cout << "tile_points: wrote " << index.dataFile << " and " << config.outputPrefix << ".tiles" << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "tile_points: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
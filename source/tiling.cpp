@@ -0,0 +1,450 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Spatial sorting of point clouds into Morton ordered tiles.
+
+*/
+
+#include "tiling.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "json/json.h"
+#include "attributes.h"
+#include "morton.h"
+#include "asyncwriter.h"
+
+#define TILE_COORDINATE_BIAS (1LL << (TILE_COORDINATE_BITS - 1))
+#define TILE_RECORD_VALUES 5
+#define TILE_MERGE_BLOCK 4096
+
+static uint64_t offsetCoordinate(int64_t c)
+{
+    c += TILE_COORDINATE_BIAS;
+    return static_cast<uint64_t>(std::min<int64_t>(std::max<int64_t>(c, 0), 2 * TILE_COORDINATE_BIAS - 1));
+}
+
+uint64_t MortonCode(int64_t i, int64_t j, int64_t k)
+{
+    return MortonInterleave(offsetCoordinate(i), offsetCoordinate(j), offsetCoordinate(k));
+}
+
+void MortonDecode(uint64_t code, int64_t& i, int64_t& j, int64_t& k)
+{
+    uint64_t ui, uj, uk;
+    MortonDeinterleave(code, ui, uj, uk);
+    i = static_cast<int64_t>(ui) - TILE_COORDINATE_BIAS;
+    j = static_cast<int64_t>(uj) - TILE_COORDINATE_BIAS;
+    k = static_cast<int64_t>(uk) - TILE_COORDINATE_BIAS;
+}
+
+bool IsTileIndex(const std::string& fileName)
+{
+    const std::string suffix = ".tiles";
+    return fileName.size() >= suffix.size() && fileName.compare(fileName.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// The directory part of a path including the trailing slash, or nothing
+static std::string directoryOf(const std::string& fileName)
+{
+    size_t slash = fileName.find_last_of('/');
+    return slash == std::string::npos ? "" : fileName.substr(0, slash + 1);
+}
+
+static std::string baseName(const std::string& fileName)
+{
+    size_t slash = fileName.find_last_of('/');
+    return slash == std::string::npos ? fileName : fileName.substr(slash + 1);
+}
+
+TileIndex LoadTileIndex(const std::string& fileName)
+{
+    std::ifstream file(fileName.c_str());
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    Json::Value root;
+    Json::Reader reader;
+    if (!file.is_open() || !reader.parse(data, root, false) || !root["tiles"].isArray())
+        throw std::invalid_argument("Could not read tile index " + fileName);
+
+    TileIndex index;
+    index.dataFile = root.get("data", "").asString();
+    if (!index.dataFile.empty() && index.dataFile[0] != '/')
+        index.dataFile = directoryOf(fileName) + index.dataFile;
+    index.tileSize = root.get("tile_size", 0).asDouble();
+    index.origin = root.get("origin", 0).asDouble();
+    index.stride = root.get("stride", 3).asUInt();
+    index.points = root.get("points", 0).asUInt64();
+
+    for (const auto& t : root["tiles"])
+    {
+        Tile tile;
+        tile.i = t[0].asInt64();
+        tile.j = t[1].asInt64();
+        tile.k = t[2].asInt64();
+        tile.first = t[3].asUInt64();
+        tile.count = t[4].asUInt64();
+        index.tiles.push_back(tile);
+    }
+    return index;
+}
+
+void WriteTileIndex(const std::string& fileName, const TileIndex& index)
+{
+    // The data file is written relative to the index so the pair can be moved
+    Json::Value root;
+    root["data"] = directoryOf(index.dataFile) == directoryOf(fileName) ? baseName(index.dataFile) : index.dataFile;
+    root["tile_size"] = index.tileSize;
+    root["origin"] = index.origin;
+    root["stride"] = static_cast<Json::UInt>(index.stride);
+    root["points"] = static_cast<Json::UInt64>(index.points);
+
+    Json::Value tiles(Json::arrayValue);
+    for (const auto& tile : index.tiles)
+    {
+        Json::Value t(Json::arrayValue);
+        t.append(static_cast<Json::Int64>(tile.i));
+        t.append(static_cast<Json::Int64>(tile.j));
+        t.append(static_cast<Json::Int64>(tile.k));
+        t.append(static_cast<Json::UInt64>(tile.first));
+        t.append(static_cast<Json::UInt64>(tile.count));
+        tiles.append(t);
+    }
+    root["tiles"] = tiles;
+
+    std::ofstream out(fileName.c_str());
+    if (!out.is_open())
+        throw std::invalid_argument("Could not open tile index " + fileName + " for output");
+    Json::FastWriter writer;
+    out << writer.write(root);
+}
+
+std::vector<std::string> ExpandTileIndices(const std::vector<std::string>& inputFiles, size_t stride)
+{
+    std::vector<std::string> files;
+    for (const auto& f : inputFiles)
+    {
+        if (!IsTileIndex(f))
+        {
+            files.push_back(f);
+            continue;
+        }
+
+        TileIndex index = LoadTileIndex(f);
+        if (index.stride != stride)
+            throw std::invalid_argument("Tile index " + f + " holds records of " + std::to_string(index.stride)
+                                        + " values but the point attribute settings need " + std::to_string(stride));
+        files.push_back(index.dataFile);
+    }
+    return files;
+}
+
+void SnapToTiles(std::vector<std::vector<InputRange>>& shares, const std::vector<std::string>& inputFiles)
+{
+    for (const auto& f : inputFiles)
+    {
+        if (!IsTileIndex(f))
+            continue;
+
+        TileIndex index = LoadTileIndex(f);
+        const uint64_t recordBytes = index.stride * sizeof(double);
+        std::vector<uint64_t> boundaries;
+        for (const auto& tile : index.tiles)
+            boundaries.push_back(tile.first * recordBytes);
+        boundaries.push_back(index.points * recordBytes);
+
+        // The last boundary at or before a cut, neighbouring ranges share
+        // their cut so they stay contiguous
+        auto snap = [&boundaries](uint64_t cut)
+        {
+            auto after = std::upper_bound(boundaries.begin(), boundaries.end(), cut);
+            return after == boundaries.begin() ? 0 : *(after - 1);
+        };
+
+        for (auto& share : shares)
+        {
+            std::vector<InputRange> kept;
+            for (auto r : share)
+            {
+                if (r.fileName == index.dataFile)
+                {
+                    r.begin = snap(r.begin);
+                    r.end = snap(r.end);
+                }
+                if (r.begin < r.end)
+                    kept.push_back(r);
+            }
+            share.swap(kept);
+        }
+    }
+}
+
+// A point and its tile key as held in the sorted runs
+struct TileRecord
+{
+    uint64_t key;
+    double values[TILE_RECORD_VALUES];
+};
+
+// The tiles are offset by half a tile to line up with the first stage bins
+static double tileOrigin(double tileSize)
+{
+    return tileSize / 2;
+}
+
+// Reads one share of the input, writing sorted runs of at most runPoints
+// records to scratch, and returns the names of the runs in input order
+static std::vector<std::string> sortRuns(const TilingConfiguration& config, const std::vector<InputRange>& ranges,
+                                         size_t share, size_t runPoints)
+{
+    std::vector<std::string> runs;
+    std::vector<TileRecord> buffer;
+    buffer.reserve(runPoints);
+
+    auto flush = [&]()
+    {
+        if (buffer.empty())
+            return;
+        std::stable_sort(buffer.begin(), buffer.end(), [](const TileRecord& a, const TileRecord& b) { return a.key < b.key; });
+
+        std::string name = config.scratchDirectory + "tile_run_" + std::to_string(share) + "_" + std::to_string(runs.size()) + ".run";
+        std::ofstream out(name.c_str(), std::ios::binary);
+        out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(TileRecord));
+        if (!out.good())
+            throw std::runtime_error("Could not write sorted run " + name);
+        runs.push_back(name);
+        buffer.clear();
+    };
+
+    const double origin = tileOrigin(config.tileSize);
+    auto add = [&](double x, double y, double z, double intensity, double packedReturns)
+    {
+        TileRecord r;
+        r.key = MortonCode((int64_t)std::floor((x - origin) / config.tileSize), (int64_t)std::floor((y - origin) / config.tileSize),
+                           (int64_t)std::floor((z - origin) / config.tileSize));
+        r.values[0] = x;
+        r.values[1] = y;
+        r.values[2] = z;
+        r.values[3] = intensity;
+        r.values[4] = packedReturns;
+        buffer.push_back(r);
+        if (buffer.size() >= runPoints)
+            flush();
+    };
+
+    const bool attributes = config.attributeColumns.enabled();
+    PointAttributes parsed;
+    for (const auto& range : ranges)
+    {
+        if (IsBinaryInput(range.fileName))
+        {
+            ForEachRecordInRange(range, attributes ? 5 : 3, [&](const double* record)
+            {
+                add(record[0], record[1], record[2], attributes ? record[3] : 0, attributes ? record[4] : 0);
+            });
+            continue;
+        }
+
+        ForEachLineInRange(range, [&](const std::string& line)
+        {
+            std::istringstream i(line);
+            std::vector<std::string> tokens{std::istream_iterator<std::string>(i), std::istream_iterator<std::string>()};
+            if (tokens.size() < 3)
+                return;
+
+            parsed.clear();
+            if (attributes)
+                ParseAttributes(tokens, config.attributeColumns, parsed);
+            add(std::stod(tokens[0]), std::stod(tokens[1]), std::stod(tokens[2]),
+                attributes ? parsed.intensity[0] : 0, attributes ? parsed.packedReturns(0) : 0);
+        });
+    }
+    flush();
+    return runs;
+}
+
+// Buffered reader of one sorted run during the merge
+struct RunCursor
+{
+    std::ifstream file;
+    std::vector<TileRecord> block;
+    size_t position;
+
+    bool next()
+    {
+        position++;
+        if (position < block.size())
+            return true;
+
+        block.resize(TILE_MERGE_BLOCK);
+        file.read(reinterpret_cast<char*>(block.data()), block.size() * sizeof(TileRecord));
+        block.resize(file.gcount() / sizeof(TileRecord));
+        position = 0;
+        return !block.empty();
+    }
+
+    inline const TileRecord& current() const { return block[position]; }
+};
+
+// Merges sorted runs, calling emit with every record in key order.  Ties in
+// the key go to the earlier run so points in the same tile keep their input
+// order.
+template <typename F>
+static void mergeRuns(const std::vector<std::string>& runs, F emit)
+{
+    std::vector<RunCursor> cursors(runs.size());
+    typedef std::pair<uint64_t, size_t> QueueEntry;
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry>> queue;
+    for (size_t r = 0; r < runs.size(); r++)
+    {
+        cursors[r].file.open(runs[r].c_str(), std::ios::binary);
+        if (!cursors[r].file.is_open())
+            throw std::runtime_error("Could not open sorted run " + runs[r]);
+        cursors[r].position = 0;
+        if (cursors[r].next())
+            queue.push(QueueEntry(cursors[r].current().key, r));
+    }
+
+    while (!queue.empty())
+    {
+        size_t r = queue.top().second;
+        queue.pop();
+        emit(cursors[r].current());
+        if (cursors[r].next())
+            queue.push(QueueEntry(cursors[r].current().key, r));
+    }
+}
+
+// Merges groups of at most fanIn neighbouring runs into longer runs until no
+// more than fanIn are left, removing the merged ones.  Groups are formed in
+// run order, so the earlier runs still hold the earlier points.
+static std::vector<std::string> mergePasses(const TilingConfiguration& config, std::vector<std::string> runs, size_t fanIn)
+{
+    for (size_t pass = 0; runs.size() > fanIn; pass++)
+    {
+        std::vector<std::string> merged;
+        for (size_t first = 0; first < runs.size(); first += fanIn)
+        {
+            std::vector<std::string> group(runs.begin() + first, runs.begin() + std::min(runs.size(), first + fanIn));
+            if (group.size() == 1)
+            {
+                merged.push_back(group[0]);
+                continue;
+            }
+
+            std::string name = config.scratchDirectory + "tile_merge_" + std::to_string(pass) + "_" + std::to_string(merged.size()) + ".run";
+            std::ofstream out(name.c_str(), std::ios::binary);
+            std::vector<TileRecord> block;
+            block.reserve(TILE_MERGE_BLOCK);
+            mergeRuns(group, [&](const TileRecord& record)
+            {
+                block.push_back(record);
+                if (block.size() >= TILE_MERGE_BLOCK)
+                {
+                    out.write(reinterpret_cast<const char*>(block.data()), block.size() * sizeof(TileRecord));
+                    block.clear();
+                }
+            });
+            out.write(reinterpret_cast<const char*>(block.data()), block.size() * sizeof(TileRecord));
+            out.close();
+            if (!out.good())
+                throw std::runtime_error("Could not write merged run " + name);
+
+            for (const auto& run : group)
+                std::remove(run.c_str());
+            merged.push_back(name);
+        }
+        runs.swap(merged);
+    }
+    return runs;
+}
+
+TileIndex TilePoints(const TilingConfiguration& config)
+{
+    size_t threads = config.threads > 0 ? config.threads : std::max(1u, std::thread::hardware_concurrency());
+    const size_t stride = config.attributeColumns.enabled() ? 5 : 3;
+
+    // Every thread sorts one share of the input, and the share of each thread
+    // is in input order, so the runs are too
+    auto shares = SplitInputFiles(config.inputFiles, threads, stride * sizeof(double));
+    size_t runPoints = std::max<size_t>(1, config.runPoints / threads);
+    std::vector<std::future<std::vector<std::string>>> sorting;
+    for (size_t t = 0; t < threads; t++)
+        sorting.push_back(std::async(std::launch::async, sortRuns, std::cref(config), std::cref(shares[t]), t, runPoints));
+
+    std::vector<std::string> runs;
+    for (auto& s : sorting)
+    {
+        auto names = s.get();
+        runs.insert(runs.end(), names.begin(), names.end());
+    }
+
+    // Bring the number of runs down to what can be open at once, then merge
+    // the rest into the output
+    runs = mergePasses(config, runs, std::max<size_t>(2, config.mergeRuns));
+
+    TileIndex index;
+    index.dataFile = config.outputPrefix + ".bin";
+    index.tileSize = config.tileSize;
+    index.origin = tileOrigin(config.tileSize);
+    index.stride = stride;
+    index.points = 0;
+
+    AsyncOutputFile out(index.dataFile);
+    if (!out.is_open())
+        throw std::invalid_argument("Could not open " + index.dataFile + " for output");
+
+    std::vector<double> outBlock;
+    outBlock.reserve(TILE_MERGE_BLOCK * stride);
+    mergeRuns(runs, [&](const TileRecord& record)
+    {
+        if (index.tiles.empty() || MortonCode(index.tiles.back().i, index.tiles.back().j, index.tiles.back().k) != record.key)
+        {
+            Tile tile;
+            MortonDecode(record.key, tile.i, tile.j, tile.k);
+            tile.first = index.points;
+            tile.count = 0;
+            index.tiles.push_back(tile);
+        }
+        index.tiles.back().count++;
+        index.points++;
+
+        outBlock.insert(outBlock.end(), record.values, record.values + stride);
+        if (outBlock.size() >= TILE_MERGE_BLOCK * stride)
+        {
+            out.write(reinterpret_cast<const char*>(outBlock.data()), outBlock.size() * sizeof(double));
+            outBlock.clear();
+        }
+    });
+    out.write(reinterpret_cast<const char*>(outBlock.data()), outBlock.size() * sizeof(double));
+    out.close();
+
+    for (const auto& name : runs)
+        std::remove(name.c_str());
+
+    WriteTileIndex(config.outputPrefix + ".tiles", index);
+    return index;
+}
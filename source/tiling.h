@@ -0,0 +1,100 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Spatial sorting of point clouds into Morton ordered tiles.
+
+    Scan files mix points from the whole scene, so every Reader sends to
+    every Worker and the Workers' bins are filled in random order.  The
+    tiling preprocessor sorts the points by the Morton code of the cubic
+    tile they lie in and writes them as a binary point file, in the layout
+    of the mpi_voxels scratch files, along with a JSON tile index giving the
+    first record and number of records of every tile.  Nearby tiles are
+    close together in Morton order, so the points of each bin arrive
+    together and a contiguous share of the file covers a compact region.
+
+    The tiles are offset by half a tile from the coordinate origin, tile i
+    covering [origin + i * size, origin + (i + 1) * size) with an origin of
+    size / 2, as the first stage bins of mpi_voxels are offset by half a bin.
+    With the tile size set to the binning distance every tile then covers
+    exactly one first stage bin.
+
+    The sort is external: threads read byte ranges of the inputs, sort runs
+    of a bounded number of points in memory and write them to scratch, and
+    the runs are then merged.  Points in the same tile keep their input
+    order, so the result is the same whatever the number of threads.  At
+    most mergeRuns runs are open at once, with more runs than that the
+    groups of neighbouring runs are merged into longer runs first.
+
+*/
+#ifndef TILING_H
+#define TILING_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "inputsplit.h"
+#include "utilities.h"
+#include "morton.h"
+
+// Tile coordinates are offset by half the range of TILE_COORDINATE_BITS bits
+// and clamped into it, so points further out share the outermost tiles
+#define TILE_COORDINATE_BITS MORTON_COORDINATE_BITS
+
+// Interleaves the bits of the offset tile coordinates, i in the lowest bit
+uint64_t MortonCode(int64_t i, int64_t j, int64_t k);
+void MortonDecode(uint64_t code, int64_t& i, int64_t& j, int64_t& k);
+
+struct Tile
+{
+    int64_t i;
+    int64_t j;
+    int64_t k;
+    uint64_t first;
+    uint64_t count;
+};
+
+struct TileIndex
+{
+    std::string dataFile;
+    double tileSize;
+    double origin;
+    size_t stride;
+    uint64_t points;
+    std::vector<Tile> tiles;
+};
+
+// True for tile index files, which are named .tiles
+bool IsTileIndex(const std::string& fileName);
+
+// Reads a tile index, the data file is resolved relative to the index
+TileIndex LoadTileIndex(const std::string& fileName);
+void WriteTileIndex(const std::string& fileName, const TileIndex& index);
+
+// Replaces every tile index in a list of input files by its data file, and
+// throws if the records of a data file are not stride doubles long
+std::vector<std::string> ExpandTileIndices(const std::vector<std::string>& inputFiles, size_t stride);
+
+// Moves the cuts between the ranges of the tiled data files back to the
+// start of a tile, so every tile is read by a single Reader
+void SnapToTiles(std::vector<std::vector<InputRange>>& shares, const std::vector<std::string>& inputFiles);
+
+// Sorts the input files into tiles, writing <output>.bin and <output>.tiles
+TileIndex TilePoints(const TilingConfiguration& config);
+
+#endif
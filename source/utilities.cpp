@@ -25,11 +25,61 @@ Copyright (C) 2016  Matthew Jarvis
 #include <iostream> // TODO: remove later
 #include <iterator>
 #include <stdexcept>
+#include <algorithm>
+#include <cmath>
 
 #include "json/json.h"
 #include "vector3d.h"
 #include "utilities.h"
 
+// Reads the "voxel_backend" setting, which is either "map" for the sparse
+// unordered_map accumulator or "brick" for the dense brick grid
+static std::string LoadVoxelBackend(const Json::Value& root)
+{
+    std::string backend = root.get("voxel_backend", "map").asString();
+    if (backend != "map" && backend != "brick")
+        throw std::invalid_argument("Unknown voxel_backend '" + backend + "', expected \"map\" or \"brick\"");
+    return backend;
+}
+
+// Reads the "leaf_size" setting, the maximum number of points in a leaf of
+// the k-d tree, which is either a number or "auto" to time a sample of the
+// cloud at several sizes when the run starts
+static size_t LoadLeafSize(const Json::Value& root, bool& autoLeafSize)
+{
+    Json::Value node = root.get("leaf_size", 10);
+    autoLeafSize = node.isString() && node.asString() == "auto";
+    if (autoLeafSize)
+        return 10;
+    if (!node.isNumeric() || node.asDouble() < 1)
+        throw std::invalid_argument("Configuration leaf_size must be at least 1, or \"auto\"");
+    return node.asUInt64();
+}
+
+// Reads the optional "attribute_columns" object, which gives the zero based
+// token index of the intensity, return number, and number of returns columns
+static AttributeColumns LoadAttributeColumns(const Json::Value& root)
+{
+    AttributeColumns columns;
+    Json::Value node = root["attribute_columns"];
+    if (node.isNull())
+        return columns;
+
+    if (!node.isObject())
+        throw std::invalid_argument("Configuration attribute_columns must be an object");
+
+    columns.intensity = node.get("intensity", -1).asInt();
+    columns.returnNumber = node.get("return_number", -1).asInt();
+    columns.numberOfReturns = node.get("number_of_returns", -1).asInt();
+
+    for (int column : {columns.intensity, columns.returnNumber, columns.numberOfReturns})
+    {
+        if (column >= 0 && column < 3)
+            throw std::invalid_argument("Configuration attribute_columns overlap the x, y, z columns");
+    }
+    return columns;
+}
+
 Configuration LoadConfiguration(std::string fileName)
 {
     Json::Value root;
@@ -64,6 +114,18 @@ Configuration LoadConfiguration(std::string fileName)
     // Load the thinning distance
     c.thinningDistance = root.get("thinning_distance", 0).asDouble();
 
+    // Load the voxel accumulator backend
+    c.voxelBackend = LoadVoxelBackend(root);
+
+    // Load the optional point attribute columns
+    c.attributeColumns = LoadAttributeColumns(root);
+
+    // Load the number of threads building the k-d tree, zero uses every core
+    c.threads = root.get("threads", 0).asUInt64();
+
+    // Load the k-d tree leaf size
+    c.leafSize = LoadLeafSize(root, c.autoLeafSize);
+
     return c;
 }
 
@@ -95,20 +157,210 @@ ParallelConfiguration LoadParallelConfiguration(std::string fileName)
     // Load the output path
     c.scratchDirectory = root.get("scratch_directory", ".").asString();
 
-    // Load the voxel width
-    c.voxelDistance = root.get("voxel_distance", 0.1).asDouble();
+    // Load the voxel width, which may be a single value or a list of nested
+    // resolutions that will be produced as a multi-resolution pyramid
+    Json::Value voxelDistance = root.get("voxel_distance", 0.1);
+    if (voxelDistance.isArray())
+    {
+        for (auto v : voxelDistance)
+            c.voxelResolutions.push_back(v.asDouble());
+    }
+    else
+    {
+        c.voxelResolutions.push_back(voxelDistance.asDouble());
+    }
+
+    if (c.voxelResolutions.empty())
+        throw std::invalid_argument("Configuration voxel_distance list is empty");
 
-    // Load the thinning distance
-    c.thinningDistance = root.get("thinning_distance", 0).asDouble();
+    std::sort(c.voxelResolutions.begin(), c.voxelResolutions.end());
+    c.voxelResolutions.erase(std::unique(c.voxelResolutions.begin(), c.voxelResolutions.end()), c.voxelResolutions.end());
+    c.voxelDistance = c.voxelResolutions.front();
 
-    // Load the parallel binning distance
-    c.binningDistance = root.get("binning_distance", 5).asDouble();
+    // Coarse levels are reduced from the finest level, so every resolution has
+    // to be an integer multiple of it
+    for (auto r : c.voxelResolutions)
+    {
+        double ratio = r / c.voxelDistance;
+        if (std::fabs(ratio - std::round(ratio)) > 1e-6 * ratio)
+            throw std::invalid_argument("Configuration voxel_distance " + std::to_string(r) + " is not an integer multiple of the finest resolution");
+    }
+
+    // The thinning bins are a multiple of the coarsest resolution, so every
+    // resolution also has to divide the coarsest one for its voxels to lie
+    // within a single bin
+    int coarsestFactor = ResolutionFactor(c, c.voxelResolutions.size() - 1);
+    for (size_t level = 0; level < c.voxelResolutions.size(); level++)
+    {
+        if (coarsestFactor % ResolutionFactor(c, level) != 0)
+            throw std::invalid_argument("Configuration voxel_distance " + std::to_string(c.voxelResolutions[level]) + " does not divide the coarsest resolution");
+    }
+
+    // Load the thinning distance.  An "auto" distance is estimated from the
+    // spacing of the input files at startup, until then it is zero.
+    c.autoThinningDistance = root.get("thinning_distance", 0).isString() && root["thinning_distance"].asString() == "auto";
+    c.thinningDistance = c.autoThinningDistance ? 0 : root.get("thinning_distance", 0).asDouble();
+
+    // Load the parallel binning distance.  An "auto" distance is chosen from
+    // the density of the input at startup, until then it holds the default.
+    c.autoBinningDistance = root.get("binning_distance", 5).isString() && root["binning_distance"].asString() == "auto";
+    c.binningDistance = c.autoBinningDistance ? 5 : root.get("binning_distance", 5).asDouble();
+
+    // Load the share of the processes which become Readers, and the number of
+    // points in each message from a Reader to a Worker.  An "auto" ratio is
+    // measured at startup, until then it holds the default.
+    c.autoReaderRatio = root.get("reader_ratio", 0.25).isString() && root["reader_ratio"].asString() == "auto";
+    c.readerRatio = c.autoReaderRatio ? 0.25 : root.get("reader_ratio", 0.25).asDouble();
+    if (c.readerRatio <= 0 || c.readerRatio >= 1)
+        throw std::invalid_argument("Configuration reader_ratio must be between 0 and 1, or \"auto\"");
+    c.messagePoints = root.get("message_points", 100).asUInt();
+    if (c.messagePoints < 1)
+        throw std::invalid_argument("Configuration message_points must be at least 1");
+
+    // Load how the Readers read ahead of their parsing: the number of blocks
+    // in flight, the size of each block in megabytes, and whether io_uring is
+    // tried before the read-ahead thread
+    c.readAheadDepth = root.get("read_ahead_depth", 4).asUInt();
+    if (c.readAheadDepth < 1)
+        throw std::invalid_argument("Configuration read_ahead_depth must be at least 1");
+    c.readAheadBytes = root.get("read_ahead_mb", 4).asUInt64() << 20;
+    if (c.readAheadBytes == 0)
+        throw std::invalid_argument("Configuration read_ahead_mb must be at least 1");
+    c.ioUring = root.get("io_uring", true).asBool();
+
+    // Load the size in megabytes of each of the two buffers of the output
+    // files, and whether their full buffers bypass the page cache
+    c.writeBufferBytes = root.get("write_buffer_mb", 4).asUInt64() << 20;
+    if (c.writeBufferBytes == 0)
+        throw std::invalid_argument("Configuration write_buffer_mb must be at least 1");
+    c.directIO = root.get("direct_io", false).asBool();
+
+    // Load the memory budget of each Worker, given in megabytes, where zero
+    // leaves the Workers unlimited
+    c.workerMemoryBudget = root.get("worker_memory_mb", 0).asUInt64() << 20;
+
+    // Load the most points a Worker thins with one tree, where zero thins
+    // every region whole
+    c.regionPointBudget = root.get("region_point_budget", 0).asUInt64();
+
+    // Load whether the Workers thin points as they arrive
+    c.streamingThinning = root.get("streaming_thinning", false).asBool();
+
+    // Load whether the Workers sort each region into Morton order before
+    // building its k-d tree
+    c.mortonOrder = root.get("morton_order", false).asBool();
+
+    // Load the leaf size of the Workers' k-d trees, an "auto" size is measured
+    // at startup
+    c.leafSize = LoadLeafSize(root, c.autoLeafSize);
+
+    // Load the voxel accumulator backend
+    c.voxelBackend = LoadVoxelBackend(root);
+
+    // Load the optional point attribute columns
+    c.attributeColumns = LoadAttributeColumns(root);
+
+    // Load the optional column profile and canopy height raster step
+    c.canopyProducts = root.get("canopy_products", false).asBool();
+    c.groundHeight = root.get("ground_height", 0.5).asDouble();
+    c.groundRadius = root.get("ground_radius", 10.0).asDouble();
+    if (c.groundRadius < 0)
+        throw std::invalid_argument("Configuration ground_radius must not be negative");
+
+    // Resume from a valid checkpoint in the scratch directory if there is one
+    c.resume = root.get("resume", true).asBool();
+
+    // The per-phase timing report written by the Director, empty to disable
+    c.runReport = root.get("run_report", "run_report.json").asString();
 
     c.debug = root.get("debug", false).asBool();
     return c;
 }
 
+TilingConfiguration LoadTilingConfiguration(std::string fileName)
+{
+    Json::Value root;
+    Json::Reader reader;
+    std::ifstream configFile(fileName);
+    std::string data((std::istreambuf_iterator<char>(configFile)), std::istreambuf_iterator<char>());
+
+    auto parsingSuccessful = reader.parse(data, root, false);
+    if (!parsingSuccessful)
+    {
+        throw std::invalid_argument("Failed to parse configuration file, :" + reader.getFormattedErrorMessages());
+    }
+
+    TilingConfiguration c;
+
+    // Load the input files from the "input_files" array
+    Json::Value inputFiles = root["input_files"];
+    if (!inputFiles.isArray() || inputFiles.empty())
+        throw std::invalid_argument("Configuration input_files must be a non-empty array");
+
+    for (auto file : inputFiles)
+    {
+        c.inputFiles.push_back(file.asString());
+    }
+
+    // Load the output prefix, the sorted runs go to the scratch directory
+    c.outputPrefix = root.get("output", "tiles").asString();
+    c.scratchDirectory = root.get("scratch_directory", "./").asString();
+
+    // Load the tile edge length, which is best set to the binning distance
+    c.tileSize = root.get("tile_size", 5).asDouble();
+    if (c.tileSize <= 0)
+        throw std::invalid_argument("Configuration tile_size must be positive");
+
+    // Load the optional point attribute columns
+    c.attributeColumns = LoadAttributeColumns(root);
+
+    // Load the number of points sorted in memory at once, and the number of
+    // threads reading and sorting them, where zero uses every core
+    c.runPoints = root.get("run_points", 1 << 22).asUInt64();
+    if (c.runPoints < 1)
+        throw std::invalid_argument("Configuration run_points must be at least 1");
+    c.threads = root.get("threads", 0).asUInt64();
+
+    // Load the number of runs merged at once, more runs are merged in passes
+    // so the open files stay within the process limit
+    c.mergeRuns = root.get("merge_runs", 64).asUInt64();
+    if (c.mergeRuns < 2)
+        throw std::invalid_argument("Configuration merge_runs must be at least 2");
+
+    return c;
+}
+
+int ResolutionFactor(const ParallelConfiguration& config, size_t level)
+{
+    return static_cast<int>(std::round(config.voxelResolutions[level] / config.voxelResolutions[0]));
+}
+
+double BinSpacing(const ParallelConfiguration& config)
+{
+    double coarsest = config.voxelResolutions.back();
+    int mult = 0;
+    while (coarsest * ++mult < config.binningDistance);
+    return coarsest * mult;
+}
+
+size_t PyramidSourceLevel(const ParallelConfiguration& config, size_t level)
+{
+    int factor = ResolutionFactor(config, level);
+    for (size_t source = level - 1; source > 0; source--)
+    {
+        if (factor % ResolutionFactor(config, source) == 0)
+            return source;
+    }
+    return 0;
+}
+
 std::vector<Vector3d> LoadPointsFromFile(std::string fileName)
+{
+    PointAttributes ignored;
+    return LoadPointsFromFile(fileName, AttributeColumns(), ignored);
+}
+
+std::vector<Vector3d> LoadPointsFromFile(std::string fileName, const AttributeColumns& columns, PointAttributes& attributes)
 {
     std::vector<Vector3d> loaded;
     std::ifstream workingFile(fileName);
@@ -129,6 +381,9 @@ std::vector<Vector3d> LoadPointsFromFile(std::string fileName)
         sz = std::stod(tokens[2]);
 
         loaded.push_back( Vector3d(sx, sy, sz) );
+
+        if (columns.enabled())
+            ParseAttributes(tokens, columns, attributes);
     }
 
     return loaded;
@@ -142,6 +397,10 @@ void PrintConfigDetails(Configuration& config, int prefixSpace)
     std::cout << padding << "voxel bin widths:  " << config.binWidths.Text() << std::endl;
     std::cout << padding << "voxel bin offsets: " << config.binOffsets.Text() << std::endl;
     std::cout << padding << "thinning distance: " << config.thinningDistance << std::endl;
+    std::cout << padding << "voxel backend:     " << config.voxelBackend << std::endl;
+    std::cout << padding << "point attributes:  " << (config.attributeColumns.enabled() ? "enabled" : "disabled") << std::endl;
+    std::cout << padding << "threads:           " << config.threads << std::endl;
+    std::cout << padding << "leaf size:         " << (config.autoLeafSize ? "auto" : std::to_string(config.leafSize)) << std::endl;
 }
 
 void PrintConfigDetails(ParallelConfiguration& config, int prefixSpace)
@@ -154,8 +413,41 @@ void PrintConfigDetails(ParallelConfiguration& config, int prefixSpace)
     }
 
     std::cout << padding << "scratch path:       " << config.scratchDirectory << std::endl;
-    std::cout << padding << "voxel bin widths:  " << config.voxelDistance << std::endl;
-    std::cout << padding << "binning widths:    " << config.binningDistance << std::endl;
-    std::cout << padding << "thinning distance: " << config.thinningDistance << std::endl;
+    for (auto r : config.voxelResolutions)
+    {
+        std::cout << padding << "voxel bin widths:  " << r << std::endl;
+    }
+    std::cout << padding << "binning widths:    " << (config.autoBinningDistance ? "auto" : std::to_string(config.binningDistance)) << std::endl;
+    std::cout << padding << "reader ratio:      " << (config.autoReaderRatio ? "auto" : std::to_string(config.readerRatio)) << std::endl;
+    std::cout << padding << "message points:    " << config.messagePoints << std::endl;
+    std::cout << padding << "read ahead:        " << config.readAheadDepth << " x " << (config.readAheadBytes >> 20) << " MB" << (config.ioUring ? ", io_uring" : "") << std::endl;
+    std::cout << padding << "write buffers:     2 x " << (config.writeBufferBytes >> 20) << " MB" << (config.directIO ? ", direct I/O" : "") << std::endl;
+    std::cout << padding << "worker memory:     " << (config.workerMemoryBudget ? std::to_string(config.workerMemoryBudget >> 20) + " MB" : "unlimited") << std::endl;
+    std::cout << padding << "region budget:     " << (config.regionPointBudget ? std::to_string(config.regionPointBudget) + " points" : "unlimited") << std::endl;
+    std::cout << padding << "thinning distance: " << (config.autoThinningDistance ? "auto" : std::to_string(config.thinningDistance)) << std::endl;
+    std::cout << padding << "stream thinning:   " << config.streamingThinning << std::endl;
+    std::cout << padding << "morton order:      " << config.mortonOrder << std::endl;
+    std::cout << padding << "leaf size:         " << (config.autoLeafSize ? "auto" : std::to_string(config.leafSize)) << std::endl;
+    std::cout << padding << "voxel backend:     " << config.voxelBackend << std::endl;
+    std::cout << padding << "point attributes:  " << (config.attributeColumns.enabled() ? "enabled" : "disabled") << std::endl;
+    std::cout << padding << "canopy products:   " << config.canopyProducts << std::endl;
+    std::cout << padding << "resume checkpoint: " << config.resume << std::endl;
+    std::cout << padding << "run report:        " << config.runReport << std::endl;
     std::cout << padding << "debug output:      " << config.debug << std::endl;
 }
+
+void PrintConfigDetails(TilingConfiguration& config, int prefixSpace)
+{
+    std::string padding = std::string(prefixSpace, ' ');
+    for (auto f : config.inputFiles)
+    {
+        std::cout << padding << "input file:        " << f << std::endl;
+    }
+    std::cout << padding << "output prefix:     " << config.outputPrefix << std::endl;
+    std::cout << padding << "scratch path:      " << config.scratchDirectory << std::endl;
+    std::cout << padding << "tile size:         " << config.tileSize << std::endl;
+    std::cout << padding << "point attributes:  " << (config.attributeColumns.enabled() ? "enabled" : "disabled") << std::endl;
+    std::cout << padding << "run points:        " << config.runPoints << std::endl;
+    std::cout << padding << "merge runs:        " << config.mergeRuns << std::endl;
+    std::cout << padding << "threads:           " << config.threads << std::endl;
+}
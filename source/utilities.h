@@ -23,6 +23,7 @@ Copyright (C) 2016  Matthew Jarvis
 #include <vector>
 #include <string>
 #include "vector3d.h"
+#include "attributes.h"
 
 
 struct Configuration
@@ -32,6 +33,11 @@ struct Configuration
     Vector3d binWidths;
     Vector3d binOffsets;
     double thinningDistance;
+    std::string voxelBackend;
+    AttributeColumns attributeColumns;
+    size_t threads;
+    size_t leafSize;
+    bool autoLeafSize;
 };
 
 struct ParallelConfiguration
@@ -39,17 +45,69 @@ struct ParallelConfiguration
     std::vector<std::string> inputFiles;
     std::string scratchDirectory;
     double voxelDistance;
+    std::vector<double> voxelResolutions;
     double binningDistance;
+    bool autoBinningDistance;
     double thinningDistance;
+    bool autoThinningDistance;
+    double readerRatio;
+    bool autoReaderRatio;
+    size_t messagePoints;
+    size_t readAheadDepth;
+    uint64_t readAheadBytes;
+    bool ioUring;
+    uint64_t writeBufferBytes;
+    bool directIO;
+    uint64_t workerMemoryBudget;
+    size_t regionPointBudget;
+    bool streamingThinning;
+    bool mortonOrder;
+    size_t leafSize;
+    bool autoLeafSize;
+    std::string voxelBackend;
+    AttributeColumns attributeColumns;
+    bool canopyProducts;
+    double groundHeight;
+    double groundRadius;
+    bool resume;
+    std::string runReport;
     bool debug;
 };
 
+struct TilingConfiguration
+{
+    std::vector<std::string> inputFiles;
+    std::string outputPrefix;
+    std::string scratchDirectory;
+    double tileSize;
+    AttributeColumns attributeColumns;
+    size_t runPoints;
+    size_t mergeRuns;
+    size_t threads;
+};
+
 std::vector<Vector3d> LoadPointsFromFile(std::string fileName);
+std::vector<Vector3d> LoadPointsFromFile(std::string fileName, const AttributeColumns& columns, PointAttributes& attributes);
 
 Configuration LoadConfiguration(std::string fileName);
 ParallelConfiguration LoadParallelConfiguration(std::string fileName);
+TilingConfiguration LoadTilingConfiguration(std::string fileName);
+
+// Returns the integer ratio between the spacing of a level of the voxel pyramid
+// and the finest level, which is level 0
+int ResolutionFactor(const ParallelConfiguration& config, size_t level);
+
+// Returns the edge length of the thinning bins, the binning distance rounded up
+// to a multiple of the coarsest voxel resolution so that every voxel of every
+// pyramid level lies entirely within a single bin
+double BinSpacing(const ParallelConfiguration& config);
+
+// Returns the coarsest finer level that the given level of the voxel pyramid
+// can be reduced from by an integer factor
+size_t PyramidSourceLevel(const ParallelConfiguration& config, size_t level);
 
 void PrintConfigDetails(Configuration& config, int prefixSpace);
 void PrintConfigDetails(ParallelConfiguration& config, int prefixSpace);
+void PrintConfigDetails(TilingConfiguration& config, int prefixSpace);
 
 #endif
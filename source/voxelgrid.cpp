@@ -0,0 +1,188 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    The BrickVoxelGrid is a two level voxel intensity accumulator with a sparse
+    map of bricks and dense counter arrays inside of each brick.
+
+*/
+
+#include "voxelgrid.h"
+#include <iostream>
+#include <unordered_set>
+#include <unordered_map>
+#include <stdexcept>
+#include <limits>
+
+// Rough cost of one node in a std::unordered_map, used to estimate the memory
+// of the bricks' own map entries
+#define MAP_NODE_OVERHEAD 48
+
+BrickVoxelGrid::BrickVoxelGrid(int edge_)
+{
+    if (edge_ != 16 && edge_ != 32)
+        throw std::invalid_argument("BrickVoxelGrid edge must be 16 or 32");
+
+    edge = edge_;
+    mask = edge - 1;
+    shift = 0;
+    while ((1 << shift) < edge)
+        shift++;
+}
+
+void BrickVoxelGrid::widen(Brick& brick)
+{
+    brick.wide.assign(brick.narrow.begin(), brick.narrow.end());
+    std::vector<uint16_t>().swap(brick.narrow);
+}
+
+void BrickVoxelGrid::increment(const VoxelAddress& address, uint32_t amount)
+{
+    auto mapIterator = bricks.find(brickOf(address));
+    if (mapIterator == bricks.end())
+    {
+        Brick empty;
+        empty.narrow.assign((size_t)edge * edge * edge, 0);
+        empty.occupied = 0;
+        mapIterator = bricks.insert(std::make_pair(brickOf(address), std::move(empty))).first;
+    }
+
+    Brick& brick = mapIterator->second;
+    size_t offset = offsetOf(address);
+
+    if (brick.wide.empty())
+    {
+        uint32_t current = brick.narrow[offset];
+        if (current == 0)
+            brick.occupied++;
+
+        if (current + amount <= std::numeric_limits<uint16_t>::max())
+        {
+            brick.narrow[offset] = static_cast<uint16_t>(current + amount);
+            return;
+        }
+
+        // This voxel no longer fits in 16 bits, so the whole brick moves to
+        // 32 bit counters
+        widen(brick);
+        brick.wide[offset] = current + amount;
+        return;
+    }
+
+    if (brick.wide[offset] == 0)
+        brick.occupied++;
+    brick.wide[offset] += amount;
+}
+
+uint32_t BrickVoxelGrid::intensity(const VoxelAddress& address) const
+{
+    auto mapIterator = bricks.find(brickOf(address));
+    if (mapIterator == bricks.end())
+        return 0;
+
+    const Brick& brick = mapIterator->second;
+    size_t offset = offsetOf(address);
+    return brick.wide.empty() ? brick.narrow[offset] : brick.wide[offset];
+}
+
+size_t BrickVoxelGrid::occupiedVoxels() const
+{
+    size_t count = 0;
+    for (const auto& pair : bricks)
+        count += pair.second.occupied;
+    return count;
+}
+
+VoxelGridStatistics BrickVoxelGrid::statistics() const
+{
+    VoxelGridStatistics s;
+    s.brickEdge = edge;
+    s.bricks = bricks.size();
+    s.wideBricks = 0;
+    s.occupiedVoxels = 0;
+    s.totalIntensity = 0;
+    s.bytes = 0;
+
+    size_t brickVolume = (size_t)edge * edge * edge;
+    for (const auto& pair : bricks)
+    {
+        const Brick& brick = pair.second;
+        s.occupiedVoxels += brick.occupied;
+        if (brick.wide.empty())
+        {
+            s.bytes += brickVolume * sizeof(uint16_t);
+        }
+        else
+        {
+            s.wideBricks++;
+            s.bytes += brickVolume * sizeof(uint32_t);
+        }
+        s.bytes += sizeof(Brick) + MAP_NODE_OVERHEAD;
+    }
+
+    forEachVoxel([&s](const VoxelAddress&, uint32_t value) { s.totalIntensity += value; });
+
+    s.fillFraction = s.bricks == 0 ? 0 : (double)s.occupiedVoxels / (double)(s.bricks * brickVolume);
+    return s;
+}
+
+std::unordered_map<VoxelAddress, int> BrickVoxelGrid::toSparse() const
+{
+    std::unordered_map<VoxelAddress, int> sparse;
+    sparse.reserve(occupiedVoxels());
+    forEachVoxel([&sparse](const VoxelAddress& a, uint32_t value) { sparse[a] = static_cast<int>(value); });
+    return sparse;
+}
+
+int BrickVoxelGrid::chooseBrickEdge(const std::vector<VoxelAddress>& sample)
+{
+    std::unordered_set<VoxelAddress> voxels(sample.begin(), sample.end());
+    std::unordered_set<VoxelAddress> small;
+    std::unordered_set<VoxelAddress> large;
+    for (auto a : voxels)
+    {
+        small.insert(VoxelAddress(a.i >> 4, a.j >> 4, a.k >> 4));
+        large.insert(VoxelAddress(a.i >> 5, a.j >> 5, a.k >> 5));
+    }
+
+    // Bytes for the dense counters plus the brick map entries
+    size_t smallBytes = small.size() * (16 * 16 * 16 * sizeof(uint16_t) + MAP_NODE_OVERHEAD);
+    size_t largeBytes = large.size() * (32 * 32 * 32 * sizeof(uint16_t) + MAP_NODE_OVERHEAD);
+
+    // Large bricks mean fewer map lookups and longer contiguous runs, so they
+    // are preferred as long as the extra empty voxels stay within 25%
+    return largeBytes * 4 <= smallBytes * 5 ? 32 : 16;
+}
+
+void incrementVoxelIntensity(BrickVoxelGrid& v, const VoxelAddress& address)
+{
+    v.increment(address);
+}
+
+std::unordered_map<VoxelAddress, int> coarsenVoxels(const BrickVoxelGrid& v, int factor)
+{
+    std::unordered_map<VoxelAddress, int> coarse;
+    v.forEachVoxel([&coarse, factor](const VoxelAddress& a, uint32_t value) { coarse[coarsenAddress(a, factor)] += value; });
+    return coarse;
+}
+
+::std::ostream& operator<<(::std::ostream& os, const VoxelGridStatistics& s)
+{
+    return os << s.bricks << " bricks of " << s.brickEdge << "^3 (" << s.wideBricks << " widened), "
+              << s.occupiedVoxels << " occupied voxels, " << s.totalIntensity << " points, "
+              << (s.fillFraction * 100.0) << "% fill, " << s.bytes / 1024 << " KiB";
+}
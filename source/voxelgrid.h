@@ -0,0 +1,125 @@
+/*
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    The BrickVoxelGrid is a two level voxel intensity accumulator intended as
+    an alternative to the std::unordered_map<VoxelAddress, int> used by
+    incrementVoxelIntensity.  Space is divided into cubic bricks of 16^3 or
+    32^3 voxels, the bricks are kept in a sparse map keyed by brick address,
+    and each brick holds a dense array of counters.  Counters start as 16 bit
+    values and a brick is widened to 32 bit counters the first time one of its
+    voxels overflows.
+
+    In dense regions, like the interior of a canopy, this costs two bytes per
+    voxel instead of a hash map node per voxel.  In sparse regions it costs
+    more, so chooseBrickEdge can be used on a sample of addresses to pick
+    a brick size from the estimated footprint.
+
+*/
+#ifndef VOXELGRID_H
+#define VOXELGRID_H
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+#include "voxelsorter.h"
+
+struct VoxelGridStatistics
+{
+    size_t brickEdge;
+    size_t bricks;
+    size_t wideBricks;
+    size_t occupiedVoxels;
+    size_t totalIntensity;
+    size_t bytes;
+    double fillFraction;    // occupied voxels / allocated voxels
+};
+
+class BrickVoxelGrid
+{
+public:
+    BrickVoxelGrid(int edge = 16);
+
+    void increment(const VoxelAddress& address, uint32_t amount = 1);
+    uint32_t intensity(const VoxelAddress& address) const;
+
+    inline int brickEdge() const { return edge; }
+    inline size_t numberOfBricks() const { return bricks.size(); }
+    size_t occupiedVoxels() const;
+
+    VoxelGridStatistics statistics() const;
+
+    // Converts the grid to the sparse representation used by the rest of the
+    // program, only occupied voxels are included
+    std::unordered_map<VoxelAddress, int> toSparse() const;
+
+    // Calls f(VoxelAddress, uint32_t) for every occupied voxel in the grid
+    template <typename F> void forEachVoxel(F f) const;
+
+    // Estimates the memory needed to hold the sampled addresses in 16^3 and
+    // 32^3 bricks and returns 32 when the larger bricks cost at most 25% more
+    // than the smaller ones, otherwise 16
+    static int chooseBrickEdge(const std::vector<VoxelAddress>& sample);
+
+private:
+    struct Brick
+    {
+        std::vector<uint16_t> narrow;
+        std::vector<uint32_t> wide;
+        size_t occupied;
+    };
+
+    int edge;
+    int shift;
+    int mask;
+    std::unordered_map<VoxelAddress, Brick> bricks;
+
+    inline VoxelAddress brickOf(const VoxelAddress& a) const { return VoxelAddress(a.i >> shift, a.j >> shift, a.k >> shift); }
+    inline size_t offsetOf(const VoxelAddress& a) const { return ((size_t)(a.k & mask) << (2 * shift)) | ((size_t)(a.j & mask) << shift) | (size_t)(a.i & mask); }
+    void widen(Brick& brick);
+};
+
+template <typename F> void BrickVoxelGrid::forEachVoxel(F f) const
+{
+    for (const auto& pair : bricks)
+    {
+        const Brick& brick = pair.second;
+        size_t n = (size_t)edge * edge * edge;
+        for (size_t offset = 0; offset < n; offset++)
+        {
+            uint32_t value = brick.wide.empty() ? brick.narrow[offset] : brick.wide[offset];
+            if (value == 0)
+                continue;
+
+            int li = offset & mask;
+            int lj = (offset >> shift) & mask;
+            int lk = (offset >> (2 * shift)) & mask;
+            f(VoxelAddress(pair.first.i * edge + li, pair.first.j * edge + lj, pair.first.k * edge + lk), value);
+        }
+    }
+}
+
+void incrementVoxelIntensity(BrickVoxelGrid&, const VoxelAddress&);
+
+// Aggregates a brick grid into a sparse map of voxels that are `factor` times
+// larger on each side
+std::unordered_map<VoxelAddress, int> coarsenVoxels(const BrickVoxelGrid&, int factor);
+
+::std::ostream& operator<<(::std::ostream& os, const VoxelGridStatistics& s);
+
+#endif
@@ -98,3 +98,11 @@ void incrementVoxelIntensity(std::unordered_map<VoxelAddress, int>& v, const Vox
         mapIterator->second += 1;
     }
 }
+
+std::unordered_map<VoxelAddress, int> coarsenVoxels(const std::unordered_map<VoxelAddress, int>& v, int factor)
+{
+    std::unordered_map<VoxelAddress, int> coarse;
+    for (const auto& voxel : v)
+        coarse[coarsenAddress(voxel.first, factor)] += voxel.second;
+    return coarse;
+}
@@ -64,6 +64,18 @@ namespace std
 
 void incrementVoxelIntensity(std::unordered_map<VoxelAddress, int>&, const VoxelAddress&);
 
+// Returns the address of the voxel that is `factor` times larger on each side
+// and contains the given voxel, assuming both grids share the same origin
+inline VoxelAddress coarsenAddress(const VoxelAddress& a, int factor)
+{
+    auto floorDiv = [factor](int n) { return n >= 0 ? n / factor : -((-n + factor - 1) / factor); };
+    return VoxelAddress(floorDiv(a.i), floorDiv(a.j), floorDiv(a.k));
+}
+
+// Aggregates a sparse voxel map into voxels that are `factor` times larger
+// on each side
+std::unordered_map<VoxelAddress, int> coarsenVoxels(const std::unordered_map<VoxelAddress, int>&, int factor);
+
 ::std::ostream& operator<<(::std::ostream& os, const VoxelAddress& a);
 
 inline bool operator==(const VoxelAddress& lhs, const VoxelAddress& rhs) {return lhs.i == rhs.i && lhs.j == rhs.j && lhs.k == rhs.k;}
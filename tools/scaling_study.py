@@ -0,0 +1,237 @@
+#!/usr/bin/env python3
+"""
+This file is part of Canopy_Vox, the Parallel Forest Canopy Voxel Generator.
+
+Canopy_Vox is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Canopy_Vox is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License v3
+along with Canopy_Vox.  If not, see <http://www.gnu.org/licenses/>.
+
+Copyright (C) 2016   Matthew Jarvis
+
+    Strong and weak scaling study of mpi_voxels on a local machine.
+
+    The harness generates a synthetic canopy with the synthetic_canopy tool,
+    then runs mpi_voxels through mpirun for every combination of rank count,
+    reader ratio, binning distance and message size.  Each run gets its own
+    directory holding its configuration, scratch files, results and the
+    per-phase run report.  The results are written as a CSV file with one
+    row per run and as speedup and efficiency tables.
+
+    Strong scaling keeps the dataset fixed as the rank count grows.  Weak
+    scaling generates a dataset for each rank count with the same number of
+    points per Worker.  Speedup and efficiency are relative to the smallest
+    rank count of each group of otherwise identical runs.
+
+    Example:
+        tools/scaling_study.py --ranks 3 5 9 --reader-ratios 0.25 0.34 \\
+            --binning 2 5 --points 2000000 --mpirun-args="--oversubscribe"
+"""
+
+import argparse
+import csv
+import itertools
+import json
+import os
+import shutil
+import subprocess
+import sys
+import time
+
+PHASES = ["parse", "read_scratch", "send", "wait", "receive", "tree_build", "thinning", "voxelize", "write", "combine", "spill"]
+
+
+def parse_arguments():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    p = argparse.ArgumentParser(description="Strong and weak scaling study of mpi_voxels")
+    p.add_argument("--mode", choices=["strong", "weak", "both"], default="strong")
+    p.add_argument("--ranks", type=int, nargs="+", default=[3, 5, 9])
+    p.add_argument("--reader-ratios", type=float, nargs="+", default=[0.25])
+    p.add_argument("--binning", type=float, nargs="+", default=[5.0])
+    p.add_argument("--message-points", type=int, nargs="+", default=[100])
+    p.add_argument("--points", type=int, default=2000000, help="points in the strong scaling dataset")
+    p.add_argument("--points-per-worker", type=int, default=500000, help="points per Worker in the weak scaling datasets")
+    p.add_argument("--stations", type=int, default=8, help="scan stations, each written to its own input file")
+    p.add_argument("--thinning", type=float, default=0.01)
+    p.add_argument("--voxel", type=float, default=0.1)
+    p.add_argument("--repeat", type=int, default=1, help="runs per configuration, the fastest is kept")
+    p.add_argument("--startup-delay", type=float, default=2.0,
+                   help="fixed delay of the Reader and Worker constructors, subtracted from the wall time")
+    p.add_argument("--mpirun", default="mpirun")
+    p.add_argument("--mpirun-args", default="--oversubscribe", help="extra mpirun arguments, split on spaces")
+    p.add_argument("--bin", default=os.path.join(root, "bin"), help="directory with mpi_voxels and synthetic_canopy")
+    p.add_argument("--workdir", default="scaling_study")
+    p.add_argument("--keep", action="store_true", help="keep the results and scratch files of every run")
+    return p.parse_args()
+
+
+def workers_for(ranks, ratio, input_bytes):
+    """Mirrors the role split of the Directory class in mpi_voxels, where each
+    Reader is given at least a megabyte of input"""
+    readers = min(int(ranks * ratio), input_bytes // (1 << 20))
+    if ranks > 2:
+        readers = min(readers, ranks - 2)
+    return ranks - 1 - max(1, readers)
+
+
+def generate_dataset(args, name, points):
+    """Writes a synthetic canopy with one file per station, reusing an existing one"""
+    prefix = os.path.join(args.workdir, "data", name)
+    files = [prefix + "_s%d.asc" % s for s in range(args.stations)]
+    if all(os.path.exists(f) for f in files):
+        return files
+
+    os.makedirs(os.path.dirname(prefix), exist_ok=True)
+    settings = {"output": prefix, "points": points, "stations": args.stations, "split_stations": True,
+                "chunk_size": max(1, points // (4 * args.stations))}
+    config = prefix + ".json"
+    with open(config, "w") as f:
+        json.dump(settings, f, indent=4)
+
+    print("Generating %d points into %s" % (points, prefix), flush=True)
+    subprocess.run([os.path.join(args.bin, "synthetic_canopy"), config], check=True, stdout=subprocess.DEVNULL)
+    return [f for f in files if os.path.getsize(f) > 0]
+
+
+def run_once(args, run_dir, ranks, config):
+    """Runs mpi_voxels in its own directory and returns the parsed run report"""
+    if os.path.exists(run_dir):
+        shutil.rmtree(run_dir)
+    os.makedirs(os.path.join(run_dir, "scratch"))
+
+    config = dict(config)
+    config["scratch_directory"] = os.path.join(os.path.abspath(run_dir), "scratch", "")
+    config["run_report"] = "run_report.json"
+    config["resume"] = False
+    with open(os.path.join(run_dir, "config.json"), "w") as f:
+        json.dump(config, f, indent=4)
+
+    command = [args.mpirun, "-np", str(ranks)] + args.mpirun_args.split() + \
+              [os.path.abspath(os.path.join(args.bin, "mpi_voxels")), "config.json"]
+    start = time.time()
+    with open(os.path.join(run_dir, "output.log"), "w") as log:
+        result = subprocess.run(command, cwd=run_dir, stdout=log, stderr=subprocess.STDOUT)
+    elapsed = time.time() - start
+
+    if result.returncode != 0:
+        raise RuntimeError("mpi_voxels failed in %s, see output.log" % run_dir)
+
+    with open(os.path.join(run_dir, "run_report.json")) as f:
+        report = json.load(f)
+    report["launch_seconds"] = elapsed
+
+    if not args.keep:
+        for name in os.listdir(run_dir):
+            if name.startswith("combined_results"):
+                os.remove(os.path.join(run_dir, name))
+        shutil.rmtree(os.path.join(run_dir, "scratch"), ignore_errors=True)
+    return report
+
+
+def run_sweep(args, mode):
+    rows = []
+    sweep = itertools.product(args.reader_ratios, args.binning, args.message_points, args.ranks)
+    for ratio, binning, message, ranks in sweep:
+        if mode == "strong":
+            files = generate_dataset(args, "strong", args.points)
+        else:
+            workers = workers_for(ranks, ratio, float("inf"))
+            files = generate_dataset(args, "weak_%d" % workers, workers * args.points_per_worker)
+
+        if workers_for(ranks, ratio, sum(os.path.getsize(f) for f in files)) < 1:
+            print("Skipping %d ranks with reader ratio %g, there would be no Workers" % (ranks, ratio))
+            continue
+
+        config = {"input_files": [os.path.abspath(f) for f in files], "thinning_distance": args.thinning,
+                  "binning_distance": binning, "voxel_distance": args.voxel, "reader_ratio": ratio,
+                  "message_points": message}
+
+        name = "%s_r%d_ratio%g_bin%g_msg%d" % (mode, ranks, ratio, binning, message)
+        best = None
+        for attempt in range(args.repeat):
+            print("Running %s (%d of %d)" % (name, attempt + 1, args.repeat), flush=True)
+            report = run_once(args, os.path.join(args.workdir, "runs", name), ranks, config)
+            if best is None or report["wall_seconds"] < best["wall_seconds"]:
+                best = report
+
+        row = {"mode": mode, "ranks": ranks, "readers": best["readers"], "workers": best["workers"],
+               "reader_ratio": ratio, "binning": binning, "message_points": message,
+               "wall_seconds": best["wall_seconds"],
+               "work_seconds": max(best["wall_seconds"] - args.startup_delay, 1e-9)}
+        for phase in PHASES:
+            summary = best["phases"].get(phase)
+            row[phase + "_median"] = summary["seconds"]["median"] if summary else 0
+            row[phase + "_max"] = summary["seconds"]["max"] if summary else 0
+        rows.append(row)
+    return rows
+
+
+def add_scaling(rows):
+    """Adds the speedup and efficiency of each row relative to the smallest rank
+    count with the same mode, reader ratio, binning and message size"""
+    key = lambda r: (r["mode"], r["reader_ratio"], r["binning"], r["message_points"])
+    for group_key, group in itertools.groupby(sorted(rows, key=lambda r: key(r) + (r["ranks"],)), key=key):
+        group = list(group)
+        base = group[0]
+        for r in group:
+            ratio = r["workers"] / float(base["workers"])
+            if r["mode"] == "strong":
+                r["speedup"] = base["work_seconds"] / r["work_seconds"]
+                r["efficiency"] = r["speedup"] / ratio
+            else:
+                r["efficiency"] = base["work_seconds"] / r["work_seconds"]
+                r["speedup"] = r["efficiency"] * ratio
+
+
+def print_tables(rows, out):
+    key = lambda r: (r["mode"], r["reader_ratio"], r["binning"], r["message_points"])
+    for group_key, group in itertools.groupby(sorted(rows, key=lambda r: key(r) + (r["ranks"],)), key=key):
+        mode, ratio, binning, message = group_key
+        out.write("\n%s scaling, reader ratio %g, binning %g, %d points per message\n\n" % (mode, ratio, binning, message))
+        out.write("| ranks | readers | workers | seconds | speedup | efficiency | slowest phase |\n")
+        out.write("|------:|--------:|--------:|--------:|--------:|-----------:|:--------------|\n")
+        for r in group:
+            slowest = max(PHASES, key=lambda p: r[p + "_max"] if p != "wait" else -1)
+            out.write("| %d | %d | %d | %.2f | %.2f | %.2f | %s (%.2f s) |\n" % (
+                r["ranks"], r["readers"], r["workers"], r["work_seconds"], r["speedup"], r["efficiency"],
+                slowest, r[slowest + "_max"]))
+
+
+def main():
+    args = parse_arguments()
+    os.makedirs(args.workdir, exist_ok=True)
+
+    rows = []
+    for mode in (["strong", "weak"] if args.mode == "both" else [args.mode]):
+        rows.extend(run_sweep(args, mode))
+
+    if not rows:
+        print("No runs were made")
+        return 1
+
+    add_scaling(rows)
+
+    csv_name = os.path.join(args.workdir, "scaling_results.csv")
+    with open(csv_name, "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=list(rows[0].keys()))
+        writer.writeheader()
+        writer.writerows(rows)
+
+    table_name = os.path.join(args.workdir, "scaling_results.md")
+    with open(table_name, "w") as f:
+        print_tables(rows, f)
+    print_tables(rows, sys.stdout)
+    print("\nWrote %s and %s" % (csv_name, table_name))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())